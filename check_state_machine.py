@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# Check that the transition table in src/state_machine.cpp and the diagram
+# in state_machine.dot describe the same state machine.
+#
+# Every state change in the table must appear as an edge in the diagram and
+# vice versa. Internal (STAY) transitions are not drawn.
+
+import re
+import sys
+
+TABLE_FILE = 'src/state_machine.cpp'
+DOT_FILE = 'state_machine.dot'
+
+ROW_RE = re.compile(
+    r'\{\s*(\w+),\s*(EV_\w+),\s*(\w+),\s*(\w+),\s*(\w+)\s*\}')
+EDGE_RE = re.compile(r'^\s*(\w+)\s*->\s*(\w+)', re.MULTILINE)
+NODE_RE = re.compile(r'^\s*(\w+)\s*\[', re.MULTILINE)
+
+
+def table_edges(source):
+    # only look at the transition table itself
+    start = source.index('transitions[] = {')
+    end = source.index('};', start)
+    edges = set()
+    for state, event, guard, action, next_state in ROW_RE.findall(
+            source[start:end]):
+        if next_state != 'STAY':
+            edges.add((state, next_state))
+    return edges
+
+
+def main():
+    with open(TABLE_FILE) as f:
+        table = table_edges(f.read())
+    with open(DOT_FILE) as f:
+        dot_source = f.read()
+    dot = set(EDGE_RE.findall(dot_source))
+    nodes = set(NODE_RE.findall(dot_source)) - {'graph', 'node', 'edge'}
+
+    ok = True
+    for a, b in sorted(table - dot):
+        print('%s: %s -> %s missing from %s' % (TABLE_FILE, a, b, DOT_FILE))
+        ok = False
+    for a, b in sorted(dot - table):
+        print('%s: %s -> %s not in the transition table' % (DOT_FILE, a, b))
+        ok = False
+    for a, b in sorted(table | dot):
+        for state in (a, b):
+            if state not in nodes:
+                print('%s: no node for %s' % (DOT_FILE, state))
+                nodes.add(state)
+                ok = False
+
+    if ok:
+        print('%d transitions match' % len(table))
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,355 @@
+#include "analog_io.h"
+
+#include "constants.h"
+#include "idle.h"
+#include "timing.h"
+
+void init_ADC1() {
+//                              30 MHz / 32 = 937 kHz,  32 MHz / 32 =  1 MHz.
+#if F_CPU > 24000000  // 24 MHz / 16 = 1.5 MHz,  25 MHz / 32 =  780 kHz
+  ADC1.CTRLC = ADC_PRESC_DIV32_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
+#elif F_CPU >= 12000000  // 16 MHz / 16 = 1.0 MHz,  20 MHz / 16 = 1.25 MHz
+  ADC1.CTRLC = ADC_PRESC_DIV16_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
+#elif F_CPU >= 6000000   //  8 MHz /  8 = 1.0 MHz,  10 MHz /  8 = 1.25 MHz
+  ADC1.CTRLC = ADC_PRESC_DIV8_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
+#elif F_CPU >= 3000000   //  4 MHz /  4 = 1.0 MHz,   5 MHz /  4 = 1.25 MHz
+  ADC1.CTRLC = ADC_PRESC_DIV4_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
+#else                    //  1 MHz /  2 = 500 kHz - the lowest setting
+  ADC1.CTRLC = ADC_PRESC_DIV2_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
+#endif
+#if (F_CPU == 6000000 || F_CPU == 12000000 || F_CPU == 24000000 || \
+     F_CPU == 25000000)
+  ADC1.SAMPCTRL = (7);  // 9 ADC clocks, 12 us
+#elif (F_CPU == 5000000 || F_CPU == 10000000 || F_CPU == 20000000)
+  ADC1.SAMPCTRL = (13);  // 15 ADC clock,s 12 us
+#else
+  ADC1.SAMPCTRL = (10);  // 12 ADC clocks, 12 us
+#endif
+  ADC1.CTRLD = ADC_INITDLY_DLY16_gc;
+  ADC1.CTRLA = ADC_ENABLE_bm;
+}
+
+void att1s_analog_reference_adc0(uint8_t mode) {
+  switch (mode) {
+#if defined(EXTERNAL)
+    case EXTERNAL:
+#endif
+    case VDD:
+      VREF.CTRLB &= ~VREF_ADC0REFEN_bm;  // Turn off force-adc-reference-enable
+      ADC0.CTRLC =
+          (ADC0.CTRLC & ~(ADC_REFSEL_gm)) | mode |
+          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v -
+                           // we don't *KNOW* the external reference will be
+                           // >1v, but it's probably more likely...
+      // VREF.CTRLA does not need to be reconfigured, as the voltage references
+      // only supply their specified voltage when requested to do so by the ADC.
+      break;
+    case INTERNAL0V55:
+      VREF.CTRLA = VREF.CTRLA &
+                   ~(VREF_ADC0REFSEL_gm);  // These bits are all 0 for 0.55v
+                                           // reference, so no need to do the
+                                           // mode << VREF_ADC0REFSEL_gp here;
+      ADC0.CTRLC =
+          (ADC0.CTRLC & ~(ADC_REFSEL_gm | ADC_SAMPCAP_bm)) |
+          INTERNAL;  // per datasheet, recommended SAMPCAP=0 at ref < 1v
+      VREF.CTRLB |= VREF_ADC0REFEN_bm;  // Turn off force-adc-reference-enable
+      break;
+    case INTERNAL1V1:
+    case INTERNAL2V5:
+    case INTERNAL4V34:
+    case INTERNAL1V5:
+      VREF.CTRLA =
+          (VREF.CTRLA & ~(VREF_ADC0REFSEL_gm)) | (mode << VREF_ADC0REFSEL_gp);
+      ADC0.CTRLC =
+          (ADC0.CTRLC & ~(ADC_REFSEL_gm)) | INTERNAL |
+          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v
+      break;
+  }
+}
+
+void att1s_analog_reference_adc1(uint8_t mode) {
+  switch (mode) {
+#if defined(EXTERNAL)
+    case EXTERNAL:
+#endif
+    case VDD:
+      VREF.CTRLB &= ~VREF_ADC1REFEN_bm;  // Turn off force-adc-reference-enable
+      ADC1.CTRLC =
+          (ADC1.CTRLC & ~(ADC_REFSEL_gm)) | mode |
+          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v -
+                           // we don't *KNOW* the external reference will be
+                           // >1v, but it's probably more likely...
+      // VREF.CTRLA does not need to be reconfigured, as the voltage references
+      // only supply their specified voltage when requested to do so by the ADC.
+      break;
+    case INTERNAL0V55:
+      VREF.CTRLC = VREF.CTRLC &
+                   ~(VREF_ADC1REFSEL_gm);  // These bits are all 0 for 0.55v
+                                           // reference, so no need to do the
+                                           // mode << VREF_ADC1REFSEL_gp here;
+      ADC1.CTRLC =
+          (ADC1.CTRLC & ~(ADC_REFSEL_gm | ADC_SAMPCAP_bm)) |
+          INTERNAL;  // per datasheet, recommended SAMPCAP=0 at ref < 1v
+      VREF.CTRLB |= VREF_ADC1REFEN_bm;  // Turn off force-adc-reference-enable
+      break;
+    case INTERNAL1V1:
+    case INTERNAL2V5:
+    case INTERNAL4V34:
+    case INTERNAL1V5:
+      VREF.CTRLC =
+          (VREF.CTRLC & ~(VREF_ADC1REFSEL_gm)) | (mode << VREF_ADC1REFSEL_gp);
+      ADC1.CTRLC =
+          (ADC1.CTRLC & ~(ADC_REFSEL_gm)) | INTERNAL |
+          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v
+      break;
+  }
+}
+
+//////
+// Interrupt-driven ADC sampler
+
+// Channel table. Entries for the same ADC are converted in table order.
+const AdcChannel adc_channels[NUM_ADC_CHANNELS] = {
+    {V_CAP_ADC_NUM, V_CAP_ADC_AIN, true},  // ADC_CH_V_CAP
+    {V_IN_ADC_NUM, V_IN_ADC_AIN, true},    // ADC_CH_V_IN
+    {I_IN_ADC_NUM, I_IN_ADC_AIN, true},    // ADC_CH_I_IN
+    {0, ADC_TEMPSENSE, false},             // ADC_CH_TEMP
+};
+
+// Per-channel result slots, written by the RESRDY ISRs
+static volatile uint16_t adc_results[NUM_ADC_CHANNELS];
+
+// Channel currently being converted on each ADC
+static volatile uint8_t adc_current_channel[2];
+// Set if the next result on the ADC is a throwaway settling conversion
+static volatile bool adc_discard_next[2];
+static_assert(ADC_SAMPNUM_ACC64_gc == ADC_MAX_OVERSAMPLE_LOG2,
+              "SAMPNUM values must equal log2 of the sample count");
+
+// Oversampling setting in use for the current conversion on each ADC
+static volatile uint8_t adc_conversion_log2[2];
+// Oversampling setting applied to the oversampled channels
+static volatile uint8_t adc_oversample_log2 = ADC_OVERSAMPLE_LOG2;
+// Bit n is set while ADCn is still working through a sweep
+static volatile uint8_t adc_busy_mask = 0;
+// Incremented every time both ADCs have completed a sweep
+static volatile uint8_t adc_sweep_count = 0;
+
+// Power-fail monitor state
+static volatile bool power_fail_armed = false;
+static volatile bool power_fail_detected = false;
+static volatile uint32_t power_fail_timestamp;
+static volatile uint16_t power_fail_threshold;
+static volatile uint16_t power_fail_reading;
+
+static inline ADC_t& adc_peripheral(uint8_t adc_num) {
+  return adc_num == 0 ? ADC0 : ADC1;
+}
+
+/**
+ * @brief Find the next channel in the table that belongs to the given ADC.
+ *
+ * @param adc_num ADC number
+ * @param from First table index to consider
+ * @return Channel index or NUM_ADC_CHANNELS if there are none left
+ */
+static uint8_t adc_next_channel(uint8_t adc_num, uint8_t from) {
+  for (uint8_t i = from; i < NUM_ADC_CHANNELS; i++) {
+    if (adc_channels[i].adc_num == adc_num) {
+      return i;
+    }
+  }
+  return NUM_ADC_CHANNELS;
+}
+
+static void adc_start_channel(uint8_t adc_num, uint8_t channel) {
+  ADC_t& adc = adc_peripheral(adc_num);
+  adc_current_channel[adc_num] = channel;
+  // the first conversion after a mux change is discarded to let the
+  // sample and hold capacitor settle
+  adc_discard_next[adc_num] = true;
+  // the settling conversion is a single sample
+  adc.CTRLB = ADC_SAMPNUM_ACC1_gc;
+  adc.MUXPOS = adc_channels[channel].ain;
+  adc.COMMAND = ADC_STCONV_bm;
+}
+
+static void power_fail_trigger(uint16_t reading) {
+  power_fail_timestamp = timing_now();
+  power_fail_reading = reading;
+  power_fail_detected = true;
+  power_fail_armed = false;
+  idle_wake();
+}
+
+// Let ADC0 free-run on V_IN with the window comparator enabled. Called
+// with interrupts disabled or from an ADC0 interrupt.
+static void power_fail_monitor_start() {
+  ADC0.INTCTRL = 0;
+  ADC0.CTRLB = ADC_POWER_FAIL_SAMPNUM;
+  ADC0.MUXPOS = V_IN_ADC_AIN;
+  // SAMPNUM values equal log2 of the sample count
+  ADC0.WINLT = power_fail_threshold << ADC_POWER_FAIL_SAMPNUM;
+  ADC0.CTRLE = ADC_WINCM_BELOW_gc;
+  ADC0.INTFLAGS = ADC_RESRDY_bm | ADC_WCMP_bm;
+  ADC0.INTCTRL = ADC_WCMP_bm;
+  ADC0.CTRLA |= ADC_FREERUN_bm;
+  ADC0.COMMAND = ADC_STCONV_bm;
+}
+
+// Return ADC0 to single conversions. Called with interrupts disabled or
+// from an ADC0 interrupt.
+static void power_fail_monitor_stop() {
+  ADC0.INTCTRL = 0;
+  ADC0.CTRLE = ADC_WINCM_NONE_gc;
+  // disabling the ADC aborts the conversion in progress
+  ADC0.CTRLA = 0;
+  ADC0.CTRLA = ADC_ENABLE_bm;
+  ADC0.INTFLAGS = ADC_RESRDY_bm | ADC_WCMP_bm;
+  ADC0.INTCTRL = ADC_RESRDY_bm;
+}
+
+ISR(ADC0_WCOMP_vect) {
+  uint16_t reading = ADC0.RES >> ADC_POWER_FAIL_SAMPNUM;
+  power_fail_monitor_stop();
+  power_fail_trigger(reading);
+}
+
+static void adc_handle_result(uint8_t adc_num) {
+  ADC_t& adc = adc_peripheral(adc_num);
+  // reading RES also clears the RESRDY flag
+  uint16_t result = adc.RES;
+
+  uint8_t channel = adc_current_channel[adc_num];
+
+  if (adc_discard_next[adc_num]) {
+    adc_discard_next[adc_num] = false;
+    uint8_t log2_samples =
+        adc_channels[channel].oversample ? adc_oversample_log2 : 0;
+    adc_conversion_log2[adc_num] = log2_samples;
+    // SAMPNUM group configuration values equal log2 of the sample count
+    adc.CTRLB = log2_samples;
+    adc.COMMAND = ADC_STCONV_bm;
+    return;
+  }
+
+  if (adc_channels[channel].oversample) {
+    result = adc_decimate(result, adc_conversion_log2[adc_num]);
+  }
+  adc_results[channel] = result;
+
+  // the monitor is paused during sweeps, so check the sweep's reading
+  if (channel == ADC_CH_V_IN && power_fail_armed &&
+      (result >> 6) < power_fail_threshold) {
+    power_fail_trigger(result >> 6);
+  }
+
+  channel = adc_next_channel(adc_num, channel + 1);
+  if (channel < NUM_ADC_CHANNELS) {
+    adc_start_channel(adc_num, channel);
+    return;
+  }
+
+  adc_busy_mask &= ~(1 << adc_num);
+  if (adc_num == 0 && power_fail_armed) {
+    power_fail_monitor_start();
+  }
+  if (adc_busy_mask == 0) {
+    adc_sweep_count++;
+    idle_wake();
+  }
+}
+
+ISR(ADC0_RESRDY_vect) { adc_handle_result(0); }
+
+ISR(ADC1_RESRDY_vect) { adc_handle_result(1); }
+
+void adc_sampler_set_oversampling(uint8_t log2_samples) {
+  if (log2_samples > ADC_MAX_OVERSAMPLE_LOG2) {
+    log2_samples = ADC_MAX_OVERSAMPLE_LOG2;
+  }
+  adc_oversample_log2 = log2_samples;
+}
+
+uint8_t adc_sampler_get_oversampling() { return adc_oversample_log2; }
+
+void adc_sampler_init() {
+  ADC0.INTFLAGS = ADC_RESRDY_bm;
+  ADC1.INTFLAGS = ADC_RESRDY_bm;
+  ADC0.INTCTRL = ADC_RESRDY_bm;
+  ADC1.INTCTRL = ADC_RESRDY_bm;
+}
+
+bool adc_sampler_start() {
+  if (adc_busy_mask) {
+    return false;
+  }
+
+  for (uint8_t adc_num = 0; adc_num < 2; adc_num++) {
+    uint8_t channel = adc_next_channel(adc_num, 0);
+    if (channel < NUM_ADC_CHANNELS) {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (adc_num == 0 && power_fail_armed) {
+          // the sweep takes over ADC0 from the power-fail monitor
+          power_fail_monitor_stop();
+        }
+        // set the busy bit before the conversion can complete
+        adc_busy_mask |= 1 << adc_num;
+        adc_start_channel(adc_num, channel);
+      }
+    }
+  }
+  return true;
+}
+
+bool adc_sampler_read(uint16_t* results) {
+  static uint8_t last_sweep_count = 0;
+
+  if (adc_busy_mask || adc_sweep_count == last_sweep_count) {
+    return false;
+  }
+  last_sweep_count = adc_sweep_count;
+
+  // No sweep is running, so the ISRs are not touching the slots
+  for (uint8_t i = 0; i < NUM_ADC_CHANNELS; i++) {
+    results[i] = adc_results[i];
+  }
+  return true;
+}
+
+void adc_power_fail_arm(uint16_t threshold) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    power_fail_threshold = threshold;
+    power_fail_detected = false;
+    if (!power_fail_armed) {
+      power_fail_armed = true;
+      // a running sweep hands ADC0 over once it is done with it
+      if (!(adc_busy_mask & 0x01)) {
+        power_fail_monitor_start();
+      }
+    }
+  }
+}
+
+void adc_power_fail_disarm() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (power_fail_armed) {
+      power_fail_armed = false;
+      if (!(adc_busy_mask & 0x01)) {
+        power_fail_monitor_stop();
+      }
+    }
+    power_fail_detected = false;
+  }
+}
+
+bool adc_power_fail_take(uint32_t& timestamp, uint16_t& reading) {
+  bool detected;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    detected = power_fail_detected;
+    power_fail_detected = false;
+    timestamp = power_fail_timestamp;
+    reading = power_fail_reading;
+  }
+  return detected;
+}
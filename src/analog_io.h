@@ -1,7 +1,7 @@
 #ifndef SH_RPI_FIRMWARE_SRC_ANALOG_IO_H_
 #define SH_RPI_FIRMWARE_SRC_ANALOG_IO_H_
 
-#include <Arduino.h>
+#include "hal.h"
 
 #define AIN0 0x00
 #define AIN1 0x01
@@ -21,30 +21,7 @@
  * @brief Replacement definition of the buggy megaTinyCore init_ADC1()
  *
  */
-void init_ADC1() {
-//                              30 MHz / 32 = 937 kHz,  32 MHz / 32 =  1 MHz.
-#if F_CPU > 24000000  // 24 MHz / 16 = 1.5 MHz,  25 MHz / 32 =  780 kHz
-  ADC1.CTRLC = ADC_PRESC_DIV32_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
-#elif F_CPU >= 12000000  // 16 MHz / 16 = 1.0 MHz,  20 MHz / 16 = 1.25 MHz
-  ADC1.CTRLC = ADC_PRESC_DIV16_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
-#elif F_CPU >= 6000000   //  8 MHz /  8 = 1.0 MHz,  10 MHz /  8 = 1.25 MHz
-  ADC1.CTRLC = ADC_PRESC_DIV8_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
-#elif F_CPU >= 3000000   //  4 MHz /  4 = 1.0 MHz,   5 MHz /  4 = 1.25 MHz
-  ADC1.CTRLC = ADC_PRESC_DIV4_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
-#else                    //  1 MHz /  2 = 500 kHz - the lowest setting
-  ADC1.CTRLC = ADC_PRESC_DIV2_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
-#endif
-#if (F_CPU == 6000000 || F_CPU == 12000000 || F_CPU == 24000000 || \
-     F_CPU == 25000000)
-  ADC1.SAMPCTRL = (7);  // 9 ADC clocks, 12 us
-#elif (F_CPU == 5000000 || F_CPU == 10000000 || F_CPU == 20000000)
-  ADC1.SAMPCTRL = (13);  // 15 ADC clock,s 12 us
-#else
-  ADC1.SAMPCTRL = (10);  // 12 ADC clocks, 12 us
-#endif
-  ADC1.CTRLD = ADC_INITDLY_DLY16_gc;
-  ADC1.CTRLA = ADC_ENABLE_bm;
-}
+void init_ADC1();
 
 /**
  * @brief Set the analog reference for ADC0
@@ -54,43 +31,7 @@ void init_ADC1() {
  *
  * @param mode Reference mode
  */
-void att1s_analog_reference_adc0(uint8_t mode) {
-  switch (mode) {
-#if defined(EXTERNAL)
-    case EXTERNAL:
-#endif
-    case VDD:
-      VREF.CTRLB &= ~VREF_ADC0REFEN_bm;  // Turn off force-adc-reference-enable
-      ADC0.CTRLC =
-          (ADC0.CTRLC & ~(ADC_REFSEL_gm)) | mode |
-          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v -
-                           // we don't *KNOW* the external reference will be
-                           // >1v, but it's probably more likely...
-      // VREF.CTRLA does not need to be reconfigured, as the voltage references
-      // only supply their specified voltage when requested to do so by the ADC.
-      break;
-    case INTERNAL0V55:
-      VREF.CTRLA = VREF.CTRLA &
-                   ~(VREF_ADC0REFSEL_gm);  // These bits are all 0 for 0.55v
-                                           // reference, so no need to do the
-                                           // mode << VREF_ADC0REFSEL_gp here;
-      ADC0.CTRLC =
-          (ADC0.CTRLC & ~(ADC_REFSEL_gm | ADC_SAMPCAP_bm)) |
-          INTERNAL;  // per datasheet, recommended SAMPCAP=0 at ref < 1v
-      VREF.CTRLB |= VREF_ADC0REFEN_bm;  // Turn off force-adc-reference-enable
-      break;
-    case INTERNAL1V1:
-    case INTERNAL2V5:
-    case INTERNAL4V34:
-    case INTERNAL1V5:
-      VREF.CTRLA =
-          (VREF.CTRLA & ~(VREF_ADC0REFSEL_gm)) | (mode << VREF_ADC0REFSEL_gp);
-      ADC0.CTRLC =
-          (ADC0.CTRLC & ~(ADC_REFSEL_gm)) | INTERNAL |
-          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v
-      break;
-  }
-}
+void att1s_analog_reference_adc0(uint8_t mode);
 
 /**
  * @brief Set the analog reference for ADC1
@@ -100,62 +41,135 @@ void att1s_analog_reference_adc0(uint8_t mode) {
  *
  * @param mode Reference mode
  */
-void att1s_analog_reference_adc1(uint8_t mode) {
-  switch (mode) {
-#if defined(EXTERNAL)
-    case EXTERNAL:
-#endif
-    case VDD:
-      VREF.CTRLB &= ~VREF_ADC1REFEN_bm;  // Turn off force-adc-reference-enable
-      ADC1.CTRLC =
-          (ADC1.CTRLC & ~(ADC_REFSEL_gm)) | mode |
-          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v -
-                           // we don't *KNOW* the external reference will be
-                           // >1v, but it's probably more likely...
-      // VREF.CTRLA does not need to be reconfigured, as the voltage references
-      // only supply their specified voltage when requested to do so by the ADC.
-      break;
-    case INTERNAL0V55:
-      VREF.CTRLC = VREF.CTRLC &
-                   ~(VREF_ADC1REFSEL_gm);  // These bits are all 0 for 0.55v
-                                           // reference, so no need to do the
-                                           // mode << VREF_ADC1REFSEL_gp here;
-      ADC1.CTRLC =
-          (ADC1.CTRLC & ~(ADC_REFSEL_gm | ADC_SAMPCAP_bm)) |
-          INTERNAL;  // per datasheet, recommended SAMPCAP=0 at ref < 1v
-      VREF.CTRLB |= VREF_ADC1REFEN_bm;  // Turn off force-adc-reference-enable
-      break;
-    case INTERNAL1V1:
-    case INTERNAL2V5:
-    case INTERNAL4V34:
-    case INTERNAL1V5:
-      VREF.CTRLC =
-          (VREF.CTRLC & ~(VREF_ADC1REFSEL_gm)) | (mode << VREF_ADC1REFSEL_gp);
-      ADC1.CTRLC =
-          (ADC1.CTRLC & ~(ADC_REFSEL_gm)) | INTERNAL |
-          ADC_SAMPCAP_bm;  // per datasheet, recommended SAMPCAP=1 at ref > 1v
-      break;
-  }
-}
+void att1s_analog_reference_adc1(uint8_t mode);
 
-uint16_t att1s_analog_read(uint8_t ain, uint8_t adc_num) {
-  volatile ADC_t *adc = adc_num == 0 ? &ADC0 : &ADC1;
+//////
+// Interrupt-driven ADC sampler
+//
+// The sampler converts all channels in the adc_channels table without
+// busy-waiting. A sweep is started with adc_sampler_start(). The RESRDY
+// interrupt handlers of ADC0 and ADC1 then step through their own channels
+// independently, storing each result in a per-channel slot. Once both ADCs
+// have finished, the results can be picked up with adc_sampler_read().
+//
+// Oversampled channels use the hardware accumulator and are reported as
+// left-aligned 16-bit values. Other channels are reported as raw 10-bit
+// results.
 
-  // select the analog input number
-  adc->MUXPOS = ain;
+/**
+ * @brief Indices of the sampled channels in the channel table.
+ */
+enum AdcChannelIndex {
+  ADC_CH_V_CAP,
+  ADC_CH_V_IN,
+  ADC_CH_I_IN,
+  ADC_CH_TEMP,
+  NUM_ADC_CHANNELS
+};
 
-  if (adc->COMMAND) return ADC_ERROR_BUSY;
+/**
+ * @brief Analog channel definition.
+ */
+struct AdcChannel {
+  uint8_t adc_num;  //!< ADC peripheral number (0 or 1)
+  uint8_t ain;      //!< Analog input (MUXPOS) selection
+  bool oversample;  //!< Use hardware accumulation on this channel
+};
 
-  // start the conversion
-  adc->COMMAND = ADC_STCONV_bm;
+extern const AdcChannel adc_channels[NUM_ADC_CHANNELS];
 
-  // wait for the conversion to complete
-  while (!(adc->INTFLAGS & ADC_RESRDY_bm)) {
-    // do nothing
-  }
+// Maximum supported oversampling setting (64 accumulated samples)
+#define ADC_MAX_OVERSAMPLE_LOG2 6
 
-  // return the result
-  return adc->RES;
+/**
+ * @brief Decimate an accumulated ADC result to a left-aligned 16-bit value.
+ *
+ * Accumulating 4^n samples yields n additional bits of resolution. The
+ * accumulated sum of 2^log2_samples 10-bit samples is shifted down to
+ * 10 + log2_samples / 2 significant bits and then left-aligned to 16 bits,
+ * so the result has the same full-scale range regardless of the setting.
+ *
+ * @param acc Accumulated ADC result
+ * @param log2_samples Base-2 logarithm of the number of accumulated samples
+ * @return Left-aligned 16-bit value
+ */
+inline uint16_t adc_decimate(uint16_t acc, uint8_t log2_samples) {
+  uint8_t extra_bits = log2_samples / 2;
+  return (acc >> (log2_samples - extra_bits)) << (6 - extra_bits);
 }
 
+/**
+ * @brief Set the number of accumulated samples on oversampled channels.
+ *
+ * Takes effect on the next conversion. Values above ADC_MAX_OVERSAMPLE_LOG2
+ * are clamped.
+ *
+ * @param log2_samples Base-2 logarithm of the number of samples
+ */
+void adc_sampler_set_oversampling(uint8_t log2_samples);
+
+uint8_t adc_sampler_get_oversampling();
+
+/**
+ * @brief Enable the ADC result ready interrupts.
+ *
+ * Must be called after the ADCs have been configured.
+ */
+void adc_sampler_init();
+
+/**
+ * @brief Start a new sweep over all channels.
+ *
+ * @return false if the previous sweep is still in progress
+ */
+bool adc_sampler_start();
+
+/**
+ * @brief Pick up the results of a completed sweep.
+ *
+ * Never blocks. Each completed sweep is returned only once.
+ *
+ * @param results Array of NUM_ADC_CHANNELS values to fill
+ * @return true if a new set of results was copied
+ */
+bool adc_sampler_read(uint16_t* results);
+
+//////
+// Power-fail monitor
+//
+// While armed, ADC0 free-runs on the V_IN channel between sampler sweeps
+// with the window comparator set to fire below the threshold. The WCOMP
+// interrupt latches the power-fail flag and disarms the monitor, so input
+// power loss is noticed within a few conversions (tens of microseconds)
+// instead of at the next sweep. During a sweep, the V_IN result of the
+// sweep itself is compared against the threshold.
+
+// Number of accumulated samples compared against the threshold, to reject
+// single-conversion noise
+#define ADC_POWER_FAIL_SAMPNUM ADC_SAMPNUM_ACC4_gc
+
+/**
+ * @brief Start monitoring V_IN.
+ *
+ * @param threshold 10-bit V_IN reading below which power has failed
+ */
+void adc_power_fail_arm(uint16_t threshold);
+
+/**
+ * @brief Stop monitoring V_IN and clear the power-fail flag.
+ */
+void adc_power_fail_disarm();
+
+/**
+ * @brief Check and clear the power-fail flag.
+ *
+ * The reading that tripped the monitor is newer than the last sweep, so
+ * it should replace the V_IN value used by the state machine.
+ *
+ * @param timestamp Set to the timing_now() value of the detection
+ * @param reading Set to the 10-bit V_IN reading that tripped the monitor
+ * @return true if power failed since the monitor was armed
+ */
+bool adc_power_fail_take(uint32_t& timestamp, uint16_t& reading);
+
 #endif  // SH_RPI_FIRMWARE_SRC_ANALOG_IO_H_
\ No newline at end of file
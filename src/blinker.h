@@ -1,11 +1,13 @@
 #ifndef _blinker_H_
 #define _blinker_H_
 
-#include <elapsedMillis.h>
+#include <stddef.h>
 
-#include "cie1931.h"
 #include "constants.h"
 #include "digital_io.h"
+#include "gamma.h"
+#include "hal.h"
+#include "led_pwm.h"
 
 #define BLINKER_PERIOD_SCALE 32768
 
@@ -20,20 +22,125 @@ extern uint8_t led_global_brightness;
  * @brief Define an individual LED pattern segment.
  *
  * A blink pattern is an array of LedPatternSegments. The final (sentinel)
- * element of the array must have a duration of 0. Once that is reached,
+ * element of the array has a duration of 0. Once that is reached,
  * the pattern will loop back to the beginning.
  *
  * For ease of use, the mask bit array has reversed order. The first bit
  * in the array corresponds to the last LED in the pattern. Thus, a brightness
  * array of {0, 0, 255, 0} and a mask of 0b0010 will both refer to the third
  * LED in the pattern.
+ *
+ * By default, a segment holds its values for its whole duration. A segment
+ * with a fade mode instead moves each LED from its own value to the value
+ * of the next segment, so a fade takes a single segment. LEDs outside the
+ * mask of either segment use the bar display value.
+ */
+enum LedFade : uint8_t {
+  LED_FADE_STEP,    //!< Hold the segment values
+  LED_FADE_LINEAR,  //!< Fade linearly to the next segment
+  LED_FADE_EASE,    //!< Fade to the next segment, slow at both ends
+};
+
+// Packing of LedPatternSegment::timing
+#define LED_SEGMENT_TICKS_BITS 10
+#define LED_SEGMENT_MASK_SHIFT 10
+#define LED_SEGMENT_FADE_SHIFT 14
+#define LED_SEGMENT_MAX_DURATION \
+  (((1U << LED_SEGMENT_TICKS_BITS) - 1) * BLINKER_INTERVAL)
+
+static_assert(NUM_LEDS <= LED_SEGMENT_FADE_SHIFT - LED_SEGMENT_MASK_SHIFT,
+              "the packed LED mask is too narrow");
+
+/**
+ * @brief Packed LED pattern segment.
+ *
+ * Segments are built with led_segment() and led_pattern() only, which
+ * validate them at compile time.
  */
 struct LedPatternSegment {
   uint8_t brightness[NUM_LEDS];  //!< Brightness of each LED in the segment
-  uint8_t mask;                  //!< Mask of LEDs to apply the segment to
-  uint16_t duration;             //!< Duration of the segment in milliseconds
+  uint16_t timing;  //!< Duration in blinker ticks, mask and fade mode
+
+  //! Duration of the segment in milliseconds
+  constexpr uint16_t duration() const {
+    return (timing & ((1U << LED_SEGMENT_TICKS_BITS) - 1)) * BLINKER_INTERVAL;
+  }
+  //! Mask of LEDs to apply the segment to
+  constexpr uint8_t mask() const {
+    return (timing >> LED_SEGMENT_MASK_SHIFT) & ((1U << NUM_LEDS) - 1);
+  }
+  //! Transition to the next segment
+  constexpr LedFade fade() const {
+    return LedFade(timing >> LED_SEGMENT_FADE_SHIFT);
+  }
+};
+
+static_assert(sizeof(LedPatternSegment) == NUM_LEDS + 2,
+              "LedPatternSegment is not packed");
+
+/**
+ * @brief Intentionally never defined. Calling it while building a pattern
+ * at compile time fails the build with the message in the error output.
+ */
+void led_pattern_error(const char* message);
+
+/**
+ * @brief Build a pattern segment.
+ *
+ * @param brightness Brightness of each LED
+ * @param mask Mask of LEDs to apply the segment to
+ * @param duration Duration in milliseconds, a multiple of BLINKER_INTERVAL
+ * @param fade Transition to the next segment
+ */
+template <size_t N>
+constexpr LedPatternSegment led_segment(const uint8_t (&brightness)[N],
+                                        uint8_t mask, uint16_t duration,
+                                        LedFade fade = LED_FADE_STEP) {
+  static_assert(N == NUM_LEDS, "a segment needs a brightness for each LED");
+  if (duration == 0 || duration > LED_SEGMENT_MAX_DURATION) {
+    led_pattern_error("segment duration out of range");
+  }
+  if (duration % BLINKER_INTERVAL) {
+    led_pattern_error("segment duration not a multiple of BLINKER_INTERVAL");
+  }
+  if (mask >> NUM_LEDS) {
+    led_pattern_error("segment mask has bits beyond NUM_LEDS");
+  }
+  if (fade > LED_FADE_EASE) {
+    led_pattern_error("invalid fade mode");
+  }
+  LedPatternSegment segment{};
+  for (size_t i = 0; i < N; i++) {
+    segment.brightness[i] = brightness[i];
+  }
+  segment.timing = (duration / BLINKER_INTERVAL) |
+                   (uint16_t(mask) << LED_SEGMENT_MASK_SHIFT) |
+                   (uint16_t(fade) << LED_SEGMENT_FADE_SHIFT);
+  return segment;
+}
+
+/**
+ * @brief LED pattern of N segments and the sentinel.
+ */
+template <size_t N>
+struct LedPattern {
+  LedPatternSegment segments[N + 1];
+
+  constexpr operator const LedPatternSegment*() const { return segments; }
 };
 
+/**
+ * @brief Build a pattern from segments, appending the sentinel.
+ *
+ * Define patterns as inline constexpr variables. That forces the
+ * validation to happen at compile time and keeps them out of SRAM.
+ */
+template <typename... Segments>
+constexpr LedPattern<sizeof...(Segments)> led_pattern(Segments... segments) {
+  static_assert(sizeof...(Segments) > 0, "a pattern needs a segment");
+  return LedPattern<sizeof...(Segments)>{{segments...}};
+}
+
 /**
  * @brief LED array blinker class.
  *
@@ -50,29 +157,30 @@ struct LedPatternSegment {
  * The bar display is non-linear. The first LED is fully lit when the
  * bar value equals to bar_knee_value. All LEDs are fully lit when the
  * bar value equals to bar_max_value.
+ *
+ * Changes to the bar, pattern or brightness only mark the output dirty.
+ * The frame is rendered on the next tick(), so the LED outputs are
+ * updated at the fixed tick rate.
  */
 class LedBlinker {
  public:
-  LedBlinker(int* pins, LedPatternSegment* pattern, uint16_t bar_knee_value)
+  LedBlinker(const int* pins, const LedPatternSegment* pattern,
+             uint16_t bar_knee_value)
       : pattern_{pattern}, bar_knee_value_{bar_knee_value} {
     for (int i = 0; i < NUM_LEDS; i++) {
-      pin_[i] = pins[i];
-      port_[i] = digitalPinToPortStruct(pins[i]);
-      pin_mask_[i] = digitalPinToBitMask(pins[i]);
       pinMode(pins[i], OUTPUT);
     }
     value_step = (bar_max_value_ - bar_knee_value_) / (NUM_LEDS - 1);
   }
 
-  void set_pattern(LedPatternSegment* pattern) {
+  void set_pattern(const LedPatternSegment* pattern) {
     // only set if the new pattern is different from the current pattern
     if (pattern == pattern_) {
       return;
     }
     pattern_ = pattern;
     pattern_index_ = 0;
-    pattern_timer_ = 0;
-    update_led_values();
+    start_segment();
   }
 
   void set_bar(uint16_t value) {
@@ -112,61 +220,119 @@ class LedBlinker {
           value_step;
       bar_value_[num_full_leds + 1] = new_value;
     }
-    update_led_values();
+    dirty_ = true;
   }
 
   void init() {
-    // Pin modes have been set in the main program.
-    // Set the PWM registers here.
+    // Pin modes have been set in the constructor.
+    led_pwm_init();
+    dirty_ = true;
   }
 
+  /**
+   * @brief Render the output again, e.g. after a brightness change.
+   */
+  void refresh() { dirty_ = true; }
+
+  /**
+   * @brief Advance the pattern and render the output if it has changed.
+   * Must be called every BLINKER_INTERVAL ms.
+   */
   void tick() {
-    if (pattern_timer_ > pattern_[pattern_index_].duration) {
-      pattern_index_++;
-      if (pattern_[pattern_index_].duration == 0) {
-        pattern_index_ = 0;
-      }
+    pattern_elapsed_ += BLINKER_INTERVAL;
+    if (pattern_elapsed_ >= pattern_[pattern_index_].duration()) {
+      pattern_index_ = next_index();
+      start_segment();
+    } else if (fade_step_) {
+      fade_phase_ = fade_phase_ > 0xffff - fade_step_ ? 0xffff
+                                                      : fade_phase_ + fade_step_;
+      dirty_ = true;
+    }
+    if (dirty_) {
+      dirty_ = false;
       update_led_values();
-      pattern_timer_ = 0;
     }
   }
 
   uint8_t bar_value_[NUM_LEDS];  //!< Bar display brightness value for each LED
 
  protected:
-  PORT_t* port_[NUM_LEDS];      //!< Port for each LED
-  uint8_t pin_[NUM_LEDS];       //!< Pin for each LED
-  uint8_t pin_mask_[NUM_LEDS];  //!< Port mask for each LED pin
-  uint8_t
-      led_value_[NUM_LEDS];     //!< Current final brightness value for each LED
-  LedPatternSegment* pattern_;  //!< Pointer to the current pattern
+  uint16_t
+      led_value_[NUM_LEDS];     //!< Current final intensity for each LED
+  bool dirty_ = true;           //!< Output needs to be rendered
+  const LedPatternSegment* pattern_;  //!< Pointer to the current pattern
   uint8_t pattern_index_ = 0;   //!< Index of the current pattern segment
-  elapsedMillis pattern_timer_ = 0;  //!< Timer for the current pattern segment
-  uint16_t bar_knee_value_;          //!< Knee value for the bar display
+  uint16_t pattern_elapsed_ = 0;  //!< Time spent in the current segment, ms
+  uint16_t fade_phase_ = 0;       //!< Fade progress, 0..0xffff
+  uint16_t fade_step_ = 0;        //!< Fade progress per tick, 0 if no fade
+  uint16_t bar_knee_value_;       //!< Knee value for the bar display
   static constexpr uint16_t bar_max_value_ = uint16_t(
       ((uint16_t)-1) * 9.0 / VCAP_MAX);  //!< Maximum value for the bar display
   uint16_t value_step;  //!< Value increase between each LED in the bar display
 
+  uint8_t next_index() const {
+    uint8_t index = pattern_index_ + 1;
+    return pattern_[index].duration() == 0 ? 0 : index;
+  }
+
+  void start_segment() {
+    pattern_elapsed_ = 0;
+    fade_phase_ = 0;
+    fade_step_ = 0;
+    const LedPatternSegment& segment = pattern_[pattern_index_];
+    if (segment.fade() != LED_FADE_STEP) {
+      // the only division per segment; the phase is advanced by addition
+      uint32_t step = ((uint32_t)BLINKER_INTERVAL << 16) / segment.duration();
+      fade_step_ = step > 0xffff ? 0xffff : step;
+    }
+    dirty_ = true;
+  }
+
+  uint8_t segment_value(const LedPatternSegment& segment, int led) const {
+    if (segment.mask() & (1 << (NUM_LEDS - 1 - led))) {
+      return segment.brightness[led];
+    }
+    return bar_value_[led];
+  }
+
+  /**
+   * @brief Fade weight of the current segment.
+   *
+   * @return 0 at the start of the segment .. 256 at the end
+   */
+  uint16_t fade_weight() const {
+    uint16_t t = fade_phase_ >> 8;
+    if (pattern_[pattern_index_].fade() == LED_FADE_EASE) {
+      // smoothstep: 3t^2 - 2t^3, rounded once so that it never decreases
+      return ((uint32_t)t * t * (3 * 256 - 2 * t)) >> 16;
+    }
+    return t;
+  }
+
   /**
    * @brief Update the LED output values.
    *
    */
   void update_led_values() {
-    // get the current pattern segment mask
-    uint8_t mask = pattern_[pattern_index_].mask;
+    uint16_t duty[NUM_LEDS];
+    const LedPatternSegment& segment = pattern_[pattern_index_];
+    const LedPatternSegment& next = pattern_[next_index()];
+    uint16_t weight = fade_step_ ? fade_weight() : 0;
     for (int i = 0; i < NUM_LEDS; i++) {
-      if (mask & (1 << NUM_LEDS - 1 - i)) {
-        uint16_t new_brightness =
-            led_global_brightness * pattern_[pattern_index_].brightness[i];
-        led_value_[i] = new_brightness >> 8;
-      } else {
-        uint16_t new_brightness = led_global_brightness * bar_value_[i];
-        led_value_[i] = new_brightness >> 8;
+      // value in 8.8 fixed point
+      uint16_t value = segment_value(segment, i) << 8;
+      if (weight) {
+        int16_t delta = segment_value(next, i) - segment_value(segment, i);
+        value += (int32_t)delta * weight;
       }
-      // Use a lookup table to map the logarithmic sensitivity of the human
-      // eye to the linear PWM output. Or the other way around?
-      analogWrite(pin_[i], cie[led_value_[i]]);
+      // keep the full 16-bit product so that low global brightness values
+      // retain their resolution
+      led_value_[i] = ((uint32_t)led_global_brightness * value) >> 8;
+      // Map the perceived brightness to a linear PWM duty value
+      duty[i] = gamma_correct(led_value_[i]);
     }
+    // only the changed outputs are written
+    led_pwm_set(duty);
   }
 };
 
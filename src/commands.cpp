@@ -0,0 +1,100 @@
+#include "commands.h"
+
+#include "analog_io.h"
+#include "config.h"
+#include "digital_io.h"
+#include "energy.h"
+#include "globals.h"
+#include "hal.h"
+#include "history.h"
+#include "state_machine.h"
+#include "supercap_health.h"
+#include "timing.h"
+
+SpscQueue<Command, COMMAND_QUEUE_LENGTH> command_queue;
+volatile uint8_t command_overflows[NUM_COMMANDS];
+
+void command_post(CommandType type, uint16_t value) {
+  if (!command_queue.push(Command{type, value}) &&
+      command_overflows[type] != 0xff) {
+    command_overflows[type] = command_overflows[type] + 1;
+  }
+}
+
+// Execute a command. Returns true if a register value may have changed.
+static bool command_execute(const Command& command) {
+  switch (command.type) {
+    case CMD_SET_EN5V:
+      // FIXME: this should change the state machine state
+      set_en5v_pin(command.value);
+      return true;
+    case CMD_SET_WATCHDOG:
+      watchdog_limit = command.value;
+      // the new limit counts from now; a disabled watchdog is stopped
+      sm_restart_watchdog();
+      sm_post_event(EV_WATCHDOG_CHANGED);
+      return true;
+    case CMD_SET_POWER_ON_VCAP:
+      power_on_vcap_voltage = command.value;
+      config_changed();
+      return true;
+    case CMD_SET_POWER_OFF_VCAP:
+      power_off_vcap_voltage = command.value;
+      config_changed();
+      return true;
+    case CMD_SET_LED_BRIGHTNESS:
+      if (command.value == led_global_brightness) {
+        return false;
+      }
+      led_global_brightness = command.value;
+      led_blinker.refresh();
+      config_changed();
+      return true;
+    case CMD_SET_ADC_OVERSAMPLE:
+      adc_sampler_set_oversampling(command.value);
+      config_changed();
+      return true;
+    case CMD_SET_HISTORY_INTERVAL: {
+      uint8_t interval = command.value;
+      history_set_interval(interval);
+      config_changed();
+      return true;
+    }
+    case CMD_SHUTDOWN:
+      sm_post_event(EV_SHUTDOWN_REQ);
+      return false;
+    case CMD_SLEEP:
+      sm_post_event(EV_SLEEP_REQ);
+      return false;
+    case CMD_RESET_TIMING:
+      timing_reset();
+      return true;
+    case CMD_RESET_TRIP:
+      energy_reset_trip();
+      return true;
+    case CMD_SET_SHUTDOWN_WAIT_LIMIT:
+      if (command.value == 0) {
+        shutdown_wait_limit = SHUTDOWN_WAIT_DURATION / 1000;
+      } else if (command.value > SHUTDOWN_WAIT_LIMIT_MAX) {
+        shutdown_wait_limit = SHUTDOWN_WAIT_LIMIT_MAX;
+      } else {
+        shutdown_wait_limit = command.value;
+      }
+      config_changed();
+      return true;
+    case CMD_RESET_SUPERCAP_HEALTH:
+      supercap_health_reset();
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool commands_process() {
+  bool registers_changed = false;
+  Command command;
+  while (command_queue.pop(command)) {
+    registers_changed |= command_execute(command);
+  }
+  return registers_changed;
+}
@@ -0,0 +1,62 @@
+#ifndef SH_RPI_FIRMWARE_SRC_COMMANDS_H_
+#define SH_RPI_FIRMWARE_SRC_COMMANDS_H_
+
+#include <stdint.h>
+
+#include "spsc_queue.h"
+
+//////
+// Host command mailbox
+//
+// The I2C receive handler only decodes register writes into command
+// records and queues them. The main loop executes the commands in the
+// order they were received. Every write is queued as its own record, so
+// back-to-back writes are never merged. If the queue is full, the command
+// is dropped and counted in the per-command overflow counters, readable
+// from I2C register 0x28.
+
+// take care to keep the order; the overflow counters in register 0x28
+// are reported in this order
+enum CommandType : uint8_t {
+  CMD_SET_EN5V,                 //!< Write 0x10
+  CMD_SET_WATCHDOG,             //!< Write 0x12
+  CMD_SET_POWER_ON_VCAP,        //!< Write 0x13
+  CMD_SET_POWER_OFF_VCAP,       //!< Write 0x14
+  CMD_SET_LED_BRIGHTNESS,       //!< Write 0x17
+  CMD_SET_ADC_OVERSAMPLE,       //!< Write 0x18
+  CMD_SET_HISTORY_INTERVAL,     //!< Write 0x19
+  CMD_SHUTDOWN,                 //!< Write 0x30
+  CMD_SLEEP,                    //!< Write 0x31
+  CMD_RESET_TIMING,             //!< Write 0x40
+  CMD_RESET_TRIP,               //!< Write 0x52
+  CMD_SET_SHUTDOWN_WAIT_LIMIT,  //!< Write 0x1A
+  CMD_RESET_SUPERCAP_HEALTH,    //!< Write 0x2B
+  NUM_COMMANDS
+};
+
+struct Command {
+  CommandType type;
+  uint16_t value;
+};
+
+// Number of queued commands (power of two)
+#define COMMAND_QUEUE_LENGTH 8
+
+extern SpscQueue<Command, COMMAND_QUEUE_LENGTH> command_queue;
+
+// Saturating counts of dropped commands, by command type
+extern volatile uint8_t command_overflows[NUM_COMMANDS];
+
+/**
+ * @brief Queue a command. Called from the I2C receive handler.
+ */
+void command_post(CommandType type, uint16_t value);
+
+/**
+ * @brief Execute all queued commands.
+ *
+ * @return true if a value visible in the I2C registers may have changed
+ */
+bool commands_process();
+
+#endif  // SH_RPI_FIRMWARE_SRC_COMMANDS_H_
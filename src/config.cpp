@@ -0,0 +1,195 @@
+#include "config.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "analog_io.h"
+#include "crc16.h"
+#include "globals.h"
+#include "hal.h"
+#include "history.h"
+#include "nvm.h"
+#include "scheduler.h"
+#include "supercap_health.h"
+
+// Fields are ordered so that the struct has no padding on either the MCU
+// or the host
+struct ConfigRecord {
+  uint16_t sequence;
+  int16_t power_on_vcap;
+  int16_t power_off_vcap;
+  uint8_t version;
+  uint8_t led_brightness;
+  uint8_t adc_oversample;
+  uint8_t history_interval;
+  // 0 in records written before the setting existed
+  uint8_t shutdown_wait_limit;
+  uint8_t reserved[3];
+  uint16_t crc;
+};
+
+static_assert(sizeof(ConfigRecord) == CONFIG_RECORD_SIZE,
+              "config record must fill a slot");
+static_assert(EEPROM_PAGE_SIZE % CONFIG_RECORD_SIZE == 0,
+              "config records must not cross EEPROM pages");
+static_assert(CONFIG_NUM_SLOTS * CONFIG_RECORD_SIZE <= SUPERCAP_HEALTH_ADDR,
+              "config records must not overlap the supercap health");
+
+// Slot of the newest valid record
+static uint8_t config_slot = 0;
+// The newest valid record, or all zeros if there is none
+static ConfigRecord config_saved;
+static bool config_valid = false;
+
+// Time of the first change not yet committed
+static uint32_t config_pending_since = 0;
+
+static uint16_t config_record_crc(const ConfigRecord& record) {
+  return crc16((const uint8_t*)&record, offsetof(ConfigRecord, crc));
+}
+
+static bool config_read_slot(uint8_t slot, ConfigRecord& record) {
+  EEPROM.get(slot * CONFIG_RECORD_SIZE, record);
+  return record.version == CONFIG_VERSION &&
+         record.crc == config_record_crc(record);
+}
+
+// Settings as stored by firmware versions before the record log
+static void config_read_legacy(ConfigRecord& record) {
+  EEPROM.get(EEPROM_POWER_ON_VCAP_ADDR, record.power_on_vcap);
+  EEPROM.get(EEPROM_POWER_OFF_VCAP_ADDR, record.power_off_vcap);
+  EEPROM.get(EEPROM_LED_BRIGHTNESS_ADDR, record.led_brightness);
+  EEPROM.get(EEPROM_ADC_OVERSAMPLE_ADDR, record.adc_oversample);
+  EEPROM.get(EEPROM_HISTORY_INTERVAL_ADDR, record.history_interval);
+}
+
+static void config_snapshot(ConfigRecord& record) {
+  memset(&record, 0, sizeof(record));
+  record.version = CONFIG_VERSION;
+  record.power_on_vcap = power_on_vcap_voltage;
+  record.power_off_vcap = power_off_vcap_voltage;
+  record.led_brightness = led_global_brightness;
+  record.adc_oversample = adc_sampler_get_oversampling();
+  record.history_interval = history_get_interval();
+  record.shutdown_wait_limit = shutdown_wait_limit;
+}
+
+static bool config_settings_equal(const ConfigRecord& a,
+                                  const ConfigRecord& b) {
+  return a.power_on_vcap == b.power_on_vcap &&
+         a.power_off_vcap == b.power_off_vcap &&
+         a.led_brightness == b.led_brightness &&
+         a.adc_oversample == b.adc_oversample &&
+         a.history_interval == b.history_interval &&
+         a.shutdown_wait_limit == b.shutdown_wait_limit;
+}
+
+static uint16_t config_commit_task() {
+  config_commit();
+  return SCHEDULER_STOP;
+}
+
+void config_load() {
+  scheduler_add(TASK_CONFIG_COMMIT, config_commit_task);
+
+  memset(&config_saved, 0, sizeof(config_saved));
+  config_valid = false;
+  config_slot = 0;
+  for (uint8_t slot = 0; slot < CONFIG_NUM_SLOTS; slot++) {
+    ConfigRecord record;
+    if (!config_read_slot(slot, record)) {
+      continue;
+    }
+    // sequence numbers are compared with wrap-around arithmetic
+    if (!config_valid ||
+        (int16_t)(record.sequence - config_saved.sequence) > 0) {
+      config_saved = record;
+      config_slot = slot;
+      config_valid = true;
+    }
+  }
+
+  ConfigRecord record = config_saved;
+  if (!config_valid) {
+    config_read_legacy(record);
+  }
+
+  power_on_vcap_voltage = record.power_on_vcap;
+  if (power_on_vcap_voltage < 0 || power_on_vcap_voltage > VCAP_SCALE) {
+    power_on_vcap_voltage = int(VCAP_POWER_ON / VCAP_MAX * VCAP_SCALE);
+  }
+
+  power_off_vcap_voltage = record.power_off_vcap;
+  if (power_off_vcap_voltage < 0 || power_off_vcap_voltage > VCAP_SCALE) {
+    power_off_vcap_voltage = int(VCAP_POWER_OFF / VCAP_MAX * VCAP_SCALE);
+  }
+
+  // The default unset value is 0xFF which just coincides with the default
+  // full brightness value.
+  led_global_brightness = record.led_brightness;
+
+  uint8_t adc_oversample = record.adc_oversample;
+  if (adc_oversample > ADC_MAX_OVERSAMPLE_LOG2) {
+    adc_oversample = ADC_OVERSAMPLE_LOG2;
+  }
+  adc_sampler_set_oversampling(adc_oversample);
+
+  // The unset value 0xFF is valid but impractically slow, so fall back to
+  // the default.
+  uint8_t history_interval = record.history_interval;
+  if (history_interval == 0xff) {
+    history_interval = HISTORY_INTERVAL;
+  }
+  history_set_interval(history_interval);
+
+  // older records and the legacy settings have no shutdown wait limit
+  shutdown_wait_limit = record.shutdown_wait_limit;
+  if (shutdown_wait_limit == 0 || shutdown_wait_limit > SHUTDOWN_WAIT_LIMIT_MAX) {
+    shutdown_wait_limit = SHUTDOWN_WAIT_DURATION / 1000;
+  }
+}
+
+void config_changed() {
+  uint32_t now = millis();
+  if (!scheduler_is_scheduled(TASK_CONFIG_COMMIT)) {
+    config_pending_since = now;
+  } else if (now - config_pending_since >=
+             CONFIG_MAX_COMMIT_DELAY - CONFIG_SETTLE_TIME) {
+    // keep a steady stream of changes from deferring the commit forever
+    return;
+  }
+  scheduler_schedule(TASK_CONFIG_COMMIT, CONFIG_SETTLE_TIME);
+}
+
+bool config_pending() {
+  return scheduler_is_scheduled(TASK_CONFIG_COMMIT) || nvm_pending();
+}
+
+bool config_commit() {
+  scheduler_cancel(TASK_CONFIG_COMMIT);
+
+  ConfigRecord record;
+  config_snapshot(record);
+  if (config_valid && config_settings_equal(record, config_saved)) {
+    return false;
+  }
+
+  record.sequence = config_saved.sequence + 1;
+  record.crc = config_record_crc(record);
+
+  // Without a valid record, config_slot is 0 and the legacy settings in
+  // slot 0 are kept until the log wraps around.
+  uint8_t slot = (config_slot + 1) % CONFIG_NUM_SLOTS;
+  // A power loss during the write leaves a record with a bad CRC, and the
+  // previous record is used instead.
+  if (!nvm_write(slot * CONFIG_RECORD_SIZE, &record, sizeof(record))) {
+    // writes are inhibited or the previous record is still being written
+    scheduler_schedule(TASK_CONFIG_COMMIT, CONFIG_SETTLE_TIME);
+    return false;
+  }
+
+  config_slot = slot;
+  config_saved = record;
+  config_valid = true;
+  return true;
+}
@@ -0,0 +1,60 @@
+#ifndef SH_RPI_FIRMWARE_SRC_CONFIG_H_
+#define SH_RPI_FIRMWARE_SRC_CONFIG_H_
+
+#include <stdint.h>
+
+//////
+// Persistent configuration
+//
+// The settings are stored as a log of fixed-size records rotating through
+// the EEPROM. Each record carries a format version, a sequence number and
+// a CRC. At boot the valid record with the newest sequence number wins, so
+// a record torn by a power loss only costs the latest change. Every commit
+// goes to the slot after the newest record, spreading the wear over all
+// slots.
+//
+// Host writes only mark the configuration as changed. The record is
+// queued for the background EEPROM writer (see nvm.h) once the settings
+// have been left alone for CONFIG_SETTLE_TIME, so a burst of changes
+// costs a single commit. A slot is half an EEPROM page, so a record is
+// programmed with a single page operation.
+//
+// EEPROMs written by older firmware hold the settings at fixed addresses
+// in the first slot. They are read if no valid record is found and are
+// only overwritten after the log has wrapped around.
+
+#define CONFIG_VERSION 1
+#define CONFIG_RECORD_SIZE 16
+// The rest of the EEPROM holds the supercap health (see supercap_health.h)
+// and the shutdown durations (see shutdown_stats.h)
+#define CONFIG_NUM_SLOTS 10
+
+/**
+ * @brief Read the settings from the EEPROM and apply them.
+ *
+ * Invalid values are replaced with the defaults.
+ */
+void config_load();
+
+/**
+ * @brief Schedule a commit of the current settings.
+ */
+void config_changed();
+
+/**
+ * @brief Queue the current settings for writing if they differ from the
+ * latest record.
+ *
+ * If the record cannot be queued, the commit is retried after
+ * CONFIG_SETTLE_TIME.
+ *
+ * @return true if a record was queued
+ */
+bool config_commit();
+
+/**
+ * @brief Check whether changed settings have not yet reached the EEPROM.
+ */
+bool config_pending();
+
+#endif  // SH_RPI_FIRMWARE_SRC_CONFIG_H_
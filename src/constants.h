@@ -1,21 +1,30 @@
 #ifndef SH_RPI_FIRMWARE_SRC_CONSTANTS_H_
 #define SH_RPI_FIRMWARE_SRC_CONSTANTS_H_
 
+#include <stdint.h>
+
 // FW version provided by the Legacy version I2C register
 #define LEGACY_FW_VERSION 0xff
 
 // FW version provided by the new I2C register
-constexpr char kFWVersion[] = {2, 0, 6, 0xff};
+constexpr uint8_t kFWVersion[] = {2, 0, 6, 0xff};
 
 // HW version provided by the Legacy version I2C register
 #define LEGACY_HW_VERSION 0x00
 
 // HW version provided by the new I2C register
-constexpr char kHWVersion[] = {2, 0, 1, 0xff};
+constexpr uint8_t kHWVersion[] = {2, 0, 1, 0xff};
 
 // Needed for HW bug workarounds for version 2.0.0 only
 //#define HW_VERSION_2_0_0
 
+// Serial port baud rate
+#define SERIAL_BAUD_RATE 115200
+
+// Define to print human-readable text on the serial port instead of the
+// binary telemetry frames (see telemetry.h)
+//#define SERIAL_TEXT_OUTPUT
+
 // I2C address of the MCU
 #define I2C_ADDRESS 0x6d
 
@@ -81,6 +90,8 @@ constexpr char kHWVersion[] = {2, 0, 1, 0xff};
 #define VCAP_MAX 9.35
 // integer scaling factor for Vcap voltage
 #define VCAP_SCALE 1024
+// Without DC input power, no EEPROM write is started below this Vcap voltage
+#define VCAP_NVM_MIN 5.5
 // Voltage at which the first LED is lit
 #define LED_BAR_KNEE 6.0
 // maximum value indicated by the LED bar
@@ -92,9 +103,29 @@ constexpr char kHWVersion[] = {2, 0, 1, 0xff};
 #define VIN_MAX 32.1
 // Vin scaling factor
 #define VIN_SCALE 1024
-
-// how long to wait until forcibly shutdown
+// max current for Iin: the 2.5 V ADC1 reference over a 75 mOhm shunt with a
+// current sense gain of 20
+#define IIN_MAX (2.5 / 0.075 / 20)
+
+// Default ADC oversampling on the Vcap, Vin and Iin channels, expressed as
+// log2 of the number of accumulated samples. 6 accumulates 64 samples,
+// giving 13 bits of resolution.
+#define ADC_OVERSAMPLE_LOG2 6
+
+// Number of records in the telemetry history ring buffer (power of two)
+#define HISTORY_LENGTH 32
+// Default number of ADC sweeps between history records
+#define HISTORY_INTERVAL 4
+// Maximum number of history records returned by one FIFO register read.
+// Must fit in the TWI driver buffer.
+#define HISTORY_READ_MAX 3
+
+// how long to wait until forcibly shutdown, unless a shorter timeout has
+// been learned (see shutdown_stats.h)
 #define SHUTDOWN_WAIT_DURATION 60000
+// maximum host-settable shutdown wait in seconds; the state machine timer
+// counts 16-bit milliseconds
+#define SHUTDOWN_WAIT_LIMIT_MAX 65
 
 // how long to stay in off state until restarting
 #define OFF_STATE_DURATION 5000
@@ -102,9 +133,25 @@ constexpr char kHWVersion[] = {2, 0, 1, 0xff};
 // how long to keep EN5V low in the event of watchdog reboot
 #define WATCHDOG_REBOOT_DURATION 2000
 
-// EEPROM addresses
+// Task intervals in milliseconds. The ADC sweep interval is selected to
+// desynchronize the readings from the other tasks.
+#define SAMPLE_INTERVAL 23
+#define BLINKER_INTERVAL 10
+#define TELEMETRY_INTERVAL 500
+#define STACK_CHECK_INTERVAL 1000
+
+// Settings are written to the EEPROM once they have been left unchanged
+// for CONFIG_SETTLE_TIME ms, but no later than CONFIG_MAX_COMMIT_DELAY ms
+// after the first change (see config.h)
+#define CONFIG_SETTLE_TIME 2000
+#define CONFIG_MAX_COMMIT_DELAY 10000
+
+// EEPROM addresses used by firmware versions before the record log. Only
+// read for migrating the settings.
 #define EEPROM_POWER_ON_VCAP_ADDR 0   // 2 bytes
 #define EEPROM_POWER_OFF_VCAP_ADDR 2  // 2 bytes
 #define EEPROM_LED_BRIGHTNESS_ADDR 4  // 1 byte
+#define EEPROM_ADC_OVERSAMPLE_ADDR 5  // 1 byte
+#define EEPROM_HISTORY_INTERVAL_ADDR 6  // 1 byte
 
 #endif  // SH_RPI_FIRMWARE_SRC_CONSTANTS_H_
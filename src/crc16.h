@@ -0,0 +1,19 @@
+#ifndef SH_RPI_FIRMWARE_SRC_CRC16_H_
+#define SH_RPI_FIRMWARE_SRC_CRC16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//////
+// CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+//
+// Protects the telemetry frames and the records saved in the EEPROM.
+
+/**
+ * @brief Calculate the CRC-16/CCITT-FALSE checksum.
+ *
+ * @param crc Initial value, or the CRC of the preceding data to continue it
+ */
+uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xffff);
+
+#endif  // SH_RPI_FIRMWARE_SRC_CRC16_H_
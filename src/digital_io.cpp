@@ -1,9 +1,7 @@
 #include "digital_io.h"
 
-#include <Arduino.h>
-#include <avr/io.h>
-
 #include "globals.h"
+#include "hal.h"
 
 bool read_pin(int pin) {
   PORT_t* port = digitalPinToPortStruct(pin);
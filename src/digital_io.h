@@ -1,9 +1,10 @@
 #ifndef _digital_io_H_
 #define _digital_io_H_
 
-#include <Arduino.h>
 #include <stdint.h>
 
+#include "hal.h"
+
 /**
  * @brief Write a pin value.
  *
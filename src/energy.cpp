@@ -0,0 +1,77 @@
+#include "energy.h"
+
+#include <string.h>
+
+#include "constants.h"
+#include "hal.h"
+
+// The sample power is v_in * i_in / 2^16, rounded, in units of
+// VIN_MAX * IIN_MAX / 2^16 W, and the sample current is i_in, in units of
+// IIN_MAX / 2^16 A. The integrals are in those units times ms, doubled by
+// the trapezoidal rule.
+constexpr uint32_t energy_units_per_mwh =
+    uint32_t(2 * 3600.0 * 65536 / (VIN_MAX * IIN_MAX) + 0.5);
+constexpr uint32_t charge_units_per_mah =
+    uint32_t(2 * 3600.0 * 65536 / IIN_MAX + 0.5);
+
+struct EnergyAccumulator {
+  EnergyTotals totals;
+  // fractions of a whole mWh and mAh
+  uint32_t energy_rest;
+  uint32_t charge_rest;
+};
+
+static EnergyAccumulator energy_counters[NUM_ENERGY_COUNTERS];
+
+// The previous sample
+static bool energy_have_previous = false;
+static uint32_t energy_previous_time = 0;
+static uint16_t energy_previous_power = 0;
+static uint16_t energy_previous_current = 0;
+
+static void energy_add(EnergyAccumulator& counter, uint32_t energy,
+                       uint32_t charge) {
+  counter.energy_rest += energy;
+  uint32_t mwh =
+      counter.totals.mwh + counter.energy_rest / energy_units_per_mwh;
+  counter.energy_rest %= energy_units_per_mwh;
+  counter.charge_rest += charge;
+  uint32_t mah =
+      counter.totals.mah + counter.charge_rest / charge_units_per_mah;
+  counter.charge_rest %= charge_units_per_mah;
+  // the TWI interrupt reads the totals (registers 0x50-0x53)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    counter.totals.mwh = mwh;
+    counter.totals.mah = mah;
+  }
+}
+
+void energy_record(uint16_t v_in, uint16_t i_in, uint32_t now) {
+  uint16_t power = ((uint32_t)v_in * i_in + 0x8000) >> 16;
+  if (energy_have_previous) {
+    uint32_t interval = now - energy_previous_time;
+    if (interval > ENERGY_MAX_INTERVAL) {
+      interval = ENERGY_MAX_INTERVAL;
+    }
+    uint32_t energy = ((uint32_t)energy_previous_power + power) * interval;
+    uint32_t charge = ((uint32_t)energy_previous_current + i_in) * interval;
+    for (uint8_t i = 0; i < NUM_ENERGY_COUNTERS; i++) {
+      energy_add(energy_counters[i], energy, charge);
+    }
+  }
+
+  energy_have_previous = true;
+  energy_previous_time = now;
+  energy_previous_power = power;
+  energy_previous_current = i_in;
+}
+
+void energy_get(EnergyCounter counter, EnergyTotals& totals) {
+  totals = energy_counters[counter].totals;
+}
+
+void energy_reset_trip() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memset(&energy_counters[ENERGY_TRIP], 0, sizeof(EnergyAccumulator));
+  }
+}
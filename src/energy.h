@@ -0,0 +1,52 @@
+#ifndef SH_RPI_FIRMWARE_SRC_ENERGY_H_
+#define SH_RPI_FIRMWARE_SRC_ENERGY_H_
+
+#include <stdint.h>
+
+//////
+// Input energy and charge accounting
+//
+// Every ADC sweep, the DC IN power (Vin * Iin) and current are integrated
+// over the time since the previous sweep with the trapezoidal rule. The
+// integrals are kept in fixed point: the whole milliwatt-hours and
+// milliampere-hours in 32-bit counters, and the remainders in the raw ADC
+// units, so no precision is lost between sweeps.
+//
+// There are two sets of counters: one running since boot and a trip
+// counter that the host can reset.
+
+// Gaps between sweeps longer than this (in ms) are integrated as if they
+// were this long, keeping the fixed-point remainders from overflowing
+#define ENERGY_MAX_INTERVAL 10000
+
+enum EnergyCounter {
+  ENERGY_SINCE_BOOT,
+  ENERGY_TRIP,
+  NUM_ENERGY_COUNTERS
+};
+
+struct EnergyTotals {
+  uint32_t mwh;  //!< Energy in mWh
+  uint32_t mah;  //!< Charge in mAh
+};
+
+/**
+ * @brief Integrate a new sample.
+ *
+ * @param v_in DC IN voltage, left-aligned 16-bit ADC value
+ * @param i_in DC IN current, left-aligned 16-bit ADC value
+ * @param now Sample time in ms
+ */
+void energy_record(uint16_t v_in, uint16_t i_in, uint32_t now);
+
+/**
+ * @brief Read the totals of a counter.
+ */
+void energy_get(EnergyCounter counter, EnergyTotals& totals);
+
+/**
+ * @brief Zero the trip counter.
+ */
+void energy_reset_trip();
+
+#endif  // SH_RPI_FIRMWARE_SRC_ENERGY_H_
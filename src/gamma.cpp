@@ -0,0 +1,9 @@
+#include "gamma.h"
+
+uint16_t gamma_correct(uint16_t intensity) {
+  uint8_t index = intensity >> 8;
+  uint8_t weight = intensity & 0xff;
+  uint16_t low = gamma_table.duty[index];
+  uint16_t high = gamma_table.duty[index + 1];
+  return low + (((uint32_t)(high - low) * weight) >> 8);
+}
@@ -0,0 +1,69 @@
+#ifndef SH_RPI_FIRMWARE_SRC_GAMMA_H_
+#define SH_RPI_FIRMWARE_SRC_GAMMA_H_
+
+#include <stdint.h>
+
+//////
+// CIE1931 lightness correction
+//
+// Maps a perceived LED intensity to a PWM duty value. The intensity is the
+// product of two 8-bit values (global brightness and LED value), so it
+// ranges from 0 to 255 * 255. The duty value has 4 fractional bits on top
+// of the 8-bit PWM resolution; the LED PWM output dithers the fraction
+// across PWM periods.
+//
+// The lookup table is generated at compile time. Constant data is placed
+// in flash and read through the memory-mapped flash section on the tinyAVR
+// 1-series, so no PROGMEM accessors are needed.
+
+#define GAMMA_INPUT_MAX (255U * 255U)
+#define GAMMA_DUTY_FRACTION_BITS 4
+#define GAMMA_DUTY_MAX (255U << GAMMA_DUTY_FRACTION_BITS)
+
+// one entry per 256 input counts, plus the end point
+#define GAMMA_TABLE_SIZE 257
+
+struct GammaTable {
+  uint16_t duty[GAMMA_TABLE_SIZE];
+};
+
+/**
+ * @brief Relative luminance of an intensity, scaled to GAMMA_DUTY_MAX.
+ */
+constexpr uint16_t gamma_cie1931(uint32_t intensity) {
+  if (intensity > GAMMA_INPUT_MAX) {
+    intensity = GAMMA_INPUT_MAX;
+  }
+  double lightness = 100.0 * intensity / GAMMA_INPUT_MAX;
+  double luminance = lightness <= 8
+                         ? lightness / 903.3
+                         : ((lightness + 16) / 116) * ((lightness + 16) / 116) *
+                               ((lightness + 16) / 116);
+  return uint16_t(luminance * GAMMA_DUTY_MAX + 0.5);
+}
+
+constexpr GammaTable gamma_make_table() {
+  GammaTable table{};
+  for (uint16_t i = 0; i < GAMMA_TABLE_SIZE; i++) {
+    table.duty[i] = gamma_cie1931(uint32_t(i) << 8);
+  }
+  return table;
+}
+
+inline constexpr GammaTable gamma_table = gamma_make_table();
+
+static_assert(gamma_table.duty[0] == 0, "zero intensity must be off");
+static_assert(gamma_table.duty[GAMMA_INPUT_MAX >> 8] == GAMMA_DUTY_MAX,
+              "full intensity must be fully on");
+
+/**
+ * @brief Get the PWM duty value of an intensity.
+ *
+ * Interpolates linearly between the table entries.
+ *
+ * @param intensity 0..GAMMA_INPUT_MAX
+ * @return Duty value, 0..GAMMA_DUTY_MAX
+ */
+uint16_t gamma_correct(uint16_t intensity);
+
+#endif  // SH_RPI_FIRMWARE_SRC_GAMMA_H_
@@ -1,21 +1,23 @@
 #ifndef SH_RPI_FIRMWARE_SRC_GLOBALS_H_
 #define SH_RPI_FIRMWARE_SRC_GLOBALS_H_
 
-#include <Arduino.h>
-
 #include "blinker.h"
 #include "constants.h"
+#include "hal.h"
 
 //////
 // Globals
+//
+// Host writes reach the main loop through the command mailbox (see
+// commands.h); the I2C interrupt handlers only set the single-byte
+// watchdog_reset and i2c_register values here directly. Multi-byte values
+// going the other way are published through the double-buffered I2C
+// register image.
 
 // milliseconds elapsed since last watchdog reset
 extern elapsedMillis watchdog_elapsed;
 // watchdog time limit
 extern int watchdog_limit;
-// new watchdog time limit set by the I2C event handler
-extern volatile int new_watchdog_limit;
-extern bool watchdog_value_changed;
 // set true whenever an i2c call is made
 extern volatile bool watchdog_reset;
 
@@ -31,27 +33,21 @@ extern int16_t power_on_vcap_voltage;
 extern int16_t power_off_vcap_voltage;
 extern int16_t vcap_alarm_voltage;
 extern bool vcap_alarm_triggered;
-extern bool vcap_alarm_changed;
-
-extern int16_t new_power_on_vcap_voltage;
-extern int16_t new_power_off_vcap_voltage;
 
 extern uint8_t led_global_brightness;
-extern uint8_t new_led_global_brightness;
+
+// ceiling of the shutdown timeout in seconds
+extern uint8_t shutdown_wait_limit;
 
 extern uint16_t v_supercap;
 extern uint16_t v_in;
 extern uint16_t i_in;
 extern uint16_t temperature_K;
 
-extern char v_supercap_buf[2];
-extern char v_in_buf[2];
-extern char i_in_buf[2];
-extern char temperature_K_buf[2];
-
-extern volatile bool shutdown_requested;
-extern volatile bool sleep_requested;
-extern volatile bool reset_requested;
+// left-aligned 16-bit readings as transmitted over I2C
+extern uint16_t v_supercap_word;
+extern uint16_t v_in_word;
+extern uint16_t i_in_word;
 
 extern LedBlinker led_blinker;
 
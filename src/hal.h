@@ -0,0 +1,28 @@
+#ifndef SH_RPI_FIRMWARE_SRC_HAL_H_
+#define SH_RPI_FIRMWARE_SRC_HAL_H_
+
+// Hardware abstraction layer.
+//
+// Firmware sources include this header instead of the Arduino, AVR and
+// library headers. On the target, it pulls in megaTinyCore and the AVR
+// register definitions. In the native environment, it pulls in a Linux
+// backend that provides the same API on top of plain memory, so the state
+// machine, blinker and I2C protocol can be built and run on the host.
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Wire.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <elapsedMillis.h>
+#include <util/atomic.h>
+
+#else
+
+#include "hal_native.h"
+
+#endif
+
+#endif  // SH_RPI_FIRMWARE_SRC_HAL_H_
@@ -0,0 +1,371 @@
+// Linux backend of the hardware abstraction layer. Only built for the
+// native environment.
+
+#ifndef ARDUINO
+
+#include "hal_native.h"
+
+#include <stdio.h>
+
+ADC_t ADC0;
+ADC_t ADC1;
+PORT_t PORTA;
+PORT_t PORTB;
+PORT_t PORTC;
+NVMCTRL_t NVMCTRL;
+TCA_t TCA0;
+TCB_t TCB0;
+TCB_t TCB1;
+VREF_t VREF;
+SIGROW_t SIGROW;
+
+HardwareSerial Serial;
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+uint8_t native_eeprom[NATIVE_EEPROM_SIZE];
+uint32_t native_eeprom_writes = 0;
+uint32_t native_nvm_operations = 0;
+NativeEepromPageBuffer native_eeprom_page_buffer;
+int native_pwm[NUM_DIGITAL_PINS];
+bool native_serial_echo = false;
+uint32_t native_sleep_count = 0;
+
+static unsigned long native_millis = 0;
+static uint16_t native_analog_inputs[2][32];
+
+static uint8_t native_page_buffer[NATIVE_EEPROM_SIZE];
+static bool native_page_buffer_loaded[NATIVE_EEPROM_SIZE];
+static unsigned long native_nvm_busy_ms = 0;
+
+// Default handlers for interrupts the firmware does not use
+extern "C" __attribute__((weak)) void ADC0_RESRDY_vect() {}
+extern "C" __attribute__((weak)) void ADC1_RESRDY_vect() {}
+extern "C" __attribute__((weak)) void ADC0_WCOMP_vect() {}
+extern "C" __attribute__((weak)) void ADC1_WCOMP_vect() {}
+extern "C" __attribute__((weak)) void NVMCTRL_EE_vect() {}
+extern "C" __attribute__((weak)) void TCA0_LUNF_vect() {}
+extern "C" __attribute__((weak)) void TCB0_INT_vect() {}
+extern "C" __attribute__((weak)) void TCB1_INT_vect() {}
+
+static struct NativeInit {
+  NativeInit() { memset(native_eeprom, 0xff, sizeof(native_eeprom)); }
+} native_init;
+
+//////
+// Interrupts
+
+void sleep_cpu() { native_sleep_count++; }
+
+volatile bool native_interrupts_enabled = true;
+static void (*volatile native_pending_interrupt)() = nullptr;
+
+void native_sei() {
+  do {
+    // run a pending handler with interrupts disabled, like the CPU does
+    native_interrupts_enabled = false;
+    void (*isr)() = native_pending_interrupt;
+    native_pending_interrupt = nullptr;
+    if (isr) {
+      isr();
+    }
+    native_interrupts_enabled = true;
+    // an interrupt raised before the flag was set is still pending
+  } while (native_pending_interrupt);
+}
+
+void native_interrupt(void (*isr)()) {
+  if (!native_interrupts_enabled) {
+    native_pending_interrupt = isr;
+    return;
+  }
+  native_interrupts_enabled = false;
+  isr();
+  native_interrupts_enabled = true;
+}
+
+//////
+// Arduino core
+
+unsigned long millis() { return native_millis; }
+
+unsigned long micros() { return native_millis * 1000; }
+
+void delay(unsigned long ms) { native_advance(ms); }
+
+PORT_t* digitalPinToPortStruct(uint8_t pin) {
+  switch (pin / 8) {
+    case 0:
+      return &PORTA;
+    case 1:
+      return &PORTB;
+    default:
+      return &PORTC;
+  }
+}
+
+uint8_t digitalPinToBitMask(uint8_t pin) { return 1 << (pin % 8); }
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  PORT_t* port = digitalPinToPortStruct(pin);
+  if (mode == OUTPUT) {
+    port->DIR |= digitalPinToBitMask(pin);
+  } else {
+    port->DIR &= ~digitalPinToBitMask(pin);
+  }
+  if (mode == INPUT_PULLUP) {
+    port->IN |= digitalPinToBitMask(pin);
+  }
+}
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin < NUM_DIGITAL_PINS) {
+    native_pwm[pin] = value;
+  }
+}
+
+void HardwareSerial::begin(unsigned long baud) {}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (native_serial_echo) {
+    putchar(c);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+size_t HardwareSerial::print(const char* str) {
+  return write((const uint8_t*)str, strlen(str));
+}
+
+size_t HardwareSerial::print(long value) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%ld", value);
+  return print(buf);
+}
+
+size_t HardwareSerial::print(unsigned long value) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%lu", value);
+  return print(buf);
+}
+
+size_t HardwareSerial::println(const char* str) {
+  return print(str) + print("\n");
+}
+
+//////
+// Libraries
+
+void TwoWire::begin(uint8_t address) { native_enabled_ = true; }
+
+void TwoWire::end() { native_enabled_ = false; }
+
+size_t TwoWire::write(const uint8_t* data, size_t quantity) {
+  size_t n = 0;
+  while (n < quantity && tx_length_ < BUFFER_LENGTH) {
+    tx_buffer_[tx_length_++] = data[n++];
+  }
+  return n;
+}
+
+uint8_t EEPROMClass::read(int address) {
+  return native_eeprom[address % NATIVE_EEPROM_SIZE];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  if (native_eeprom[address % NATIVE_EEPROM_SIZE] != value) {
+    native_eeprom[address % NATIVE_EEPROM_SIZE] = value;
+    native_eeprom_writes++;
+  }
+}
+
+uint16_t EEPROMClass::length() { return NATIVE_EEPROM_SIZE; }
+
+//////
+// NVM controller
+
+NativeEepromPageBuffer::Byte& NativeEepromPageBuffer::Byte::operator=(
+    uint8_t value) {
+  native_page_buffer[address] = value;
+  native_page_buffer_loaded[address] = true;
+  return *this;
+}
+
+void native_protected_write_spm(register8_t& reg, uint8_t value) {
+  if (&reg != &NVMCTRL.CTRLA || value != NVMCTRL_CMD_PAGEERASEWRITE_gc) {
+    reg = value;
+    return;
+  }
+  // only the loaded bytes of the page buffer are erased and written
+  for (int i = 0; i < NATIVE_EEPROM_SIZE; i++) {
+    if (native_page_buffer_loaded[i]) {
+      EEPROM.write(i, native_page_buffer[i]);
+      native_page_buffer_loaded[i] = false;
+    }
+  }
+  native_nvm_operations++;
+  NVMCTRL.STATUS |= NVMCTRL_EEBUSY_bm;
+  native_nvm_busy_ms = NATIVE_NVM_WRITE_MS;
+}
+
+//////
+// Simulation control
+
+// Update the input register of a port from its outputs.
+static void native_settle_port(PORT_t& port) {
+  // output pins read back their driven level
+  port.IN = (port.IN & ~port.DIR) | (port.OUT & port.DIR);
+}
+
+static void native_run_conversion(ADC_t& adc, uint8_t adc_num,
+                                  void (*resrdy_isr)(), void (*wcomp_isr)()) {
+  if (!(adc.COMMAND & ADC_STCONV_bm)) {
+    return;
+  }
+  // a free-running ADC keeps converting
+  if (!(adc.CTRLA & ADC_FREERUN_bm)) {
+    adc.COMMAND = 0;
+  }
+  uint8_t samples = 1 << (adc.CTRLB & 0x07);
+  adc.RES = native_analog_inputs[adc_num][adc.MUXPOS & 0x1f] * samples;
+  adc.INTFLAGS |= ADC_RESRDY_bm;
+  if ((adc.CTRLE & 0x07) == ADC_WINCM_BELOW_gc && adc.RES < adc.WINLT) {
+    adc.INTFLAGS |= ADC_WCMP_bm;
+    if (adc.INTCTRL & ADC_WCMP_bm) {
+      bool freerun = adc.CTRLA & ADC_FREERUN_bm;
+      wcomp_isr();
+      if (freerun && !(adc.CTRLA & ADC_FREERUN_bm)) {
+        // the handler stopped the ADC, discarding the result
+        adc.COMMAND = 0;
+        return;
+      }
+    }
+  }
+  if (adc.INTCTRL & ADC_RESRDY_bm) {
+    resrdy_isr();
+  }
+}
+
+void native_run_adc() {
+  // An interrupt handler may start another conversion right away. A
+  // free-running ADC runs the full number of conversions.
+  for (int i = 0; i < 64; i++) {
+    if (!((ADC0.COMMAND | ADC1.COMMAND) & ADC_STCONV_bm)) {
+      break;
+    }
+    native_run_conversion(ADC0, 0, ADC0_RESRDY_vect, ADC0_WCOMP_vect);
+    native_run_conversion(ADC1, 1, ADC1_RESRDY_vect, ADC1_WCOMP_vect);
+  }
+}
+
+// Advance a TCB in periodic interrupt mode, running its interrupt on every
+// period.
+static void native_run_tcb(TCB_t& tcb, unsigned long ms, void (*isr)()) {
+  if (!(tcb.CTRLA & TCB_ENABLE_bm)) {
+    return;
+  }
+  uint32_t clock_div = (tcb.CTRLA & 0x06) == TCB_CLKSEL_CLKDIV2_gc ? 2 : 1;
+  uint64_t ticks = (uint64_t)ms * (F_CPU / 1000) / clock_div;
+  uint32_t period = (uint32_t)tcb.CCMP + 1;
+  while (ticks) {
+    uint32_t to_top = period - tcb.CNT;
+    if (ticks < to_top) {
+      tcb.CNT = tcb.CNT + ticks;
+      break;
+    }
+    ticks -= to_top;
+    tcb.CNT = 0;
+    tcb.INTFLAGS |= TCB_CAPT_bm;
+    if (tcb.INTCTRL & TCB_CAPT_bm) {
+      isr();
+    }
+  }
+}
+
+// A PWM period of TCA0 is shorter than a millisecond, so a pending
+// underflow interrupt always runs when the clock advances.
+static void native_run_tca(TCA_t& tca, void (*lunf_isr)()) {
+  tca.SPLIT.INTFLAGS |= TCA_SPLIT_LUNF_bm;
+  if (tca.SPLIT.INTCTRL & TCA_SPLIT_LUNF_bm) {
+    lunf_isr();
+  }
+}
+
+// Complete the EEPROM operation in progress, then keep running the
+// EEREADY interrupt until it is disabled or starts another operation.
+static void native_run_nvm(unsigned long ms) {
+  if (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm) {
+    if (ms < native_nvm_busy_ms) {
+      native_nvm_busy_ms -= ms;
+      return;
+    }
+    NVMCTRL.STATUS &= ~NVMCTRL_EEBUSY_bm;
+  }
+  for (int i = 0; i < 64 && (NVMCTRL.INTCTRL & NVMCTRL_EEREADY_bm) &&
+                  !(NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm);
+       i++) {
+    NVMCTRL_EE_vect();
+  }
+}
+
+void native_advance(unsigned long ms) {
+  native_run_tca(TCA0, TCA0_LUNF_vect);
+  native_settle_port(PORTA);
+  native_settle_port(PORTB);
+  native_settle_port(PORTC);
+  native_run_adc();
+  native_run_tcb(TCB0, ms, TCB0_INT_vect);
+  native_run_tcb(TCB1, ms, TCB1_INT_vect);
+  native_run_nvm(ms);
+  native_millis += ms;
+}
+
+void native_set_analog_input(uint8_t adc_num, uint8_t ain, uint16_t value) {
+  native_analog_inputs[adc_num & 1][ain & 0x1f] = value;
+}
+
+void native_set_pin(uint8_t pin, bool value) {
+  PORT_t* port = digitalPinToPortStruct(pin);
+  if (value) {
+    port->IN |= digitalPinToBitMask(pin);
+  } else {
+    port->IN &= ~digitalPinToBitMask(pin);
+  }
+}
+
+void native_i2c_write(const uint8_t* data, uint8_t length) {
+  if (!Wire.native_enabled_ || !Wire.on_receive_) {
+    return;
+  }
+  if (length > BUFFER_LENGTH) {
+    length = BUFFER_LENGTH;
+  }
+  memcpy(Wire.rx_buffer_, data, length);
+  Wire.rx_length_ = length;
+  Wire.rx_index_ = 0;
+  Wire.on_receive_(length);
+}
+
+uint8_t native_i2c_read(uint8_t reg, uint8_t* data, uint8_t length) {
+  native_i2c_write(&reg, 1);
+  if (!Wire.native_enabled_ || !Wire.on_request_) {
+    return 0;
+  }
+  Wire.tx_length_ = 0;
+  Wire.on_request_();
+  uint8_t n = Wire.tx_length_ < length ? Wire.tx_length_ : length;
+  memcpy(data, Wire.tx_buffer_, n);
+  Wire.bytes_read_ += n;
+  // the host clocks out 0xff once the slave runs out of data
+  memset(data + n, 0xff, length - n);
+  return n;
+}
+
+#endif  // ARDUINO
@@ -0,0 +1,479 @@
+#ifndef SH_RPI_FIRMWARE_SRC_HAL_NATIVE_H_
+#define SH_RPI_FIRMWARE_SRC_HAL_NATIVE_H_
+
+// Linux backend of the hardware abstraction layer.
+//
+// Provides the subset of the megaTinyCore, AVR and library APIs used by the
+// firmware, backed by plain memory. Peripheral registers are ordinary
+// structs that the firmware reads and writes as usual; the native_*
+// functions at the end of this file let a host program drive the simulated
+// clock, analog inputs, I2C bus and interrupt handlers.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define F_CPU 20000000L
+#define MILLIS_USE_TIMERD0
+
+//////
+// Interrupts
+
+// Interrupt handlers become plain functions that the simulation calls.
+#define ISR(vector) extern "C" void vector()
+
+// Global interrupt enable flag. An interrupt raised asynchronously with
+// native_interrupt() while it is clear is held pending until sei().
+extern volatile bool native_interrupts_enabled;
+
+inline void native_cli() {
+  native_interrupts_enabled = false;
+  // keep the accesses that follow inside the critical section
+  __asm__ __volatile__("" ::: "memory");
+}
+
+void native_sei();
+
+#define cli() native_cli()
+#define sei() native_sei()
+
+// The simulated CPU never actually sleeps; sleep_cpu() only counts.
+#define SLEEP_MODE_IDLE 0x00
+#define SLEEP_MODE_STANDBY 0x02
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+void sleep_cpu();
+
+// Restores the interrupt enable flag on leaving the block, also through
+// return or break
+struct NativeAtomicBlock {
+  bool sreg = native_interrupts_enabled;
+  bool once = true;
+  NativeAtomicBlock() { cli(); }
+  ~NativeAtomicBlock() {
+    if (sreg) {
+      sei();
+    }
+  }
+};
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type)                                  \
+  for (NativeAtomicBlock _atomic_block; _atomic_block.once; \
+       _atomic_block.once = false)
+
+//////
+// Peripheral registers
+
+typedef volatile uint8_t register8_t;
+typedef volatile uint16_t register16_t;
+
+typedef struct {
+  register8_t CTRLA;
+  register8_t CTRLB;
+  register8_t CTRLC;
+  register8_t CTRLD;
+  register8_t CTRLE;
+  register8_t SAMPCTRL;
+  register8_t MUXPOS;
+  register8_t COMMAND;
+  register8_t EVCTRL;
+  register8_t INTCTRL;
+  register8_t INTFLAGS;
+  register8_t DBGCTRL;
+  register8_t TEMP;
+  register16_t RES;
+  register16_t WINLT;
+  register16_t WINHT;
+  register8_t CALIB;
+} ADC_t;
+
+// Writing ones to a strobe register (DIRSET, OUTCLR, ...) sets, clears or
+// toggles those bits in the register `offset` bytes before it. Reading
+// returns that register.
+enum NativeStrobeOp { NATIVE_STROBE_SET, NATIVE_STROBE_CLR, NATIVE_STROBE_TGL };
+
+template <int offset, NativeStrobeOp op>
+struct NativeStrobe {
+  NativeStrobe& operator=(uint8_t value) {
+    register8_t& target = *((register8_t*)this - offset);
+    switch (op) {
+      case NATIVE_STROBE_SET:
+        target = target | value;
+        break;
+      case NATIVE_STROBE_CLR:
+        target = target & ~value;
+        break;
+      case NATIVE_STROBE_TGL:
+        target = target ^ value;
+        break;
+    }
+    return *this;
+  }
+  operator uint8_t() const { return *((const register8_t*)this - offset); }
+};
+
+typedef struct {
+  register8_t DIR;
+  NativeStrobe<1, NATIVE_STROBE_SET> DIRSET;
+  NativeStrobe<2, NATIVE_STROBE_CLR> DIRCLR;
+  NativeStrobe<3, NATIVE_STROBE_TGL> DIRTGL;
+  register8_t OUT;
+  NativeStrobe<1, NATIVE_STROBE_SET> OUTSET;
+  NativeStrobe<2, NATIVE_STROBE_CLR> OUTCLR;
+  NativeStrobe<3, NATIVE_STROBE_TGL> OUTTGL;
+  register8_t IN;
+  register8_t INTFLAGS;
+  register8_t PINCTRL[8];
+} PORT_t;
+
+typedef struct {
+  register8_t CTRLA;
+  register8_t CTRLB;
+  register8_t CTRLC;
+} VREF_t;
+
+typedef struct {
+  register8_t TEMPSENSE0;
+  register8_t TEMPSENSE1;
+} SIGROW_t;
+
+typedef struct {
+  register8_t CTRLA;
+  register8_t CTRLB;
+  register8_t EVCTRL;
+  register8_t INTCTRL;
+  register8_t INTFLAGS;
+  register8_t STATUS;
+  register8_t DBGCTRL;
+  register8_t TEMP;
+  register16_t CNT;
+  register16_t CCMP;
+} TCB_t;
+
+typedef struct {
+  register8_t CTRLA;
+  register8_t CTRLB;
+  register8_t INTCTRL;
+  register8_t INTFLAGS;
+  register8_t LPER;
+  register8_t HPER;
+  register8_t LCMP0;
+  register8_t HCMP0;
+  register8_t LCMP1;
+  register8_t HCMP1;
+  register8_t LCMP2;
+  register8_t HCMP2;
+} TCA_SPLIT_t;
+
+typedef union {
+  TCA_SPLIT_t SPLIT;
+} TCA_t;
+
+typedef struct {
+  register8_t CTRLA;
+  register8_t CTRLB;
+  register8_t STATUS;
+  register8_t INTCTRL;
+  register8_t INTFLAGS;
+  register8_t reserved_0x05;
+  register16_t DATA;
+  register16_t ADDR;
+} NVMCTRL_t;
+
+extern ADC_t ADC0;
+extern ADC_t ADC1;
+extern PORT_t PORTA;
+extern PORT_t PORTB;
+extern PORT_t PORTC;
+extern NVMCTRL_t NVMCTRL;
+extern TCA_t TCA0;
+extern TCB_t TCB0;
+extern TCB_t TCB1;
+extern VREF_t VREF;
+extern SIGROW_t SIGROW;
+
+#define ADC_ENABLE_bm 0x01
+#define ADC_FREERUN_bm 0x02
+#define ADC_SAMPNUM_ACC1_gc 0x00
+#define ADC_SAMPNUM_ACC4_gc 0x02
+#define ADC_SAMPNUM_ACC64_gc 0x06
+#define ADC_PRESC_DIV2_gc 0x00
+#define ADC_PRESC_DIV4_gc 0x01
+#define ADC_PRESC_DIV8_gc 0x02
+#define ADC_PRESC_DIV16_gc 0x03
+#define ADC_PRESC_DIV32_gc 0x04
+#define ADC_REFSEL_gm 0x30
+#define ADC_REFSEL_VDDREF_gc 0x10
+#define ADC_SAMPCAP_bm 0x40
+#define ADC_INITDLY_DLY16_gc 0x20
+#define ADC_STCONV_bm 0x01
+#define ADC_RESRDY_bm 0x01
+#define ADC_WCMP_bm 0x02
+#define ADC_WINCM_NONE_gc 0x00
+#define ADC_WINCM_BELOW_gc 0x01
+
+#define NVMCTRL_CMD_PAGEERASEWRITE_gc 0x03
+#define NVMCTRL_EEBUSY_bm 0x02
+#define NVMCTRL_EEREADY_bm 0x01
+
+// Self-programming commands need the CCP unlock on the MCU. Here, the
+// write executes the command.
+#define _PROTECTED_WRITE_SPM(reg, value) native_protected_write_spm(reg, value)
+void native_protected_write_spm(register8_t& reg, uint8_t value);
+
+#define EEPROM_PAGE_SIZE 32
+
+// Stands in for the memory-mapped EEPROM, of which only the writes that
+// load the NVM page buffer are used
+class NativeEepromPageBuffer {
+ public:
+  struct Byte {
+    uint8_t address;
+    Byte& operator=(uint8_t value);
+  };
+  Byte operator[](uint8_t address) { return Byte{address}; }
+};
+
+extern NativeEepromPageBuffer native_eeprom_page_buffer;
+
+#define PIN0_bm 0x01
+#define PIN1_bm 0x02
+#define PIN2_bm 0x04
+#define PIN3_bm 0x08
+#define PIN4_bm 0x10
+#define PIN5_bm 0x20
+#define PIN6_bm 0x40
+#define PIN7_bm 0x80
+
+#define TCA_SPLIT_ENABLE_bm 0x01
+#define TCA_SPLIT_LCMP0EN_bm 0x01
+#define TCA_SPLIT_LCMP1EN_bm 0x02
+#define TCA_SPLIT_LCMP2EN_bm 0x04
+#define TCA_SPLIT_HCMP0EN_bm 0x10
+#define TCA_SPLIT_HCMP1EN_bm 0x20
+#define TCA_SPLIT_HCMP2EN_bm 0x40
+#define TCA_SPLIT_LUNF_bm 0x01
+
+#define TCB_ENABLE_bm 0x01
+#define TCB_CLKSEL_CLKDIV1_gc 0x00
+#define TCB_CLKSEL_CLKDIV2_gc 0x02
+#define TCB_CNTMODE_INT_gc 0x00
+#define TCB_CAPT_bm 0x01
+
+#define VREF_ADC0REFSEL_gm 0x07
+#define VREF_ADC0REFSEL_gp 0
+#define VREF_ADC0REFEN_bm 0x02
+#define VREF_ADC1REFSEL_gm 0x07
+#define VREF_ADC1REFSEL_gp 0
+#define VREF_ADC1REFEN_bm 0x10
+
+//////
+// Arduino core
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define VDD 0x10
+#define INTERNAL 0x00
+#define INTERNAL0V55 0x80
+#define INTERNAL1V1 0x81
+#define INTERNAL2V5 0x82
+#define INTERNAL4V34 0x83
+#define INTERNAL1V5 0x84
+
+// Pin numbers are port * 8 + bit
+#define PIN_PA0 0
+#define PIN_PA1 1
+#define PIN_PA2 2
+#define PIN_PA3 3
+#define PIN_PA4 4
+#define PIN_PA5 5
+#define PIN_PA6 6
+#define PIN_PA7 7
+#define PIN_PB0 8
+#define PIN_PB1 9
+#define PIN_PB2 10
+#define PIN_PB3 11
+#define PIN_PB4 12
+#define PIN_PB5 13
+#define PIN_PC0 16
+#define PIN_PC1 17
+#define PIN_PC2 18
+#define PIN_PC3 19
+#define NUM_DIGITAL_PINS 24
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void analogWrite(uint8_t pin, int value);
+PORT_t* digitalPinToPortStruct(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+
+class HardwareSerial {
+ public:
+  void begin(unsigned long baud);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t* buffer, size_t size);
+  int availableForWrite() { return 64; }
+  size_t print(const char* str);
+  size_t print(long value);
+  size_t print(unsigned long value);
+  size_t print(int value) { return print(long(value)); }
+  size_t print(unsigned int value) { return print((unsigned long)value); }
+  size_t println(const char* str);
+};
+
+extern HardwareSerial Serial;
+
+//////
+// Libraries
+
+class elapsedMillis {
+ public:
+  elapsedMillis(unsigned long value = 0) : start_{millis() - value} {}
+  operator unsigned long() const { return millis() - start_; }
+  elapsedMillis& operator=(unsigned long value) {
+    start_ = millis() - value;
+    return *this;
+  }
+
+ private:
+  unsigned long start_;
+};
+
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+ public:
+  void swap(uint8_t state) {}
+  void begin(uint8_t address);
+  void end();
+  void onReceive(void (*handler)(int)) { on_receive_ = handler; }
+  void onRequest(void (*handler)()) { on_request_ = handler; }
+  int available() { return rx_length_ - rx_index_; }
+  int read() { return rx_index_ < rx_length_ ? rx_buffer_[rx_index_++] : -1; }
+  size_t write(uint8_t data) { return write(&data, 1); }
+  size_t write(const uint8_t* data, size_t quantity);
+  size_t write(const char* data, size_t quantity) {
+    return write((const uint8_t*)data, quantity);
+  }
+  // Bytes the host has read since the last call (megaTinyCore extension)
+  uint8_t getBytesRead() {
+    uint8_t bytes = bytes_read_;
+    bytes_read_ = 0;
+    return bytes;
+  }
+
+  // Simulated host side of the bus
+  bool native_enabled_ = false;
+  void (*on_receive_)(int) = nullptr;
+  void (*on_request_)() = nullptr;
+  uint8_t rx_buffer_[BUFFER_LENGTH];
+  uint8_t rx_length_ = 0;
+  uint8_t rx_index_ = 0;
+  uint8_t tx_buffer_[BUFFER_LENGTH];
+  uint8_t tx_length_ = 0;
+  uint8_t bytes_read_ = 0;
+};
+
+extern TwoWire Wire;
+
+class EEPROMClass {
+ public:
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value) { write(address, value); }
+  uint16_t length();
+
+  template <typename T>
+  T& get(int address, T& value) {
+    uint8_t* p = (uint8_t*)&value;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      p[i] = read(address + i);
+    }
+    return value;
+  }
+
+  template <typename T>
+  const T& put(int address, const T& value) {
+    const uint8_t* p = (const uint8_t*)&value;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      update(address + i, p[i]);
+    }
+    return value;
+  }
+};
+
+extern EEPROMClass EEPROM;
+
+//////
+// Simulation control
+
+#define NATIVE_EEPROM_SIZE 256
+
+// Duration of an EEPROM page erase/write operation
+#define NATIVE_NVM_WRITE_MS 4
+
+extern uint8_t native_eeprom[NATIVE_EEPROM_SIZE];
+// Number of EEPROM bytes changed
+extern uint32_t native_eeprom_writes;
+// Number of NVMCTRL page erase/write operations
+extern uint32_t native_nvm_operations;
+// Last value written to each pin with analogWrite
+extern int native_pwm[NUM_DIGITAL_PINS];
+// Echo Serial output to stdout
+extern bool native_serial_echo;
+// Number of times the CPU has been put to sleep
+extern uint32_t native_sleep_count;
+
+/**
+ * @brief Advance the simulated clock, completing ADC conversions and
+ * EEPROM operations.
+ */
+void native_advance(unsigned long ms);
+
+/**
+ * @brief Set the simulated 10-bit reading of an analog input.
+ */
+void native_set_analog_input(uint8_t adc_num, uint8_t ain, uint16_t value);
+
+/**
+ * @brief Complete all pending ADC conversions and run their interrupts.
+ *
+ * A free-running ADC performs a fixed number of conversions, comparing each
+ * result against its window.
+ */
+void native_run_adc();
+
+/**
+ * @brief Raise an interrupt asynchronously, as from a signal handler.
+ *
+ * The handler runs at once with interrupts disabled, or, if interrupts are
+ * disabled, on the next sei(). Models the preemption of the main loop by
+ * an interrupt on the MCU.
+ */
+void native_interrupt(void (*isr)());
+
+/**
+ * @brief Set the input level of a pin.
+ */
+void native_set_pin(uint8_t pin, bool value);
+
+/**
+ * @brief Simulate an I2C write transaction from the host.
+ */
+void native_i2c_write(const uint8_t* data, uint8_t length);
+
+/**
+ * @brief Simulate a register read transaction from the host.
+ *
+ * @return Number of bytes provided by the firmware
+ */
+uint8_t native_i2c_read(uint8_t reg, uint8_t* data, uint8_t length);
+
+#endif  // SH_RPI_FIRMWARE_SRC_HAL_NATIVE_H_
@@ -0,0 +1,85 @@
+#include "history.h"
+
+#include <string.h>
+
+static uint8_t history_buffer[HISTORY_LENGTH][HISTORY_RECORD_SIZE];
+
+// Free-running indices; the buffer position is the index modulo
+// HISTORY_LENGTH. head is only written by the producer, tail only by the
+// consumer.
+static volatile uint8_t history_head = 0;
+static volatile uint8_t history_tail = 0;
+// Overflows counted by the producer and acknowledged by the consumer, in
+// the same way; the count stops short of wrapping around to the
+// acknowledged value
+static volatile uint8_t history_overflows = 0;
+static volatile uint8_t history_overflows_acked = 0;
+
+static uint8_t history_interval = HISTORY_INTERVAL;
+
+void history_record(uint16_t v_in, uint16_t v_cap, uint16_t i_in,
+                    uint8_t state) {
+  static uint8_t sequence = 0;
+  static uint8_t samples_skipped = 0;
+
+  sequence++;
+
+  if (history_interval == 0 || ++samples_skipped < history_interval) {
+    return;
+  }
+  samples_skipped = 0;
+
+  uint8_t head = history_head;
+  if ((uint8_t)(head - history_tail) >= HISTORY_LENGTH) {
+    uint8_t overflows = history_overflows + 1;
+    if (overflows != history_overflows_acked) {
+      history_overflows = overflows;
+    }
+    return;
+  }
+
+  uint8_t* record = history_buffer[head % HISTORY_LENGTH];
+  record[0] = v_in >> 8;
+  record[1] = v_in & 0xff;
+  record[2] = v_cap >> 8;
+  record[3] = v_cap & 0xff;
+  record[4] = i_in >> 8;
+  record[5] = i_in & 0xff;
+  record[6] = state;
+  record[7] = sequence;
+
+  // publish the record only after it has been written
+  history_head = head + 1;
+}
+
+void history_set_interval(uint8_t interval) { history_interval = interval; }
+
+uint8_t history_get_interval() { return history_interval; }
+
+uint8_t history_count() { return history_head - history_tail; }
+
+bool history_get_overflow(uint8_t& mark) {
+  mark = history_overflows;
+  return mark != history_overflows_acked;
+}
+
+void history_clear_overflow(uint8_t mark) { history_overflows_acked = mark; }
+
+uint8_t history_peek(uint8_t* dst, uint8_t max_records) {
+  uint8_t tail = history_tail;
+  uint8_t count = history_head - tail;
+  if (count > max_records) {
+    count = max_records;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    memcpy(dst, history_buffer[tail % HISTORY_LENGTH], HISTORY_RECORD_SIZE);
+    dst += HISTORY_RECORD_SIZE;
+    tail++;
+  }
+  return count;
+}
+
+void history_drop(uint8_t count) {
+  uint8_t available = history_head - history_tail;
+  history_tail = history_tail + (count < available ? count : available);
+}
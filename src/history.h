@@ -0,0 +1,95 @@
+#ifndef SH_RPI_FIRMWARE_SRC_HISTORY_H_
+#define SH_RPI_FIRMWARE_SRC_HISTORY_H_
+
+#include <stdint.h>
+
+#include "constants.h"
+
+//////
+// Telemetry history
+//
+// Every HISTORY_INTERVAL ADC sweeps, a record of Vin, Vcap, Iin and the
+// state machine state is appended to a ring buffer in SRAM. The host drains
+// the buffer through the I2C FIFO register.
+//
+// The ring buffer has a single producer (the main loop) and a single
+// consumer (the I2C handlers). Each side only writes its own index, so no
+// locking is needed. If the buffer is full, new records are dropped and
+// the overflow flag is set until the host reads it.
+//
+// The consumer copies records and the overflow flag out first and removes
+// or clears them only once the host has actually read them, so a read cut
+// short by the host loses nothing.
+
+// Size of a serialized history record in bytes
+#define HISTORY_RECORD_SIZE 8
+
+// Record layout (multi-byte values are big-endian):
+//
+// Offset  Size  Content
+//   0      2    DC IN voltage (as I2C register 0x20)
+//   2      2    Supercap voltage (as I2C register 0x21)
+//   4      2    DC IN current (as I2C register 0x22)
+//   6      1    State machine state
+//   7      1    Sample sequence number, incremented on every ADC sweep
+
+static_assert((HISTORY_LENGTH & (HISTORY_LENGTH - 1)) == 0,
+              "HISTORY_LENGTH must be a power of two");
+
+/**
+ * @brief Record a new sample.
+ *
+ * Called once per ADC sweep. Only every history_get_interval()th sample is
+ * stored.
+ */
+void history_record(uint16_t v_in, uint16_t v_cap, uint16_t i_in,
+                    uint8_t state);
+
+/**
+ * @brief Set the recording interval.
+ *
+ * @param interval Number of ADC sweeps between records; 0 disables
+ *   recording.
+ */
+void history_set_interval(uint8_t interval);
+
+uint8_t history_get_interval();
+
+/**
+ * @brief Number of records waiting to be read.
+ */
+uint8_t history_count();
+
+/**
+ * @brief Read the overflow flag.
+ *
+ * @param mark Set to the value to pass to history_clear_overflow() once
+ *   the flag has reached the host
+ * @return true if records have been dropped since the flag was cleared
+ */
+bool history_get_overflow(uint8_t& mark);
+
+/**
+ * @brief Clear the overflow flag as read by history_get_overflow().
+ *
+ * Records dropped after that read set the flag again.
+ */
+void history_clear_overflow(uint8_t mark);
+
+/**
+ * @brief Copy up to max_records oldest records without removing them.
+ *
+ * @param dst Destination buffer of max_records * HISTORY_RECORD_SIZE bytes
+ * @param max_records Maximum number of records to copy
+ * @return Number of records copied
+ */
+uint8_t history_peek(uint8_t* dst, uint8_t max_records);
+
+/**
+ * @brief Remove the oldest records, once the host has read them.
+ *
+ * @param count Number of records to remove
+ */
+void history_drop(uint8_t count);
+
+#endif  // SH_RPI_FIRMWARE_SRC_HISTORY_H_
@@ -0,0 +1,119 @@
+#include "holdup.h"
+
+static_assert((HOLDUP_FIT_POINTS & (HOLDUP_FIT_POINTS - 1)) == 0,
+              "HOLDUP_FIT_POINTS must be a power of two");
+static_assert(HOLDUP_POINT_INTERVAL % 50 == 0,
+              "HOLDUP_POINT_INTERVAL must be a multiple of 50 ms");
+
+// Vcap^2 is kept as the square of the 12-bit voltage >> 8, which fits in
+// 16 bits. That is the same scale as the square of the 10-bit threshold
+// >> 4, so the samples and the threshold compare directly, and the fit
+// keeps the 16-bit values that its overflow bounds assume.
+static inline uint16_t holdup_square_word(uint16_t v_word) {
+  uint16_t v = v_word >> 4;
+  return ((uint32_t)v * v) >> 8;
+}
+
+static inline uint16_t holdup_square_10bit(uint16_t v) {
+  return ((uint32_t)v * v) >> 4;
+}
+
+static_assert(((0xfffUL * 0xfffUL) >> 8) <= 0xffff,
+              "Vcap^2 of a 16-bit word must fit in 16 bits");
+
+static bool holdup_active = false;
+
+// Ring buffer of the fitted points, the newest just before holdup_head
+static uint16_t holdup_points[HOLDUP_FIT_POINTS];
+static uint8_t holdup_head = 0;
+static uint8_t holdup_count = 0;
+
+// The point being collected
+static uint32_t holdup_point_start = 0;
+static uint32_t holdup_point_sum = 0;
+static uint8_t holdup_point_samples = 0;
+// Time of the latest sample
+static uint32_t holdup_now = 0;
+
+// The latest fit. With the points numbered k = 0..n-1 and weights
+// w_k = 2k - (n - 1), slope_num is sum(w_k * y_k) and slope_den is
+// sum(w_k^2); the slope is 2 * slope_num / slope_den per point.
+// y_end is the fitted value at the newest point.
+static int32_t holdup_slope_num = 0;
+static uint16_t holdup_slope_den = 0;
+static int32_t holdup_y_end = 0;
+
+static void holdup_fit() {
+  uint8_t n = holdup_count;
+  int32_t sum = 0;
+  int32_t slope_num = 0;
+  for (uint8_t k = 0; k < n; k++) {
+    uint16_t y = holdup_points[(holdup_head - n + k) & (HOLDUP_FIT_POINTS - 1)];
+    sum += y;
+    slope_num += (int32_t)(2 * k - (n - 1)) * y;
+  }
+  holdup_slope_num = slope_num;
+  holdup_slope_den = (uint16_t)((uint32_t)n * (n * n - 1) / 3);
+  holdup_y_end = sum / n + slope_num * (n - 1) / holdup_slope_den;
+}
+
+void holdup_start() {
+  holdup_active = true;
+  holdup_count = 0;
+  holdup_point_sum = 0;
+  holdup_point_samples = 0;
+}
+
+void holdup_stop() { holdup_active = false; }
+
+void holdup_record(uint16_t v_cap, uint32_t now) {
+  if (!holdup_active) {
+    return;
+  }
+
+  if (holdup_point_samples == 0 && holdup_count == 0) {
+    holdup_point_start = now;
+  } else if (now - holdup_point_start >= HOLDUP_POINT_INTERVAL) {
+    if (holdup_point_samples != 0) {
+      holdup_points[holdup_head] = holdup_point_sum / holdup_point_samples;
+      holdup_head = (holdup_head + 1) & (HOLDUP_FIT_POINTS - 1);
+      if (holdup_count < HOLDUP_FIT_POINTS) {
+        holdup_count++;
+      }
+      if (holdup_count >= HOLDUP_MIN_POINTS) {
+        holdup_fit();
+      }
+    }
+    holdup_point_sum = 0;
+    holdup_point_samples = 0;
+    // points stay evenly spaced unless the samples have stalled
+    holdup_point_start += HOLDUP_POINT_INTERVAL;
+    if (now - holdup_point_start >= HOLDUP_POINT_INTERVAL) {
+      holdup_point_start = now;
+    }
+  }
+
+  holdup_point_sum += holdup_square_word(v_cap);
+  holdup_point_samples++;
+  holdup_now = now;
+}
+
+uint16_t holdup_get_tenths(uint16_t v_off) {
+  if (!holdup_active || holdup_count < HOLDUP_MIN_POINTS ||
+      holdup_slope_num >= 0) {
+    return HOLDUP_UNKNOWN;
+  }
+  int32_t y_off = holdup_square_10bit(v_off);
+  if (holdup_y_end <= y_off) {
+    return 0;
+  }
+  // Remaining points: (y_end - y_off) / -(2 * slope_num / slope_den).
+  // The product fits in 32 bits for up to 32 points of 250 ms.
+  uint32_t tenths = (uint32_t)(holdup_y_end - y_off) * holdup_slope_den *
+                    (HOLDUP_POINT_INTERVAL / 50) /
+                    (4 * (uint32_t)-holdup_slope_num);
+  // the fitted value is for the middle of the newest complete point
+  uint32_t age = holdup_now - holdup_point_start + HOLDUP_POINT_INTERVAL / 2;
+  tenths = tenths > age / 100 ? tenths - age / 100 : 0;
+  return tenths < HOLDUP_UNKNOWN ? tenths : HOLDUP_UNKNOWN - 1;
+}
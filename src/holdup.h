@@ -0,0 +1,55 @@
+#ifndef SH_RPI_FIRMWARE_SRC_HOLDUP_H_
+#define SH_RPI_FIRMWARE_SRC_HOLDUP_H_
+
+#include <stdint.h>
+
+//////
+// Hold-up time prediction
+//
+// While DEPLETING, the host runs on the energy stored in the supercap,
+// 1/2 C Vcap^2. The 5V converter draws a roughly constant power, so Vcap^2
+// falls linearly with time, with a slope of -2 P / C. A least-squares line
+// is fitted to Vcap^2 over the latest HOLDUP_FIT_POINTS points, each the
+// mean of the samples taken in HOLDUP_POINT_INTERVAL ms. The predicted
+// hold-up time is the time until the fitted line reaches the power-off
+// threshold. The window is short enough to follow a change in the load as
+// the host shuts down.
+
+// Spacing of the fitted points in ms
+#define HOLDUP_POINT_INTERVAL 250
+// Number of fitted points (power of two)
+#define HOLDUP_FIT_POINTS 32
+// Minimum number of points for a prediction
+#define HOLDUP_MIN_POINTS 4
+
+// Hold-up time reported when there is no prediction
+#define HOLDUP_UNKNOWN 0xffff
+
+/**
+ * @brief Start a new fit. Called on entering DEPLETING.
+ */
+void holdup_start();
+
+/**
+ * @brief Stop fitting and forget the prediction.
+ */
+void holdup_stop();
+
+/**
+ * @brief Add a supercap voltage sample. Ignored unless started.
+ *
+ * @param v_cap Left-aligned 16-bit (oversampled) supercap voltage
+ * @param now Sample time in ms
+ */
+void holdup_record(uint16_t v_cap, uint32_t now);
+
+/**
+ * @brief Predicted time until Vcap reaches the power-off threshold.
+ *
+ * @param v_off 10-bit power-off threshold voltage
+ * @return Time in 0.1 s units, or HOLDUP_UNKNOWN if not discharging or not
+ * enough points have been collected
+ */
+uint16_t holdup_get_tenths(uint16_t v_off);
+
+#endif  // SH_RPI_FIRMWARE_SRC_HOLDUP_H_
@@ -0,0 +1,29 @@
+#include "idle.h"
+
+#include "hal.h"
+
+static volatile bool idle_wake_pending = false;
+
+void idle_init() {
+  // STANDBY would stop the TCD0 millis timer and the PWM outputs
+  set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+void idle_wake() { idle_wake_pending = true; }
+
+bool idle_sleep() {
+  cli();
+  if (idle_wake_pending) {
+    idle_wake_pending = false;
+    sei();
+    return false;
+  }
+  sleep_enable();
+  // The instruction following SEI is always executed before any pending
+  // interrupt, so an interrupt arriving after the check above still wakes
+  // the CPU from the sleep.
+  sei();
+  sleep_cpu();
+  sleep_disable();
+  return true;
+}
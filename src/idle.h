@@ -0,0 +1,34 @@
+#ifndef SH_RPI_FIRMWARE_SRC_IDLE_H_
+#define SH_RPI_FIRMWARE_SRC_IDLE_H_
+
+//////
+// Idle sleep between main loop passes
+//
+// The CPU sleeps in IDLE mode at the end of every loop pass. All
+// peripherals keep running, so the millis timer tick, TWI, ADC and pin
+// interrupts all wake the CPU and the loop runs another pass. Sleeping
+// thus adds no latency to the interrupt handlers, and at most one timer
+// tick to the work done in the loop.
+
+/**
+ * @brief Select the sleep mode.
+ */
+void idle_init();
+
+/**
+ * @brief Make the next idle_sleep() call return without sleeping.
+ *
+ * Called by interrupt handlers that leave work for the main loop, and by
+ * the loop itself when another pass is needed right away.
+ */
+void idle_wake();
+
+/**
+ * @brief Sleep until the next interrupt unless idle_wake() has been called
+ * since the previous call.
+ *
+ * @return true if the CPU slept
+ */
+bool idle_sleep();
+
+#endif  // SH_RPI_FIRMWARE_SRC_IDLE_H_
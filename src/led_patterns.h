@@ -0,0 +1,63 @@
+#ifndef SH_RPI_FIRMWARE_SRC_LED_PATTERNS_H_
+#define SH_RPI_FIRMWARE_SRC_LED_PATTERNS_H_
+
+#include "blinker.h"
+
+//////
+// LED patterns shown by the state machine
+//
+// The patterns are built and validated at compile time. As constant data,
+// they stay in flash, which the tinyAVR 1-series reads through its memory
+// mapping, and take no SRAM.
+
+// All LEDs are off, used until the state machine sets a pattern
+inline constexpr auto off_pattern =
+    led_pattern(led_segment({0, 0, 0, 0}, 0b1111, 50));
+
+// All LEDs are off
+inline constexpr auto power_off_pattern =
+    led_pattern(led_segment({0, 0, 0, 0}, 0b1111, 3900));
+
+// just show the underlying bar display
+inline constexpr auto no_pattern =
+    led_pattern(led_segment({0, 0, 0, 0}, 0b0000, 100));
+
+// Pattern to set when watchdog is enabled
+inline constexpr auto watchdog_pattern =
+    led_pattern(led_segment({255, 255, 255, 255}, 0b0000, 3950),
+                led_segment({0, 0, 0, 0}, 0b1111, 50));
+
+// Pattern to set when supercap overvoltage is detected
+inline constexpr auto vcap_alarm_pattern =
+    led_pattern(led_segment({255, 255, 255, 255}, 0b1111, 100),
+                led_segment({0, 0, 0, 0}, 0b1111, 100));
+
+// KITT light effect to the left, gliding from LED to LED and back into
+// the bar display
+inline constexpr auto depleting_pattern =
+    led_pattern(led_segment({0, 0, 0, 255}, 0b0011, 80, LED_FADE_LINEAR),
+                led_segment({0, 0, 255, 0}, 0b0111, 80, LED_FADE_LINEAR),
+                led_segment({0, 255, 0, 0}, 0b1110, 80, LED_FADE_LINEAR),
+                led_segment({255, 0, 0, 0}, 0b1100, 80, LED_FADE_LINEAR),
+                led_segment({0, 0, 0, 0}, 0b0000, 680));
+
+// two longish blips, then a long pause
+inline constexpr auto shutdown_pattern =
+    led_pattern(led_segment({0, 0, 0, 0}, 0b1111, 200),
+                led_segment({0, 0, 0, 0}, 0b0000, 100),
+                led_segment({0, 0, 0, 0}, 0b1111, 200),
+                led_segment({0, 0, 0, 0}, 0b0000, 1000));
+
+// alternating blink pattern indicating something is wrong
+inline constexpr auto watchdog_reboot_pattern =
+    led_pattern(led_segment({255, 0, 255, 0}, 0b1111, 200),
+                led_segment({0, 255, 0, 255}, 0b1111, 200));
+
+// two short blinks, then a long pause
+inline constexpr auto sleep_pattern =
+    led_pattern(led_segment({255, 255, 255, 255}, 0b1111, 100),
+                led_segment({0, 0, 0, 0}, 0b1111, 200),
+                led_segment({255, 255, 255, 255}, 0b1111, 100),
+                led_segment({0, 0, 0, 0}, 0b0000, 2000));
+
+#endif  // SH_RPI_FIRMWARE_SRC_LED_PATTERNS_H_
@@ -0,0 +1,126 @@
+#include "led_pwm.h"
+
+#include "digital_io.h"
+#include "gamma.h"
+#include "hal.h"
+
+// The channel assignment below is fixed by the board
+static_assert(LED1_PIN == PIN_PB0 && LED2_PIN == PIN_PB1 &&
+                  LED3_PIN == PIN_PA3 && LED4_PIN == PIN_PA4,
+              "LED pins do not match the PWM channels");
+
+#define NUM_TCA_LEDS 3
+
+#define DUTY_FRACTION_MASK ((1 << GAMMA_DUTY_FRACTION_BITS) - 1)
+
+struct TcaChannel {
+  register8_t* cmp;   //!< Compare register
+  uint8_t enable_bm;  //!< Compare output enable bit in CTRLB
+  PORT_t* port;       //!< Port of the output pin
+  uint8_t pin_bm;     //!< Bit of the output pin
+};
+
+static const TcaChannel tca_channels[NUM_TCA_LEDS] = {
+    {&TCA0.SPLIT.LCMP0, TCA_SPLIT_LCMP0EN_bm, &PORTB, PIN0_bm},
+    {&TCA0.SPLIT.LCMP1, TCA_SPLIT_LCMP1EN_bm, &PORTB, PIN1_bm},
+    {&TCA0.SPLIT.HCMP0, TCA_SPLIT_HCMP0EN_bm, &PORTA, PIN3_bm},
+};
+
+// Duty values of the latest frame
+static uint16_t frame[NUM_LEDS];
+// 8-bit duty values currently output on the TCA channels
+static uint8_t tca_output[NUM_TCA_LEDS];
+// Sigma-delta accumulators of the TCA channels
+static uint8_t tca_dither[NUM_TCA_LEDS];
+// Some TCA channel of the latest frame has a fractional duty
+static bool tca_dithering;
+// 8-bit duty value currently output on the TCD channel
+static uint8_t tcd_output;
+
+static void tca_write(const TcaChannel& ch, uint8_t duty) {
+  if (duty == 0 || duty == 255) {
+    // disconnect the timer; the pin drives a constant level
+    TCA0.SPLIT.CTRLB &= ~ch.enable_bm;
+    update_pin(ch.port, ch.pin_bm, duty);
+  } else {
+    *ch.cmp = duty;
+    TCA0.SPLIT.CTRLB |= ch.enable_bm;
+  }
+}
+
+void led_pwm_init() {
+  for (uint8_t i = 0; i < NUM_TCA_LEDS; i++) {
+    const TcaChannel& ch = tca_channels[i];
+    update_pin(ch.port, ch.pin_bm, false);
+    ch.port->DIRSET = ch.pin_bm;
+    tca_output[i] = 0;
+  }
+  analogWrite(LED4_PIN, 0);
+  tcd_output = 0;
+  for (uint8_t i = 0; i < NUM_LEDS; i++) {
+    frame[i] = 0;
+  }
+}
+
+bool led_pwm_set(const uint16_t duty[NUM_LEDS]) {
+  bool changed = false;
+  for (uint8_t i = 0; i < NUM_TCA_LEDS; i++) {
+    changed |= duty[i] != frame[i];
+  }
+  if (changed) {
+    bool dithering = false;
+    for (uint8_t i = 0; i < NUM_TCA_LEDS; i++) {
+      dithering |= (duty[i] & DUTY_FRACTION_MASK) != 0;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      for (uint8_t i = 0; i < NUM_TCA_LEDS; i++) {
+        frame[i] = duty[i];
+      }
+      tca_dithering = dithering;
+      TCA0.SPLIT.INTFLAGS = TCA_SPLIT_LUNF_bm;
+      TCA0.SPLIT.INTCTRL |= TCA_SPLIT_LUNF_bm;
+    }
+  }
+  if (duty[NUM_TCA_LEDS] != frame[NUM_TCA_LEDS]) {
+    frame[NUM_TCA_LEDS] = duty[NUM_TCA_LEDS];
+    changed = true;
+    uint8_t rounded =
+        (frame[NUM_TCA_LEDS] + (DUTY_FRACTION_MASK + 1) / 2) >>
+        GAMMA_DUTY_FRACTION_BITS;
+    if (rounded != tcd_output) {
+      tcd_output = rounded;
+      analogWrite(LED4_PIN, tcd_output);
+    }
+  }
+  return changed;
+}
+
+bool led_pwm_pending() { return TCA0.SPLIT.INTCTRL & TCA_SPLIT_LUNF_bm; }
+
+// Start of a PWM period: output the next dithered duty values, writing
+// only the channels that change. Without a fractional duty, the frame is
+// committed and the interrupt disabled until the next frame.
+ISR(TCA0_LUNF_vect) {
+  for (uint8_t i = 0; i < NUM_TCA_LEDS; i++) {
+    uint8_t duty = frame[i] >> GAMMA_DUTY_FRACTION_BITS;
+    uint8_t fraction = frame[i] & DUTY_FRACTION_MASK;
+    if (fraction) {
+      tca_dither[i] += fraction;
+      if (tca_dither[i] > DUTY_FRACTION_MASK) {
+        tca_dither[i] -= DUTY_FRACTION_MASK + 1;
+        duty++;
+      }
+    } else {
+      // a whole or off channel starts its next fraction from scratch
+      tca_dither[i] = 0;
+    }
+    if (duty != tca_output[i]) {
+      tca_output[i] = duty;
+      tca_write(tca_channels[i], duty);
+    }
+  }
+  if (!tca_dithering) {
+    TCA0.SPLIT.INTCTRL &= ~TCA_SPLIT_LUNF_bm;
+  }
+  TCA0.SPLIT.INTFLAGS = TCA_SPLIT_LUNF_bm;
+}
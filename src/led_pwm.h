@@ -0,0 +1,49 @@
+#ifndef SH_RPI_FIRMWARE_SRC_LED_PWM_H_
+#define SH_RPI_FIRMWARE_SRC_LED_PWM_H_
+
+#include <stdint.h>
+
+#include "constants.h"
+
+//////
+// LED PWM output
+//
+// LED1..LED3 are driven by TCA0 in the split mode set up by megaTinyCore,
+// LED4 by TCD0. Only the duty values that differ from the previous frame
+// are written. The TCA0 compare registers are not buffered in split mode,
+// so new values are committed by the low counter underflow interrupt at
+// the start of a PWM period instead of in the middle of one. TCD0 compare
+// updates have to be synchronized with the timer and go through
+// analogWrite().
+//
+// Duty values are 8.4 fixed point (see gamma.h). On the TCA0 channels,
+// the underflow interrupt dithers the fraction across PWM periods with a
+// first-order sigma-delta modulator. The TCD0 channel is rounded to 8 bits.
+// An 8-bit duty of 0 is constantly off and 255 constantly on.
+//
+// The underflow interrupt wakes the CPU from idle sleep once per PWM
+// period, about 1.2 kHz with megaTinyCore's TCA0 setup at 20 MHz (DIV64,
+// PER 254). It stays enabled only while a TCA0 channel has a fractional
+// duty. A frame whose TCA0 duties are all whole, including an all-off
+// frame, costs a single wakeup to commit it.
+
+/**
+ * @brief Configure the LED pins as PWM outputs, all off.
+ */
+void led_pwm_init();
+
+/**
+ * @brief Set the duty values of all LEDs.
+ *
+ * @param duty 0..GAMMA_DUTY_MAX for each LED
+ * @return true if any value changed
+ */
+bool led_pwm_set(const uint16_t duty[NUM_LEDS]);
+
+/**
+ * @brief Check whether the TCA0 underflow interrupt is enabled, i.e. a
+ * frame is waiting for the start of a PWM period or is being dithered.
+ */
+bool led_pwm_pending();
+
+#endif  // SH_RPI_FIRMWARE_SRC_LED_PWM_H_
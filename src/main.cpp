@@ -1,14 +1,24 @@
-#include <Arduino.h>
-#include <EEPROM.h>
-#include <Wire.h>
-#include <avr/io.h>
-
 #include "analog_io.h"
 #include "blinker.h"
+#include "commands.h"
+#include "config.h"
 #include "digital_io.h"
+#include "energy.h"
 #include "globals.h"
+#include "hal.h"
+#include "history.h"
+#include "holdup.h"
+#include "idle.h"
+#include "led_patterns.h"
+#include "nvm.h"
+#include "scheduler.h"
 #include "shrpi_i2c.h"
+#include "shutdown_stats.h"
+#include "stack_monitor.h"
 #include "state_machine.h"
+#include "supercap_health.h"
+#include "telemetry.h"
+#include "timing.h"
 
 // ATTiny software for monitoring and controlling the Sailor Hat board.
 
@@ -20,29 +30,18 @@
 
 // VCAP led: indicate supercap charge level
 
-LedPatternSegment off_pattern[] = {
-    {{0, 0, 0, 0}, 0b1111, 50},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
-
 // define external variables declared in globals.h
 volatile bool watchdog_reset = false;
 elapsedMillis watchdog_elapsed;
-volatile int new_watchdog_limit = -1;
 int watchdog_limit = 0;
-bool watchdog_value_changed = false;
 
 elapsedMillis gpio_poweroff_elapsed;
 
-int led_pins[] = {LED1_PIN, LED2_PIN, LED3_PIN, LED4_PIN};
+const int led_pins[] = {LED1_PIN, LED2_PIN, LED3_PIN, LED4_PIN};
 constexpr uint16_t led_bar_knee_value =
     uint16_t(((uint16_t)-1) * (LED_BAR_KNEE / VCAP_MAX));
 LedBlinker led_blinker(led_pins, off_pattern, led_bar_knee_value);
 
-volatile bool shutdown_requested = false;
-volatile bool sleep_requested = false;
-volatile bool reset_requested = false;
-
 bool rtc_wakeup_triggered = false;
 bool ext_wakeup_triggered = false;
 
@@ -51,12 +50,11 @@ volatile uint8_t i2c_register = 0;
 int16_t power_on_vcap_voltage = int(VCAP_POWER_ON / VCAP_MAX * VCAP_SCALE);
 int16_t power_off_vcap_voltage = int(VCAP_POWER_OFF / VCAP_MAX * VCAP_SCALE);
 int16_t vcap_alarm_voltage = int(VCAP_ALARM / VCAP_MAX * VCAP_SCALE);
+constexpr int16_t vcap_nvm_min_voltage =
+    int(VCAP_NVM_MIN / VCAP_MAX * VCAP_SCALE);
+constexpr int16_t vin_present_voltage = int(VIN_OFF / VIN_MAX * VIN_SCALE);
 
 bool vcap_alarm_triggered = false;
-bool vcap_alarm_changed = false;
-
-int16_t new_power_on_vcap_voltage = -1;
-int16_t new_power_off_vcap_voltage = -1;
 
 uint16_t v_supercap = 0;
 uint16_t v_in = 0;
@@ -64,24 +62,75 @@ uint16_t i_in = 0;
 uint16_t temperature_K = 0;
 
 uint8_t led_global_brightness = 0;
-uint8_t new_led_global_brightness = 255;
 
-char v_supercap_buf[2];
-char v_in_buf[2];
-char i_in_buf[2];
-char temperature_K_buf[2];
+uint8_t shutdown_wait_limit = SHUTDOWN_WAIT_DURATION / 1000;
+
+uint16_t v_supercap_word = 0;
+uint16_t v_in_word = 0;
+uint16_t i_in_word = 0;
 
 // factory calibration of the internal temperature sensor
 int8_t sigrow_offset = SIGROW.TEMPSENSE1;
 uint8_t sigrow_gain = SIGROW.TEMPSENSE0;
 
+//////
+// Periodic tasks
+
+static uint16_t acquisition_task() {
+  // the conversions are carried out by the ADC interrupt handlers
+  adc_sampler_start();
+  return SAMPLE_INTERVAL;
+}
+
+static uint16_t blinker_task() {
+  led_blinker.tick();
+  return BLINKER_INTERVAL;
+}
+
+static uint16_t telemetry_task() {
+#ifdef SERIAL_TEXT_OUTPUT
+  Serial.print("State: ");
+  Serial.print(get_sm_state_name());
+  Serial.print(", V_sup: ");
+  Serial.print(v_supercap);
+  Serial.print(", V_in: ");
+  Serial.print(v_in);
+  Serial.print(", I_in: ");
+  Serial.print(i_in);
+  Serial.print(", temp: ");
+  Serial.print(temperature_K);
+  Serial.print(", i2c: ");
+  Serial.print(i2c_register);
+  Serial.print(", RTC: ");
+  Serial.print(read_pin(RTC_INT_PIN));
+  Serial.print(", EXT: ");
+  Serial.print(read_pin(EXT_INT_PIN));
+  Serial.print(", PWR: ");
+  Serial.print(read_pin(POWER_TOGGLE_PIN));
+  Serial.println("");
+#else
+  telemetry_send_status();
+#endif
+  return TELEMETRY_INTERVAL;
+}
+
+static uint16_t stack_check_task() {
+  stack_check();
+  return STACK_CHECK_INTERVAL;
+}
+
 void setup() {
   init_ADC1();
   att1s_analog_reference_adc0(INTERNAL1V1);  // set ADC0 reference to 1.1V
   att1s_analog_reference_adc1(INTERNAL2V5);  // set ADC1 reference to 2.5V
+  adc_sampler_init();
+  timing_init();
+  idle_init();
 
   pinMode(EN5V_PIN, OUTPUT);
 
+  led_blinker.init();
+
   // set up I2C
 
   // Use alternate pins for I2C
@@ -89,6 +138,7 @@ void setup() {
 
   // defer the actual BEGIN call until the first step of the state machine
   Wire.onReceive(receive_I2C_event);
+  Wire.onRequest(request_I2C_event);
 
   // set the analog input pins to input
   pinMode(V_CAP_ADC_PIN, INPUT);
@@ -100,70 +150,67 @@ void setup() {
   pinMode(EXT_INT_PIN, INPUT_PULLUP);
   pinMode(RTC_INT_PIN, INPUT_PULLUP);
 
-  // read the power on voltage from EEPROM
-  EEPROM.get(EEPROM_POWER_ON_VCAP_ADDR, power_on_vcap_voltage);
-  if (power_on_vcap_voltage < 0 || power_on_vcap_voltage > VCAP_SCALE) {
-    power_on_vcap_voltage = int(VCAP_POWER_ON / VCAP_MAX * VCAP_SCALE);
-  }
-
-  // read the power off voltage from EEPROM
-  EEPROM.get(EEPROM_POWER_OFF_VCAP_ADDR, power_off_vcap_voltage);
-  if (power_off_vcap_voltage < 0 || power_off_vcap_voltage > VCAP_SCALE) {
-    power_off_vcap_voltage = int(VCAP_POWER_OFF / VCAP_MAX * VCAP_SCALE);
-  }
-
-  // Read the LED brightness from EEPROM. The default unset value is 0xFF which
-  // just coincides with the default full brightness value.
-  EEPROM.get(EEPROM_LED_BRIGHTNESS_ADDR, led_global_brightness);
-  new_led_global_brightness = led_global_brightness;
+  // read the settings, the shutdown durations and the supercap health
+  // from EEPROM
+  config_load();
+  shutdown_stats_load();
+  supercap_health_load();
 
   // setup serial port
-  Serial.begin(38400);
+  Serial.begin(SERIAL_BAUD_RATE);
+#ifdef SERIAL_TEXT_OUTPUT
   delay(100);
   Serial.println("Starting up...");
+#endif
+
+  scheduler_add(TASK_ACQUISITION, acquisition_task);
+  scheduler_add(TASK_BLINKER, blinker_task);
+  scheduler_add(TASK_TELEMETRY, telemetry_task);
+  scheduler_add(TASK_STACK_CHECK, stack_check_task);
+  scheduler_run(millis());
+  scheduler_schedule(TASK_ACQUISITION, 0);
+  scheduler_schedule(TASK_BLINKER, BLINKER_INTERVAL);
+  scheduler_schedule(TASK_TELEMETRY, TELEMETRY_INTERVAL);
+  scheduler_schedule(TASK_STACK_CHECK, STACK_CHECK_INTERVAL);
+
+  sm_init();
 }
 
 void loop() {
-  static elapsedMillis v_reading_elapsed = 0;
-
-  // no need to read the values at every iteration;
-  // 23 ms selected to descynchronize the reading from
-  // other loops
-  if (v_reading_elapsed > 23) {
-    v_reading_elapsed = 0;
-
-    // read the analog inputs twice to let the ADC stabilize
-
-    att1s_analog_read(V_CAP_ADC_AIN, V_CAP_ADC_NUM);
-    v_supercap = att1s_analog_read(V_CAP_ADC_AIN, V_CAP_ADC_NUM);
-    att1s_analog_read(V_CAP_ADC_AIN, V_CAP_ADC_NUM);
-    v_in = att1s_analog_read(V_IN_ADC_AIN, V_IN_ADC_NUM);
-    att1s_analog_read(V_CAP_ADC_AIN, V_CAP_ADC_NUM);
-    i_in = att1s_analog_read(I_IN_ADC_AIN, I_IN_ADC_NUM);
+  uint32_t loop_start = timing_now();
+  // start the tasks that are due
+  scheduler_run(millis());
+
+  uint16_t adc_values[NUM_ADC_CHANNELS];
+  bool new_sample = adc_sampler_read(adc_values);
+  // set whenever a value visible in the I2C registers may have changed
+  bool registers_changed = new_sample;
+  if (new_sample) {
+    uint32_t adc_start = timing_now();
+
+    // the oversampled channels are left-aligned 16-bit values; the
+    // thresholds used by the state machine are 10-bit
+    v_supercap = adc_values[ADC_CH_V_CAP] >> 6;
+    v_in = adc_values[ADC_CH_V_IN] >> 6;
+    i_in = adc_values[ADC_CH_I_IN] >> 6;
 
     if (v_supercap > vcap_alarm_voltage) {
       if (!vcap_alarm_triggered) {
         vcap_alarm_triggered = true;
-        vcap_alarm_changed = true;
+        sm_post_event(EV_VCAP_ALARM_CHANGED);
       }
     } else {
       if (vcap_alarm_triggered) {
         vcap_alarm_triggered = false;
-        vcap_alarm_changed = true;
+        sm_post_event(EV_VCAP_ALARM_CHANGED);
       }
     }
 
-    v_supercap_buf[0] = v_supercap >> 2;
-    v_supercap_buf[1] = (v_supercap << 6) & 0xff;
-
-    v_in_buf[0] = v_in >> 2;
-    v_in_buf[1] = (v_in << 6) & 0xff;
+    v_supercap_word = adc_values[ADC_CH_V_CAP];
+    v_in_word = adc_values[ADC_CH_V_IN];
+    i_in_word = adc_values[ADC_CH_I_IN];
 
-    i_in_buf[0] = i_in >> 2;
-    i_in_buf[1] = (i_in << 6) & 0xff;
-
-    att1s_analog_read(ADC_TEMPSENSE, 0);
-    unsigned int adc_reading = att1s_analog_read(ADC_TEMPSENSE, 0);
+    unsigned int adc_reading = adc_values[ADC_CH_TEMP];
     // temperature compensation code from the datasheet page 435
     uint32_t temp_temp = adc_reading - sigrow_offset;
     temp_temp *= sigrow_gain;
@@ -171,9 +218,6 @@ void loop() {
     temp_temp >>= 1;  // make temperature fit in uint16_t
     temperature_K = temp_temp;
 
-    temperature_K_buf[0] = temperature_K >> 8;
-    temperature_K_buf[1] = temperature_K & 0xff;
-
     // A low value of GPIO_POWEROFF_PIN indicates that the host has shut down
     if (read_pin(GPIO_POWEROFF_PIN) == true) {
       gpio_poweroff_elapsed = 0;
@@ -186,76 +230,58 @@ void loop() {
 
     // if POWER_TOGGLE_PIN is pulled low, initiate shutdown
     if (read_pin(POWER_TOGGLE_PIN) == false) {
-      shutdown_requested = true;
-    }
-
-    // Pulling both EXT_INT_PIN and RTC_INT_PIN low will trigger a reset
-    if (ext_wakeup_triggered && shutdown_requested) {
-      reset_requested = true;
+      sm_post_event(EV_SHUTDOWN_REQ);
     }
 #endif
-    // v_supercap is 10-bit while set_bar input is 16-bit - shift up by 6 bits
-    led_blinker.set_bar(v_supercap << 6);
-  }
+    led_blinker.set_bar(v_supercap_word);
+
+    history_record(v_in_word, v_supercap_word, i_in_word, get_sm_state());
 
-  static elapsedMillis serial_output_elapsed = 0;
-  if (serial_output_elapsed > 500) {
-    serial_output_elapsed = 0;
-
-    // Serial.print("0123456789");
-    Serial.print("State: ");
-    Serial.print(get_sm_state_name());
-    Serial.print(", V_sup: ");
-    Serial.print(v_supercap);
-    Serial.print(", V_in: ");
-    Serial.print(v_in);
-    Serial.print(", I_in: ");
-    Serial.print(i_in);
-    Serial.print(", temp: ");
-    Serial.print(temperature_K);
-    Serial.print(", i2c: ");
-    Serial.print(i2c_register);
-    Serial.print(", RTC: ");
-    Serial.print(read_pin(RTC_INT_PIN));
-    Serial.print(", EXT: ");
-    Serial.print(read_pin(EXT_INT_PIN));
-    Serial.print(", PWR: ");
-    Serial.print(read_pin(POWER_TOGGLE_PIN));
-    Serial.println("");
+    energy_record(v_in_word, i_in_word, millis());
+    holdup_record(v_supercap_word, millis());
+    supercap_health_record(v_supercap_word, i_in_word, millis());
+
+    sm_post_event(EV_SAMPLE);
+
+    timing_record(TIMING_ADC, adc_start);
   }
 
-  if (watchdog_reset) {
-    if (new_watchdog_limit != -1) {
-      watchdog_value_changed = true;
-      watchdog_limit = new_watchdog_limit;
-      new_watchdog_limit = -1;
-    }
+  registers_changed |= commands_process();
 
-    watchdog_elapsed = 0;
-    watchdog_reset = false;
+#ifndef HW_VERSION_2_0_0
+  // Pulling EXT_INT_PIN low while a shutdown is requested, with the button
+  // or over I2C, will trigger a reset
+  if (ext_wakeup_triggered && sm_shutdown_requested()) {
+    sm_post_event(EV_RESET_REQ);
   }
+#endif
 
-  if (new_power_on_vcap_voltage != -1) {
-    power_on_vcap_voltage = new_power_on_vcap_voltage;
-    new_power_on_vcap_voltage = -1;
-    // write the set value to EEPROM
-    EEPROM.put(EEPROM_POWER_ON_VCAP_ADDR, power_on_vcap_voltage);
+  if (watchdog_reset) {
+    // clear the flag first so that a reset arriving meanwhile is not lost
+    watchdog_reset = false;
+    watchdog_elapsed = 0;
+    sm_restart_watchdog();
   }
 
-  if (new_power_off_vcap_voltage != -1) {
-    power_off_vcap_voltage = new_power_off_vcap_voltage;
-    new_power_off_vcap_voltage = -1;
-    // write the set value to EEPROM
-    EEPROM.put(EEPROM_POWER_OFF_VCAP_ADDR, power_off_vcap_voltage);
+  static StateType published_state = NUM_STATES;
+  uint32_t sm_start = timing_now();
+  sm_run();
+  timing_record(TIMING_SM, sm_start);
+
+  // A write interrupted by a brownout could corrupt the EEPROM. Without
+  // DC IN, the supercap must hold enough for the write in any state.
+  nvm_set_writes_allowed(v_in >= vin_present_voltage ||
+                         v_supercap >= vcap_nvm_min_voltage);
+  if (get_sm_state() != published_state) {
+    published_state = get_sm_state();
+    registers_changed = true;
   }
 
-  if (new_led_global_brightness != led_global_brightness) {
-    led_global_brightness = new_led_global_brightness;
-    // write the set value to EEPROM
-    EEPROM.put(EEPROM_LED_BRIGHTNESS_ADDR, led_global_brightness);
+  if (registers_changed) {
+    update_I2C_register_file(new_sample);
   }
 
-  led_blinker.tick();
+  timing_record(TIMING_LOOP, loop_start);
 
-  sm_run();
+  idle_sleep();
 }
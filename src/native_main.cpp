@@ -0,0 +1,165 @@
+// Host entry point for the native environment.
+//
+// Without arguments, runs the firmware against a simulated power cycle and
+// prints the state transitions. With --bench, measures the time taken by
+// the hot paths of the LED blinker and the I2C protocol. With --awake,
+// models how long the CPU is awake in each state of the power cycle.
+//
+// The checks of the firmware modules are PIO test suites under test/, run
+// with `pio test -e native`.
+
+#if !defined(ARDUINO) && !defined(PIO_UNIT_TESTING)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "globals.h"
+#include "hal.h"
+#include "native_sim.h"
+#include "shrpi_i2c.h"
+#include "state_machine.h"
+
+static void run_power_cycle(bool print_states) {
+  float v_cap = 0;
+  float v_in = 12.0;
+  StateType last_state = NUM_STATES;
+
+  sim_idle_pins();
+  setup();
+
+  for (unsigned long t = 0; t < 60000; t += 10) {
+    if (t == 20000) {
+      // input power cut
+      v_in = 0;
+    }
+    if (v_in > 0) {
+      v_cap = v_cap < 9.0 ? v_cap + 0.005 : v_cap;
+    } else {
+      v_cap = v_cap > 0.002 ? v_cap - 0.002 : 0;
+    }
+    if (t == 30000) {
+      // host has shut down
+      native_set_pin(GPIO_POWEROFF_PIN, false);
+    }
+
+    native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN,
+                            sim_vcap_counts(v_cap));
+    native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(v_in));
+    native_set_analog_input(I_IN_ADC_NUM, I_IN_ADC_AIN, v_in > 0 ? 200 : 0);
+    native_set_analog_input(0, ADC_TEMPSENSE, 300);
+    sim_step(10);
+
+    if (print_states && get_sm_state() != last_state) {
+      last_state = get_sm_state();
+      printf("%6lu ms: %-20s Vin %5.2f V, Vcap %4.2f V\n", t,
+             get_sm_state_name(), v_in, v_cap);
+    }
+  }
+}
+
+static int simulate() {
+  run_power_cycle(true);
+  return 0;
+}
+
+// Estimate the CPU awake time from the loop passes of a power cycle. The
+// costs of a loop pass and of a timer tick are inputs to the model;
+// I2C register 0x40 gives the loop pass time measured on the MCU.
+static int awake(unsigned long pass_us, unsigned long tick_us) {
+  run_power_cycle(false);
+
+  printf("%-20s %8s %8s %8s %8s\n", "state", "time ms", "passes", "sleeps",
+         "awake %");
+  for (int i = 0; i < NUM_STATES; i++) {
+    if (sim_state_ms[i] == 0) {
+      continue;
+    }
+    double awake_us = (double)sim_state_passes[i] * pass_us +
+                      (double)sim_state_sleeps[i] * tick_us;
+    printf("%-20s %8u %8u %8u %8.2f\n", state_names[i], sim_state_ms[i],
+           sim_state_passes[i], sim_state_sleeps[i],
+           100 * awake_us / (sim_state_ms[i] * 1000.0));
+  }
+  return 0;
+}
+
+static double elapsed_ns(const struct timespec& start, long iterations) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  return ns / iterations;
+}
+
+static int bench() {
+  const long iterations = 1000000;
+  struct timespec start;
+  uint8_t buf[16];
+
+  setup();
+  sim_step(100);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long i = 0; i < iterations; i++) {
+    led_blinker.set_bar(i * 7);
+  }
+  printf("set_bar:           %8.1f ns\n", elapsed_ns(start, iterations));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long i = 0; i < iterations; i++) {
+    led_blinker.tick();
+  }
+  printf("blinker tick:      %8.1f ns\n", elapsed_ns(start, iterations));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long i = 0; i < iterations; i++) {
+    native_i2c_read(0x20 + (i & 3), buf, 2);
+  }
+  printf("I2C register read: %8.1f ns\n", elapsed_ns(start, iterations));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long i = 0; i < iterations; i++) {
+    update_I2C_register_file(true);
+  }
+  printf("register render:   %8.1f ns\n", elapsed_ns(start, iterations));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long i = 0; i < iterations; i++) {
+    loop();
+  }
+  printf("loop():            %8.1f ns\n", elapsed_ns(start, iterations));
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  bool run_bench = false;
+  bool run_awake = false;
+  unsigned long pass_us = 50;
+  unsigned long tick_us = 5;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bench") == 0) {
+      run_bench = true;
+    } else if (strcmp(argv[i], "--awake") == 0) {
+      run_awake = true;
+    } else if (strcmp(argv[i], "--pass-us") == 0 && i + 1 < argc) {
+      pass_us = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--tick-us") == 0 && i + 1 < argc) {
+      tick_us = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      native_serial_echo = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--bench] [--awake [--pass-us N] [--tick-us N]] "
+              "[-v]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (run_bench) {
+    return bench();
+  }
+  return run_awake ? awake(pass_us, tick_us) : simulate();
+}
+
+#endif  // !ARDUINO && !PIO_UNIT_TESTING
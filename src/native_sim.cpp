@@ -0,0 +1,71 @@
+// Firmware simulation helpers. Only built for the native environment.
+
+#ifndef ARDUINO
+
+#include "native_sim.h"
+
+#include "hal.h"
+#include "nvm.h"
+
+uint32_t sim_state_ms[NUM_STATES];
+uint32_t sim_state_passes[NUM_STATES];
+uint32_t sim_state_sleeps[NUM_STATES];
+
+void sim_step(unsigned long ms) {
+  for (unsigned long i = 0; i < ms; i++) {
+    StateType state = get_sm_state();
+    sim_state_ms[state]++;
+    // bound the passes in case the loop never sleeps
+    for (int pass = 0; pass < 16; pass++) {
+      uint32_t sleeps = native_sleep_count;
+      sim_state_passes[state]++;
+      loop();
+      if (native_sleep_count != sleeps) {
+        sim_state_sleeps[state]++;
+        break;
+      }
+    }
+    native_advance(1);
+  }
+}
+
+void sim_idle_pins() {
+  native_set_pin(GPIO_POWEROFF_PIN, true);
+  native_set_pin(POWER_TOGGLE_PIN, true);
+  native_set_pin(EXT_INT_PIN, true);
+  native_set_pin(RTC_INT_PIN, true);
+}
+
+bool sim_power_up() {
+  sim_idle_pins();
+  native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN, sim_vcap_counts(8.5));
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(12.0));
+
+  setup();
+  for (int i = 0; i < 1000 && get_sm_state() != ON; i++) {
+    sim_step(10);
+  }
+  return get_sm_state() == ON;
+}
+
+bool sim_power_restart() {
+  native_set_pin(GPIO_POWEROFF_PIN, true);
+  for (int i = 0; i < 2000 && get_sm_state() != ON; i++) {
+    sim_step(10);
+  }
+  return get_sm_state() == ON;
+}
+
+void sim_wait_nvm() {
+  while (nvm_pending()) {
+    native_advance(1);
+  }
+}
+
+uint16_t sim_read_word(uint8_t address, uint8_t offset) {
+  uint8_t reg[4];
+  native_i2c_read(address, reg, offset + 2);
+  return reg[offset] << 8 | reg[offset + 1];
+}
+
+#endif  // ARDUINO
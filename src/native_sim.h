@@ -0,0 +1,75 @@
+#ifndef SH_RPI_FIRMWARE_SRC_NATIVE_SIM_H_
+#define SH_RPI_FIRMWARE_SRC_NATIVE_SIM_H_
+
+// Firmware simulation helpers for the native environment.
+//
+// Runs the firmware's setup() and loop() against the simulated hardware of
+// hal_native.h. Used by the simulator in native_main.cpp and by the test
+// suites under test/.
+
+#ifndef ARDUINO
+
+#include <stdint.h>
+
+#include "analog_io.h"
+#include "constants.h"
+#include "hal.h"
+#include "state_machine.h"
+
+void setup();
+void loop();
+
+// Convert voltages to simulated 10-bit ADC readings
+inline uint16_t sim_vcap_counts(float v) { return v / VCAP_MAX * VCAP_SCALE; }
+inline uint16_t sim_vin_counts(float v) { return v / VIN_MAX * VIN_SCALE; }
+
+// Simulated time, loop passes and sleeps per state since boot
+extern uint32_t sim_state_ms[NUM_STATES];
+extern uint32_t sim_state_passes[NUM_STATES];
+extern uint32_t sim_state_sleeps[NUM_STATES];
+
+/**
+ * @brief Run the loop for the given time.
+ *
+ * Every simulated millisecond, the loop runs until it puts the CPU to
+ * sleep, as it would on the MCU where the millis timer interrupt is the
+ * next wakeup.
+ */
+void sim_step(unsigned long ms);
+
+/**
+ * @brief Set the input pins to their idle levels.
+ */
+void sim_idle_pins();
+
+/**
+ * @brief Boot with a full supercap and wait until the state machine is ON.
+ *
+ * @return true if ON was reached
+ */
+bool sim_power_up();
+
+/**
+ * @brief Wait for the power to come back on after OFF.
+ *
+ * @return true if ON was reached
+ */
+bool sim_power_restart();
+
+/**
+ * @brief Let the simulated time pass until the queued EEPROM writes are
+ * done.
+ */
+void sim_wait_nvm();
+
+/**
+ * @brief Read a big-endian 16-bit word from an I2C register.
+ *
+ * @param address Register address
+ * @param offset Byte offset of the word in the register, at most 2
+ */
+uint16_t sim_read_word(uint8_t address, uint8_t offset = 0);
+
+#endif  // ARDUINO
+
+#endif  // SH_RPI_FIRMWARE_SRC_NATIVE_SIM_H_
@@ -0,0 +1,59 @@
+#include "nvm.h"
+
+#include "hal.h"
+#include "spsc_queue.h"
+
+#ifdef ARDUINO
+// Writes to the memory-mapped EEPROM load the NVM page buffer
+#define NVM_PAGE_BUFFER ((volatile uint8_t*)MAPPED_EEPROM_START)
+#else
+#define NVM_PAGE_BUFFER native_eeprom_page_buffer
+#endif
+
+struct NvmWrite {
+  uint8_t address;
+  uint8_t value;
+};
+
+// Filled by the main loop, drained by the EEREADY interrupt
+static SpscQueue<NvmWrite, NVM_QUEUE_LENGTH> nvm_queue;
+static volatile bool nvm_writes_allowed = true;
+
+bool nvm_write(uint8_t address, const void* data, uint8_t length) {
+  if (!nvm_writes_allowed || NVM_QUEUE_LENGTH - nvm_queue.size() < length) {
+    return false;
+  }
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (uint8_t i = 0; i < length; i++) {
+    nvm_queue.push(NvmWrite{uint8_t(address + i), bytes[i]});
+  }
+  NVMCTRL.INTCTRL = NVMCTRL_EEREADY_bm;
+  return true;
+}
+
+bool nvm_pending() {
+  return nvm_queue.size() != 0 || (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm);
+}
+
+void nvm_set_writes_allowed(bool allowed) {
+  nvm_writes_allowed = allowed;
+  if (allowed && nvm_queue.size() != 0) {
+    NVMCTRL.INTCTRL = NVMCTRL_EEREADY_bm;
+  }
+}
+
+// The EEREADY flag stays set for as long as the EEPROM is idle, so the
+// interrupt is disabled whenever there is nothing to start.
+ISR(NVMCTRL_EE_vect) {
+  NvmWrite write;
+  if (!nvm_writes_allowed || !nvm_queue.peek(write)) {
+    NVMCTRL.INTCTRL = 0;
+    return;
+  }
+  uint8_t page = write.address / EEPROM_PAGE_SIZE;
+  do {
+    NVM_PAGE_BUFFER[write.address] = write.value;
+    nvm_queue.pop(write);
+  } while (nvm_queue.peek(write) && write.address / EEPROM_PAGE_SIZE == page);
+  _PROTECTED_WRITE_SPM(NVMCTRL.CTRLA, NVMCTRL_CMD_PAGEERASEWRITE_gc);
+}
@@ -0,0 +1,46 @@
+#ifndef SH_RPI_FIRMWARE_SRC_NVM_H_
+#define SH_RPI_FIRMWARE_SRC_NVM_H_
+
+#include <stdint.h>
+
+//////
+// Background EEPROM writer
+//
+// An EEPROM erase/write operation takes about 4 ms, during which the
+// megaTinyCore EEPROM library busy-waits. Here, writes are queued instead
+// and carried out by the NVMCTRL EEREADY interrupt whenever the EEPROM is
+// idle. The interrupt loads all queued bytes that fall on the same EEPROM
+// page into the page buffer and writes them with a single page
+// erase/write operation, which only touches the loaded bytes.
+//
+// Writes can be inhibited while the supply is unsafe. Queued writes are
+// then held back, and an operation already in progress completes.
+
+// Number of queued bytes (power of two)
+#define NVM_QUEUE_LENGTH 64
+
+/**
+ * @brief Queue bytes to be written to the EEPROM.
+ *
+ * Either all bytes are queued or none.
+ *
+ * @param address EEPROM address
+ * @param data Bytes to write
+ * @param length Number of bytes, at most NVM_QUEUE_LENGTH
+ * @return false if writes are inhibited or the queue is too full
+ */
+bool nvm_write(uint8_t address, const void* data, uint8_t length);
+
+/**
+ * @brief Check whether queued bytes have not yet been written.
+ *
+ * @return true until the last queued byte has been programmed
+ */
+bool nvm_pending();
+
+/**
+ * @brief Allow or inhibit starting EEPROM write operations.
+ */
+void nvm_set_writes_allowed(bool allowed);
+
+#endif  // SH_RPI_FIRMWARE_SRC_NVM_H_
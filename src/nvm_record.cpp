@@ -0,0 +1,63 @@
+#include "nvm_record.h"
+
+#include <string.h>
+
+#include "crc16.h"
+#include "hal.h"
+#include "nvm.h"
+
+static_assert(NVM_RECORD_MAX_SIZE <= EEPROM_PAGE_SIZE,
+              "a record copy must fit in an EEPROM page");
+
+static uint16_t nvm_record_crc(const uint8_t* bytes, uint8_t size) {
+  return crc16(bytes, size - NVM_RECORD_CRC_SIZE);
+}
+
+static bool nvm_record_read(uint8_t address, uint8_t* bytes, uint8_t size,
+                            uint8_t version) {
+  for (uint8_t i = 0; i < size; i++) {
+    bytes[i] = EEPROM.read(address + i);
+  }
+  uint16_t crc;
+  memcpy(&crc, bytes + size - NVM_RECORD_CRC_SIZE, sizeof(crc));
+  return bytes[NVM_RECORD_VERSION] == version &&
+         crc == nvm_record_crc(bytes, size);
+}
+
+bool nvm_record_load(uint8_t address, void* record, uint8_t size,
+                     uint8_t version, uint8_t& copy) {
+  uint8_t* first = (uint8_t*)record;
+  uint8_t second[NVM_RECORD_MAX_SIZE];
+  bool valid[2];
+  valid[0] = nvm_record_read(address, first, size, version);
+  valid[1] = nvm_record_read(address + size, second, size, version);
+  if (valid[0] && valid[1]) {
+    // sequence numbers are compared with wrap-around arithmetic
+    copy = (int8_t)(second[NVM_RECORD_SEQUENCE] -
+                    first[NVM_RECORD_SEQUENCE]) > 0;
+  } else if (valid[0] || valid[1]) {
+    copy = valid[1];
+  } else {
+    copy = 1;
+    return false;
+  }
+  if (copy == 1) {
+    memcpy(first, second, size);
+  }
+  return true;
+}
+
+bool nvm_record_save(uint8_t address, void* record, uint8_t size,
+                     uint8_t& copy) {
+  uint8_t* bytes = (uint8_t*)record;
+  bytes[NVM_RECORD_SEQUENCE]++;
+  uint16_t crc = nvm_record_crc(bytes, size);
+  memcpy(bytes + size - NVM_RECORD_CRC_SIZE, &crc, sizeof(crc));
+  uint8_t next = copy ^ 1;
+  if (!nvm_write(address + next * size, bytes, size)) {
+    bytes[NVM_RECORD_SEQUENCE]--;
+    return false;
+  }
+  copy = next;
+  return true;
+}
@@ -0,0 +1,52 @@
+#ifndef SH_RPI_FIRMWARE_SRC_NVM_RECORD_H_
+#define SH_RPI_FIRMWARE_SRC_NVM_RECORD_H_
+
+#include <stdint.h>
+
+//////
+// Records kept in two EEPROM copies
+//
+// A record is saved to the copy not holding the last save, so that a write
+// cut short by a power loss leaves the other copy intact. A record starts
+// with a version byte and a sequence byte and ends with the CRC-16 of the
+// bytes before it. At boot the valid copy with the newer sequence number
+// is used.
+
+// Offsets of the common fields
+#define NVM_RECORD_VERSION 0
+#define NVM_RECORD_SEQUENCE 1
+// Size of the trailing CRC
+#define NVM_RECORD_CRC_SIZE 2
+// Largest record, so that a copy fits in an EEPROM page
+#define NVM_RECORD_MAX_SIZE 32
+
+/**
+ * @brief Read the newest valid copy of a record.
+ *
+ * @param address EEPROM address of the first copy
+ * @param record Filled with the newest valid copy
+ * @param size Size of a copy, at most NVM_RECORD_MAX_SIZE
+ * @param version Expected format version
+ * @param copy Set to the copy read, or to 1 if there is none so that the
+ * first save goes to copy 0
+ * @return false if neither copy is valid; record is then undefined
+ */
+bool nvm_record_load(uint8_t address, void* record, uint8_t size,
+                     uint8_t version, uint8_t& copy);
+
+/**
+ * @brief Save a record to the copy not holding the last save.
+ *
+ * The sequence number is advanced and the CRC updated in place.
+ *
+ * @param address EEPROM address of the first copy
+ * @param record Record to save
+ * @param size Size of a copy
+ * @param copy Copy holding the last save, updated once the write is queued
+ * @return false if the EEPROM writer refused the write; the sequence
+ * number and copy are then unchanged
+ */
+bool nvm_record_save(uint8_t address, void* record, uint8_t size,
+                     uint8_t& copy);
+
+#endif  // SH_RPI_FIRMWARE_SRC_NVM_RECORD_H_
@@ -0,0 +1,99 @@
+#include "scheduler.h"
+
+struct ScheduledTask {
+  TaskFunction function;
+  uint32_t deadline;
+};
+
+static ScheduledTask tasks[NUM_TASKS];
+
+// Ids of the scheduled tasks, sorted by deadline
+static uint8_t schedule[NUM_TASKS];
+static uint8_t schedule_length = 0;
+
+// Time of the latest scheduler_run() call
+static uint32_t scheduler_now = 0;
+
+// true if deadline a is before deadline b
+static inline bool deadline_before(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) < 0;
+}
+
+static void schedule_remove(uint8_t id) {
+  for (uint8_t i = 0; i < schedule_length; i++) {
+    if (schedule[i] == id) {
+      schedule_length--;
+      for (; i < schedule_length; i++) {
+        schedule[i] = schedule[i + 1];
+      }
+      return;
+    }
+  }
+}
+
+static void schedule_insert(uint8_t id, uint32_t deadline) {
+  tasks[id].deadline = deadline;
+  // tasks with equal deadlines run in the order they were scheduled
+  uint8_t i = schedule_length;
+  while (i > 0 && deadline_before(deadline, tasks[schedule[i - 1]].deadline)) {
+    schedule[i] = schedule[i - 1];
+    i--;
+  }
+  schedule[i] = id;
+  schedule_length++;
+}
+
+void scheduler_add(TaskId id, TaskFunction function) {
+  schedule_remove(id);
+  tasks[id].function = function;
+}
+
+void scheduler_schedule(TaskId id, uint16_t delay) {
+  schedule_remove(id);
+  schedule_insert(id, scheduler_now + delay);
+}
+
+void scheduler_cancel(TaskId id) { schedule_remove(id); }
+
+bool scheduler_is_scheduled(TaskId id) {
+  for (uint8_t i = 0; i < schedule_length; i++) {
+    if (schedule[i] == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void scheduler_run(uint32_t now) {
+  scheduler_now = now;
+  while (schedule_length > 0 &&
+         !deadline_before(now, tasks[schedule[0]].deadline)) {
+    uint8_t id = schedule[0];
+    uint32_t deadline = tasks[id].deadline;
+    schedule_remove(id);
+
+    uint16_t delay = tasks[id].function();
+    // the task may have rescheduled itself
+    if (delay == SCHEDULER_STOP || scheduler_is_scheduled((TaskId)id)) {
+      continue;
+    }
+    // keep the rate unless the task has fallen a full period behind
+    uint32_t next = deadline + delay;
+    if (!deadline_before(now, next)) {
+      next = now + delay;
+    }
+    schedule_insert(id, next);
+  }
+}
+
+uint16_t scheduler_time_to_next() {
+  if (schedule_length == 0) {
+    return 0xffff;
+  }
+  uint32_t deadline = tasks[schedule[0]].deadline;
+  if (!deadline_before(scheduler_now, deadline)) {
+    return 0;
+  }
+  uint32_t remaining = deadline - scheduler_now;
+  return remaining > 0xffff ? 0xffff : remaining;
+}
@@ -0,0 +1,80 @@
+#ifndef SH_RPI_FIRMWARE_SRC_SCHEDULER_H_
+#define SH_RPI_FIRMWARE_SRC_SCHEDULER_H_
+
+#include <stdint.h>
+
+//////
+// Cooperative deadline scheduler
+//
+// Each task has a deadline in milliseconds. Scheduled tasks are kept in a
+// list sorted by deadline, so the next task to run is always at the head.
+// The main loop calls scheduler_run() with the current millis() value once
+// per pass; it runs every task whose deadline has passed. A task returns
+// the delay until it should run again, or SCHEDULER_STOP for one-shot
+// timers.
+//
+// Deadlines are compared with wrap-around arithmetic, so the scheduler
+// keeps working when millis() overflows. Delays must be shorter than
+// 2^31 ms.
+
+enum TaskId {
+  TASK_ACQUISITION,      //!< Start an ADC sweep
+  TASK_BLINKER,          //!< Advance the LED pattern
+  TASK_TELEMETRY,        //!< Send a serial status frame
+  TASK_SM_TIMER,         //!< State machine timeout (one-shot)
+  TASK_WATCHDOG,         //!< Host watchdog expiry (one-shot)
+  TASK_STACK_CHECK,      //!< Update the stack high-water mark
+  TASK_CONFIG_COMMIT,    //!< Write changed settings to EEPROM (one-shot)
+  TASK_SHUTDOWN_STATS,   //!< Retry saving the shutdown durations (one-shot)
+  TASK_SUPERCAP_HEALTH,  //!< Retry saving the supercap health (one-shot)
+  NUM_TASKS
+};
+
+#define SCHEDULER_STOP 0
+
+/**
+ * @brief Task function.
+ *
+ * @return Delay in ms until the next run, or SCHEDULER_STOP
+ */
+typedef uint16_t (*TaskFunction)();
+
+/**
+ * @brief Set the function of a task. The task is not scheduled.
+ */
+void scheduler_add(TaskId id, TaskFunction function);
+
+/**
+ * @brief Schedule a task to run after a delay.
+ *
+ * The delay is counted from the time passed to the latest scheduler_run()
+ * call. A task that is already scheduled is moved to the new deadline.
+ */
+void scheduler_schedule(TaskId id, uint16_t delay);
+
+/**
+ * @brief Remove a task from the schedule.
+ */
+void scheduler_cancel(TaskId id);
+
+/**
+ * @brief Check whether a task is scheduled.
+ */
+bool scheduler_is_scheduled(TaskId id);
+
+/**
+ * @brief Run all tasks whose deadline has passed, in deadline order.
+ *
+ * @param now Current time in ms
+ */
+void scheduler_run(uint32_t now);
+
+/**
+ * @brief Time until the next deadline.
+ *
+ * @return Milliseconds until the first scheduled task is due, 0 if it is
+ *   already due, or 0xffff if no task is scheduled
+ */
+uint16_t scheduler_time_to_next();
+
+#endif  // SH_RPI_FIRMWARE_SRC_SCHEDULER_H_
@@ -1,9 +1,19 @@
 #include "shrpi_i2c.h"
 
-#include <Wire.h>
-
+#include "analog_io.h"
+#include "commands.h"
+#include "energy.h"
 #include "globals.h"
+#include "hal.h"
+#include "history.h"
+#include "holdup.h"
+#include "idle.h"
+#include "shutdown_stats.h"
+#include "spsc_queue.h"
+#include "stack_monitor.h"
 #include "state_machine.h"
+#include "supercap_health.h"
+#include "timing.h"
 
 // Spec:
 
@@ -27,163 +37,477 @@
 // - Read 0x16: Query watchdog elapsed
 // - Read 0x17: Query LED brightness setting
 // - Write 0x17 [NN]: Set LED brightness to NN
+// - Read 0x18: Query ADC oversampling setting
+// - Write 0x18 [NN]: Accumulate 2^NN samples per reading (NN = 0..6)
+// - Read 0x19: Query history recording interval
+// - Write 0x19 [NN]: Record history every NN ADC sweeps (0 = disabled)
+// - Read 0x1A: Query shutdown wait limit in seconds
+// - Write 0x1A [NN]: Wait at most NN s (1..65, 0 = default) for the host to
+//   power off after a shutdown request
 // - Read 0x20: Query DC IN voltage
 // - Read 0x21: Query supercap voltage
 // - Read 0x22: Query DC IN current
 // - Read 0x23: Query MCU temperature
+// - Read 0x24: Query telemetry block (see below)
+// - Read 0x25: Read and remove up to 3 history records (see history.h)
+// - Read 0x26: Query history record count and overflow flag; reading both
+//   bytes clears the flag
+// - Read 0x27: Query minimum free SRAM since boot, in bytes (see below)
+// - Read 0x28: Query command overflow counters (see below)
+// - Read 0x29: Query predicted hold-up time in DEPLETING (see below)
+// - Read 0x2A: Query learned shutdown timeout and durations (see below)
+// - Read 0x2B: Query estimated supercap capacitance in mF (see below)
+// - Read 0x2C: Query estimated supercap ESR in mOhm
+// - Read 0x2D: Query the number of capacitance and ESR estimates
+// - Write 0x2B [ANY]: Forget the supercap estimates, e.g. after replacing
+//   the supercap
 // - Write 0x30: [ANY]: Initiate shutdown
 // - Write 0x31: [ANY]: Initiate sleep shutdown
+// - Read 0x40: Query loop() execution time statistics (see below)
+// - Read 0x41: Query ADC sample processing time statistics
+// - Read 0x42: Query state machine execution time statistics
+// - Read 0x43: Query I2C handler execution time statistics
+// - Read 0x44: Query power-fail response time statistics, from V_IN
+//   dropping below the threshold to the state machine entering DEPLETING
+// - Write 0x40 [ANY]: Reset all execution time statistics
+// - Read 0x50: Query DC IN energy since boot in mWh (see below)
+// - Read 0x51: Query DC IN charge since boot in mAh
+// - Read 0x52: Query DC IN energy since the trip reset in mWh
+// - Read 0x53: Query DC IN charge since the trip reset in mAh
+// - Write 0x52 [ANY]: Reset the trip counters
+//
+// Registers 0x01-0x29 are served from a register image (see below). A
+// read transaction that continues past the end of a register returns the
+// following registers in address order, so any contiguous range of them
+// can be read in one go.
+//
+// The statistics registers 0x2A-0x2D, 0x40-0x44 and 0x50-0x53 are served
+// from a separate cache (see below). A read continues into the following
+// registers of the same group (0x2A, 0x2B-0x2D, 0x40-0x44 or 0x50-0x53).
+//
+// The history FIFO registers 0x25 and 0x26 are served live instead. To
+// drain the history, first read the count from 0x26 and then read
+// min(count, 3) * 8 bytes from 0x25. The records the host has read in full
+// are removed from the buffer, and the overflow flag is cleared, when the
+// next transaction starts; Wire.getBytesRead() tells how many bytes the
+// host clocked out. The rest are served again by the next read.
 
-void request_I2C_event_0x01() {
-  // Query hardware version
-  Wire.write(0xff);
-}
+// Telemetry block returned by register 0x24. All multi-byte values are
+// big-endian and use the same scaling as the individual registers.
+//
+// Offset  Size  Content
+//   0      1    Block format version (TELEMETRY_BLOCK_VERSION)
+//   1      2    Sample sequence number, incremented on every ADC sweep
+//   3      2    DC IN voltage (as 0x20)
+//   5      2    Supercap voltage (as 0x21)
+//   7      2    DC IN current (as 0x22)
+//   9      2    MCU temperature (as 0x23)
+//  11      1    State machine state (as 0x15)
+//  12      2    Watchdog elapsed in 0.1 s units, saturated
+//  14      1    Flags: bit 0 = supercap overvoltage alarm, bit 1 = 5V on
 
-void request_I2C_event_0x02() {
-  // Query legacy firmware version
-  Wire.write(LEGACY_FW_VERSION);
-}
+#define TELEMETRY_BLOCK_VERSION 1
+#define TELEMETRY_BLOCK_SIZE 15
 
-void request_I2C_event_0x03() {
-  // Query hardware version
-  Wire.write(kHWVersion[0]);
-  Wire.write(kHWVersion[1]);
-  Wire.write(kHWVersion[2]);
-  Wire.write(kHWVersion[3]);
-  // Wire.write(kHWVersion, 4);
-}
+#define TELEMETRY_FLAG_VCAP_ALARM 0x01
+#define TELEMETRY_FLAG_EN5V 0x02
+
+// Command overflow counters returned by register 0x28. One byte per
+// command type, in CommandType order (0x10, 0x12, 0x13, 0x14, 0x17, 0x18,
+// 0x19, 0x30, 0x31, 0x40, 0x52, 0x1A, 0x2B), counting writes dropped
+// because the command queue was full. The counts saturate at 255.
+
+// Register 0x27 is a big-endian 16-bit word: the number of bytes between
+// the end of the static data and the deepest stack use seen so far. It is
+// updated once per second.
+
+// Register 0x29 is a big-endian 16-bit word: the time in 0.1 s units until
+// the supercap is expected to reach the power-off threshold, extrapolated
+// from the discharge so far (see holdup.h). It is 0xFFFF outside DEPLETING
+// and during the first second of it.
+
+// Shutdown block returned by register 0x2A (see shutdown_stats.h). Times
+// are big-endian 16-bit words in 0.1 s units.
+//
+// Offset  Size  Content
+//   0      2    Shutdown timeout currently in use
+//   2      2    Duration of the latest shutdown, 0xFFFF if none since boot
+//   4     24    Histogram bin counts; bin i counts shutdowns shorter than
+//               2.5 s * (i + 1), the last bin counts all longer ones and
+//               the hosts cut off at the timeout
+
+#define SHUTDOWN_BLOCK_SIZE (4 + SHUTDOWN_BINS)
+
+// Registers 0x2B and 0x2C are big-endian 16-bit words holding the moving
+// averages of the supercap capacitance and ESR estimates (see
+// supercap_health.h), 0xFFFF until the first estimate. Register 0x2D holds
+// two bytes: the number of capacitance estimates and the number of ESR
+// estimates, saturated at 255.
+
+// Execution time statistics returned by registers 0x40-0x44. All values
+// are big-endian 16-bit words; durations are in microseconds and saturate
+// at 65535.
+//
+// Offset  Size  Content
+//   0      2    Minimum duration
+//   2      2    Maximum duration
+//   4      2    Mean duration
+//   6     16    Histogram bin counts; bin i counts durations shorter than
+//               12.8 us * 2^i, the last bin counts all longer durations
+//
+// The five blocks are rendered in turn, one per ADC sweep, so a block may
+// lag the statistics, including a reset, by up to about 0.1 s.
+
+#define TIMING_BLOCK_SIZE (6 + 2 * TIMING_HISTOGRAM_BINS)
+
+// Energy and charge registers 0x50-0x53 are big-endian 32-bit counters,
+// integrated from the DC IN voltage and current on every ADC sweep (see
+// energy.h). Reading 0x50 with a length of 16 returns all four.
+
+//////
+// Register image
+//
+// The registers that change with every ADC sweep are laid out back to back
+// in address order in a flat byte array. The main loop renders the values
+// into the back buffer and then flips the buffers, so the TWI interrupt
+// only ever copies bytes out of a complete, consistent image.
+//
+// The statistics registers would more than double the size of the image
+// while rarely changing. They are kept in a single statistics cache
+// instead, which the main loop renders group by group and copies in with
+// interrupts disabled. The TWI interrupt only copies bytes out of either.
+
+// Byte offset of each readable register in the image. Each entry is the
+// previous offset plus the size of the previous register.
+enum RegisterFileOffset : uint8_t {
+  RF_0x01 = 0,
+  RF_0x02 = RF_0x01 + 1,
+  RF_0x03 = RF_0x02 + 1,
+  RF_0x04 = RF_0x03 + 4,
+  RF_0x10 = RF_0x04 + 4,
+  RF_0x12 = RF_0x10 + 1,
+  RF_0x13 = RF_0x12 + 2,
+  RF_0x14 = RF_0x13 + 2,
+  RF_0x15 = RF_0x14 + 2,
+  RF_0x16 = RF_0x15 + 1,
+  RF_0x17 = RF_0x16 + 1,
+  RF_0x18 = RF_0x17 + 1,
+  RF_0x19 = RF_0x18 + 1,
+  RF_0x1A = RF_0x19 + 1,
+  RF_0x20 = RF_0x1A + 1,
+  RF_0x21 = RF_0x20 + 2,
+  RF_0x22 = RF_0x21 + 2,
+  RF_0x23 = RF_0x22 + 2,
+  RF_0x24 = RF_0x23 + 2,
+  RF_0x27 = RF_0x24 + TELEMETRY_BLOCK_SIZE,
+  RF_0x28 = RF_0x27 + 2,
+  RF_0x29 = RF_0x28 + NUM_COMMANDS,
+  REGISTER_FILE_SIZE = RF_0x29 + 2,
+  RF_UNKNOWN = 0xff,
+};
+
+static_assert(REGISTER_FILE_SIZE <= RF_UNKNOWN,
+              "the register image must fit 8-bit offsets");
+
+// Register address to image offset lookup
+const uint8_t register_offsets[] = {
+    RF_UNKNOWN,  // 0x00
+    RF_0x01,     // 0x01
+    RF_0x02,     // 0x02
+    RF_0x03,     // 0x03
+    RF_0x04,     // 0x04
+    RF_UNKNOWN,  // 0x05
+    RF_UNKNOWN,  // 0x06
+    RF_UNKNOWN,  // 0x07
+    RF_UNKNOWN,  // 0x08
+    RF_UNKNOWN,  // 0x09
+    RF_UNKNOWN,  // 0x0a
+    RF_UNKNOWN,  // 0x0b
+    RF_UNKNOWN,  // 0x0c
+    RF_UNKNOWN,  // 0x0d
+    RF_UNKNOWN,  // 0x0e
+    RF_UNKNOWN,  // 0x0f
+    RF_0x10,     // 0x10
+    RF_UNKNOWN,  // 0x11
+    RF_0x12,     // 0x12
+    RF_0x13,     // 0x13
+    RF_0x14,     // 0x14
+    RF_0x15,     // 0x15
+    RF_0x16,     // 0x16
+    RF_0x17,     // 0x17
+    RF_0x18,     // 0x18
+    RF_0x19,     // 0x19
+    RF_0x1A,     // 0x1a
+    RF_UNKNOWN,  // 0x1b
+    RF_UNKNOWN,  // 0x1c
+    RF_UNKNOWN,  // 0x1d
+    RF_UNKNOWN,  // 0x1e
+    RF_UNKNOWN,  // 0x1f
+    RF_0x20,     // 0x20
+    RF_0x21,     // 0x21
+    RF_0x22,     // 0x22
+    RF_0x23,     // 0x23
+    RF_0x24,     // 0x24
+    RF_UNKNOWN,  // 0x25
+    RF_UNKNOWN,  // 0x26
+    RF_0x27,     // 0x27
+    RF_0x28,     // 0x28
+    RF_0x29,     // 0x29
+};
+
+static uint8_t register_file[2][REGISTER_FILE_SIZE];
+// index of the buffer currently served to the host
+static volatile uint8_t register_file_front = 0;
+
+// Byte offset of each statistics register group in the cache
+enum RegisterStatsOffset : uint8_t {
+  RS_0x2A = 0,
+  RS_0x2B = RS_0x2A + SHUTDOWN_BLOCK_SIZE,
+  RS_0x40 = RS_0x2B + 6,
+  RS_0x50 = RS_0x40 + NUM_TIMING_SECTIONS * TIMING_BLOCK_SIZE,
+  REGISTER_STATS_SIZE = RS_0x50 + 16,
+};
+
+static uint8_t register_stats[REGISTER_STATS_SIZE];
 
-void request_I2C_event_0x04() {
-  // Query firmware version
-  Wire.write(kFWVersion[0]);
-  Wire.write(kFWVersion[1]);
-  Wire.write(kFWVersion[2]);
-  Wire.write(kFWVersion[3]);
-  // Wire.write(kFWVersion, 4);
+static inline void put_word(uint8_t* dst, uint16_t value) {
+  dst[0] = value >> 8;
+  dst[1] = value & 0xff;
 }
 
-void request_I2C_event_0x10() {
-  // Query 5V power state
-  Wire.write(read_pin(EN5V_PIN));
+static inline void put_long(uint8_t* dst, uint32_t value) {
+  put_word(&dst[0], value >> 16);
+  put_word(&dst[2], value & 0xffff);
 }
 
-void request_I2C_event_0x12() {
-  // Query watchdog time remaining
-  // FIXME: magic numbers
-  Wire.write(watchdog_limit >> 8);
-  Wire.write(watchdog_limit & 0xff);
+static inline uint16_t ticks_to_us(uint32_t ticks) {
+  uint32_t us = ticks / TIMING_TICKS_PER_US;
+  return us > 0xffff ? 0xffff : us;
 }
 
-void request_I2C_event_0x13() {
-  // Query power-on threshold voltage
-  // power_on_vcap_voltage is stored as a 10-bit value, but
-  // it should be scaled and transmitted as a 16-bit word.
-  Wire.write(char(power_on_vcap_voltage >> 2));
-  Wire.write(char((power_on_vcap_voltage << 6) & 0xff));
+static void render_timing_block(uint8_t* dst, TimingSection section) {
+  TimingStats stats;
+  timing_get_stats(section, stats);
+  put_word(&dst[0], ticks_to_us(stats.min));
+  put_word(&dst[2], ticks_to_us(stats.max));
+  put_word(&dst[4], stats.count ? ticks_to_us(stats.sum / stats.count) : 0);
+  for (uint8_t i = 0; i < TIMING_HISTOGRAM_BINS; i++) {
+    put_word(&dst[6 + 2 * i], stats.histogram[i]);
+  }
 }
 
-void request_I2C_event_0x14() {
-  // Query power-off threshold voltage
-  // power_off_vcap_voltage is stored as a 10-bit value, but
-  // it should be scaled and transmitted as a 16-bit word.
-  Wire.write(char(power_off_vcap_voltage >> 2));
-  Wire.write(char((power_off_vcap_voltage << 6) & 0xff));
+// Copy a rendered group into the statistics cache. The TWI interrupt
+// cannot run meanwhile, so it never sees half a group.
+static void publish_stats(uint8_t offset, const uint8_t* block,
+                          uint8_t length) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memcpy(&register_stats[offset], block, length);
+  }
 }
 
-void request_I2C_event_0x15() {
-  // Query state-machine state
-  Wire.write(get_sm_state());
+static void update_stats_registers() {
+  // the timing blocks take several divisions each, so one is rendered per
+  // update, which comes at least with every ADC sweep
+  static uint8_t timing_section = 0;
+  static_assert(TIMING_BLOCK_SIZE <= SHUTDOWN_BLOCK_SIZE &&
+                    16 <= SHUTDOWN_BLOCK_SIZE,
+                "every statistics group must fit the render buffer");
+
+  uint8_t block[SHUTDOWN_BLOCK_SIZE];
+  put_word(&block[0], shutdown_stats_get_timeout() / 100);
+  uint32_t last_tenths = shutdown_stats_get_last() / 100;
+  put_word(&block[2], last_tenths > 0xffff ? 0xffff : last_tenths);
+  shutdown_stats_get_bins(&block[4]);
+  publish_stats(RS_0x2A, block, SHUTDOWN_BLOCK_SIZE);
+
+  SupercapHealth health;
+  supercap_health_get(health);
+  put_word(&block[0], health.capacitance);
+  put_word(&block[2], health.esr);
+  block[4] = health.capacitance_count;
+  block[5] = health.esr_count;
+  publish_stats(RS_0x2B, block, 6);
+
+  render_timing_block(block, (TimingSection)timing_section);
+  publish_stats(RS_0x40 + timing_section * TIMING_BLOCK_SIZE, block,
+                TIMING_BLOCK_SIZE);
+  if (++timing_section == NUM_TIMING_SECTIONS) {
+    timing_section = 0;
+  }
+
+  EnergyTotals totals;
+  energy_get(ENERGY_SINCE_BOOT, totals);
+  put_long(&block[0], totals.mwh);
+  put_long(&block[4], totals.mah);
+  energy_get(ENERGY_TRIP, totals);
+  put_long(&block[8], totals.mwh);
+  put_long(&block[12], totals.mah);
+  publish_stats(RS_0x50, block, 16);
 }
 
-void request_I2C_event_0x16() {
-  // Query watchdog elapsed
+void update_I2C_register_file(bool new_sample) {
+  static uint16_t sequence = 0;
+  static uint16_t watchdog_tenths = 0;
+
+  // values that only change with a new ADC sweep are carried over
+  uint8_t* front = register_file[register_file_front];
+  uint8_t* rf = register_file[register_file_front ^ 1];
+  memcpy(rf, front, REGISTER_FILE_SIZE);
+
+  if (new_sample) {
+    sequence++;
+    uint32_t elapsed_tenths = watchdog_elapsed / 100;
+    watchdog_tenths = elapsed_tenths > 0xffff ? 0xffff : elapsed_tenths;
+  }
+
+  uint8_t flags = 0;
+  if (vcap_alarm_triggered) {
+    flags |= TELEMETRY_FLAG_VCAP_ALARM;
+  }
+  if (read_pin(EN5V_PIN)) {
+    flags |= TELEMETRY_FLAG_EN5V;
+  }
+
+  rf[RF_0x01] = 0xff;
+  rf[RF_0x02] = LEGACY_FW_VERSION;
+  memcpy(&rf[RF_0x03], kHWVersion, 4);
+  memcpy(&rf[RF_0x04], kFWVersion, 4);
+  rf[RF_0x10] = read_pin(EN5V_PIN);
+  put_word(&rf[RF_0x12], watchdog_limit);
+  // The Vcap thresholds are stored as 10-bit values, but they are
+  // transmitted as left-aligned 16-bit words.
+  put_word(&rf[RF_0x13], power_on_vcap_voltage << 6);
+  put_word(&rf[RF_0x14], power_off_vcap_voltage << 6);
+  rf[RF_0x15] = get_sm_state();
   // FIXME: magic numbers
-  Wire.write(watchdog_elapsed / 100);
-}
+  rf[RF_0x16] = watchdog_tenths;
+  rf[RF_0x17] = led_global_brightness;
+  rf[RF_0x18] = adc_sampler_get_oversampling();
+  rf[RF_0x19] = history_get_interval();
+  rf[RF_0x1A] = shutdown_wait_limit;
+  put_word(&rf[RF_0x20], v_in_word);
+  put_word(&rf[RF_0x21], v_supercap_word);
+  put_word(&rf[RF_0x22], i_in_word);
+  put_word(&rf[RF_0x23], temperature_K);
 
-void request_I2C_event_0x17() {
-  // Query LED brightness level
-  Wire.write(led_global_brightness);
-}
+  uint8_t* block = &rf[RF_0x24];
+  block[0] = TELEMETRY_BLOCK_VERSION;
+  put_word(&block[1], sequence);
+  memcpy(&block[3], &rf[RF_0x20], 8);
+  block[11] = rf[RF_0x15];
+  put_word(&block[12], watchdog_tenths);
+  block[14] = flags;
 
-void request_I2C_event_0x20() {
-  // Query DC IN voltage
-  Wire.write(v_in_buf, 2);
-}
+  put_word(&rf[RF_0x27], stack_get_free_min());
 
-void request_I2C_event_0x21() {
-  // Query supercap voltage
-  Wire.write(v_supercap_buf, 2);
-}
+  for (uint8_t i = 0; i < NUM_COMMANDS; i++) {
+    rf[RF_0x28 + i] = command_overflows[i];
+  }
+
+  put_word(&rf[RF_0x29], holdup_get_tenths(power_off_vcap_voltage));
+
+  // the image must be complete before it is handed to the TWI interrupt
+  SPSC_BARRIER();
+  // single byte write; takes effect atomically
+  register_file_front ^= 1;
 
-void request_I2C_event_0x22() {
-  // Query DC IN current
-  Wire.write(i_in_buf, 2);
+  update_stats_registers();
 }
 
-void request_I2C_event_0x23() {
-  // Query MCU temperature
-  Wire.write(temperature_K_buf, 2);
+// History FIFO data handed to the TWI driver by the last request
+static uint8_t history_records_served = 0;
+static bool history_overflow_served = false;
+static uint8_t history_overflow_mark;
+
+// Remove what the host has read of the last request. Called as every
+// transaction starts, which also restarts the count of bytes read.
+static void commit_history_read() {
+  uint8_t bytes_read = Wire.getBytesRead();
+  if (history_records_served) {
+    uint8_t records = bytes_read / HISTORY_RECORD_SIZE;
+    history_drop(records < history_records_served ? records
+                                                  : history_records_served);
+    history_records_served = 0;
+  }
+  if (history_overflow_served) {
+    if (bytes_read >= 2) {
+      history_clear_overflow(history_overflow_mark);
+    }
+    history_overflow_served = false;
+  }
 }
 
-void request_I2C_event_unknown() {
+static void serve_I2C_request() {
+  commit_history_read();
+
+  if (i2c_register == 0x25) {
+    // Read history records
+    uint8_t records[HISTORY_READ_MAX * HISTORY_RECORD_SIZE];
+    uint8_t count = history_peek(records, HISTORY_READ_MAX);
+    if (count == 0) {
+      Wire.write(0);
+    } else {
+      Wire.write(records, count * HISTORY_RECORD_SIZE);
+    }
+    history_records_served = count;
+    return;
+  }
+  if (i2c_register == 0x26) {
+    // Query history count and overflow flag
+    Wire.write(history_count());
+    bool overflow = history_get_overflow(history_overflow_mark);
+    Wire.write(overflow);
+    history_overflow_served = overflow;
+    return;
+  }
+
+  uint8_t offset = RF_UNKNOWN;
+  if (i2c_register < sizeof(register_offsets)) {
+    offset = register_offsets[i2c_register];
+  }
+
+  if (offset != RF_UNKNOWN) {
+    // Hand the rest of the image to the TWI driver. It sends as many bytes
+    // as the host clocks out, up to the size of its buffer.
+    const uint8_t* rf = register_file[register_file_front];
+    Wire.write(&rf[offset], REGISTER_FILE_SIZE - offset);
+    return;
+  }
+
+  // Statistics groups: the offset of the register and the end of its group
+  uint8_t end = 0;
+  if (i2c_register == 0x2A) {
+    offset = RS_0x2A;
+    end = RS_0x2B;
+  } else if (i2c_register >= 0x2B && i2c_register <= 0x2D) {
+    offset = RS_0x2B + 2 * (i2c_register - 0x2B);
+    end = RS_0x40;
+  } else if (i2c_register >= 0x40 && i2c_register <= 0x44) {
+    offset = RS_0x40 + TIMING_BLOCK_SIZE * (i2c_register - 0x40);
+    end = RS_0x50;
+  } else if (i2c_register >= 0x50 && i2c_register <= 0x53) {
+    offset = RS_0x50 + 4 * (i2c_register - 0x50);
+    end = REGISTER_STATS_SIZE;
+  }
+  if (end) {
+    Wire.write(&register_stats[offset], end - offset);
+    return;
+  }
+
   // Ignore other registers
   Wire.write(0);
 }
 
-void (*request_I2C_event_array[])() = {
-    request_I2C_event_unknown,  // 0x00
-    request_I2C_event_0x01,     // 0x01
-    request_I2C_event_0x02,     // 0x02
-    request_I2C_event_0x03,     // 0x03
-    request_I2C_event_0x04,     // 0x04
-    request_I2C_event_unknown,  // 0x05
-    request_I2C_event_unknown,  // 0x06
-    request_I2C_event_unknown,  // 0x07
-    request_I2C_event_unknown,  // 0x08
-    request_I2C_event_unknown,  // 0x09
-    request_I2C_event_unknown,  // 0x0a
-    request_I2C_event_unknown,  // 0x0b
-    request_I2C_event_unknown,  // 0x0c
-    request_I2C_event_unknown,  // 0x0d
-    request_I2C_event_unknown,  // 0x0e
-    request_I2C_event_unknown,  // 0x0f
-    request_I2C_event_0x10,     // 0x10
-    request_I2C_event_unknown,  // 0x11
-    request_I2C_event_0x12,     // 0x12
-    request_I2C_event_0x13,     // 0x13
-    request_I2C_event_0x14,     // 0x14
-    request_I2C_event_0x15,     // 0x15
-    request_I2C_event_0x16,     // 0x16
-    request_I2C_event_0x17,     // 0x17
-    request_I2C_event_unknown,  // 0x18
-    request_I2C_event_unknown,  // 0x19
-    request_I2C_event_unknown,  // 0x1a
-    request_I2C_event_unknown,  // 0x1b
-    request_I2C_event_unknown,  // 0x1c
-    request_I2C_event_unknown,  // 0x1d
-    request_I2C_event_unknown,  // 0x1e
-    request_I2C_event_unknown,  // 0x1f
-    request_I2C_event_0x20,     // 0x20
-    request_I2C_event_0x21,     // 0x21
-    request_I2C_event_0x22,     // 0x22
-    request_I2C_event_0x23,     // 0x23
-};
-
-void receive_I2C_event(int bytes) {
+static void handle_I2C_receive(int bytes) {
   // watchdog is considered zeroed after any input
   watchdog_reset = true;
+  idle_wake();
+  commit_history_read();
 
   if (bytes == 1) {
     // We can assume this is a register read request
+    // The data is served by request_I2C_event().
     i2c_register = Wire.read();
-
-    if (i2c_register <
-        sizeof(request_I2C_event_array) / sizeof(request_I2C_event_array[0])) {
-      Wire.onRequest(request_I2C_event_array[i2c_register]);
-    } else {
-      Wire.onRequest(request_I2C_event_unknown);
-    }
     return;
   }
 
@@ -192,13 +516,12 @@ void receive_I2C_event(int bytes) {
   i2c_register = Wire.read();
 
   // If there are more than 1 byte, then the master is writing to the slave.
-  // We can go through a long switch statement because the transmission
-  // has been already received in the RX buffer.
+  // The write is decoded into a command for the main loop; nothing is
+  // executed here.
   switch (i2c_register) {
     case 0x10:
       // Set 5V power state
-      // FIXME: this should change the state machine state
-      set_en5v_pin(Wire.read());
+      command_post(CMD_SET_EN5V, Wire.read());
       break;
     case 0x11:
       // This used to set ENIN (input voltage to Vcap) state.
@@ -206,32 +529,69 @@ void receive_I2C_event(int bytes) {
       // so this is just ignored.
       Wire.read();
       break;
-    case 0x12:
+    case 0x12: {
       // Set or disable watchdog timer
       // FIXME: magic numbers
-      new_watchdog_limit = Wire.read() << 8 | Wire.read();
+      uint16_t limit = Wire.read() << 8;
+      limit |= Wire.read();
+      command_post(CMD_SET_WATCHDOG, limit);
       break;
-    case 0x13:
+    }
+    case 0x13: {
       // Set power-on threshold voltage
-      new_power_on_vcap_voltage = (Wire.read() << 2) | (Wire.read() >> 6);
+      int16_t voltage = Wire.read() << 2;
+      voltage |= Wire.read() >> 6;
+      command_post(CMD_SET_POWER_ON_VCAP, voltage);
       break;
-    case 0x14:
+    }
+    case 0x14: {
       // Set power-off threshold voltage
-      new_power_off_vcap_voltage = (Wire.read() << 2) | (Wire.read() >> 6);
+      int16_t voltage = Wire.read() << 2;
+      voltage |= Wire.read() >> 6;
+      command_post(CMD_SET_POWER_OFF_VCAP, voltage);
       break;
+    }
     case 0x17:
       // Set LED brightness level
-      new_led_global_brightness = Wire.read();
+      command_post(CMD_SET_LED_BRIGHTNESS, Wire.read());
+      break;
+    case 0x18:
+      // Set ADC oversampling
+      // out-of-range values are clamped by the sampler
+      command_post(CMD_SET_ADC_OVERSAMPLE, Wire.read());
+      break;
+    case 0x19:
+      // Set history recording interval
+      command_post(CMD_SET_HISTORY_INTERVAL, Wire.read());
+      break;
+    case 0x1A:
+      // Set shutdown wait limit
+      command_post(CMD_SET_SHUTDOWN_WAIT_LIMIT, Wire.read());
+      break;
+    case 0x2B:
+      // Forget the supercap health estimates
+      Wire.read();
+      command_post(CMD_RESET_SUPERCAP_HEALTH, 0);
       break;
     case 0x30:
       // Set shutdown initiated
       Wire.read();
-      shutdown_requested = true;
+      command_post(CMD_SHUTDOWN, 0);
       break;
     case 0x31:
       // Set sleep initiated
       Wire.read();
-      sleep_requested = true;
+      command_post(CMD_SLEEP, 0);
+      break;
+    case 0x40:
+      // Reset execution time statistics
+      Wire.read();
+      command_post(CMD_RESET_TIMING, 0);
+      break;
+    case 0x52:
+      // Reset the trip counters
+      Wire.read();
+      command_post(CMD_RESET_TRIP, 0);
       break;
     default:
       break;
@@ -242,3 +602,15 @@ void receive_I2C_event(int bytes) {
     Wire.read();
   }
 }
+
+void request_I2C_event() {
+  uint32_t start = timing_now();
+  serve_I2C_request();
+  timing_record(TIMING_TWI, start);
+}
+
+void receive_I2C_event(int bytes) {
+  uint32_t start = timing_now();
+  handle_I2C_receive(bytes);
+  timing_record(TIMING_TWI, start);
+}
@@ -3,5 +3,6 @@
 
 extern void receive_I2C_event(int bytes);
 extern void request_I2C_event();
+extern void update_I2C_register_file(bool new_sample);
 
 #endif  // SH_RPI_FIRMWARE_SRC_SHRPI_I2C_H_
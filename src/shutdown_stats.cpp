@@ -0,0 +1,124 @@
+#include "shutdown_stats.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "globals.h"
+#include "hal.h"
+#include "nvm_record.h"
+#include "scheduler.h"
+
+// Delay before retrying a save refused by the EEPROM writer, in ms
+#define SHUTDOWN_STATS_RETRY_DELAY 1000
+
+struct ShutdownStatsRecord {
+  uint8_t version;
+  uint8_t sequence;
+  uint8_t bins[SHUTDOWN_BINS];
+  uint8_t reserved[4];
+  uint16_t crc;
+};
+
+static_assert(sizeof(ShutdownStatsRecord) == SHUTDOWN_STATS_SIZE,
+              "shutdown stats record must fill its slot");
+static_assert(offsetof(ShutdownStatsRecord, sequence) == NVM_RECORD_SEQUENCE &&
+                  offsetof(ShutdownStatsRecord, crc) ==
+                      SHUTDOWN_STATS_SIZE - NVM_RECORD_CRC_SIZE,
+              "shutdown stats record must have the common record layout");
+static_assert(SHUTDOWN_STATS_SIZE == EEPROM_PAGE_SIZE &&
+                  SHUTDOWN_STATS_ADDR % EEPROM_PAGE_SIZE == 0,
+              "each copy must be one EEPROM page");
+
+static ShutdownStatsRecord shutdown_stats;
+// Copy (0 or 1) holding the saved histogram
+static uint8_t shutdown_stats_copy = 1;
+static uint32_t shutdown_last_duration = 0xffffffff;
+
+static bool shutdown_stats_save() {
+  return nvm_record_save(SHUTDOWN_STATS_ADDR, &shutdown_stats,
+                         sizeof(shutdown_stats), shutdown_stats_copy);
+}
+
+static uint16_t shutdown_stats_task() {
+  return shutdown_stats_save() ? SCHEDULER_STOP : SHUTDOWN_STATS_RETRY_DELAY;
+}
+
+void shutdown_stats_load() {
+  scheduler_add(TASK_SHUTDOWN_STATS, shutdown_stats_task);
+
+  ShutdownStatsRecord record;
+  if (!nvm_record_load(SHUTDOWN_STATS_ADDR, &record, sizeof(record),
+                       SHUTDOWN_STATS_VERSION, shutdown_stats_copy)) {
+    memset(&record, 0, sizeof(record));
+    record.version = SHUTDOWN_STATS_VERSION;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { shutdown_stats = record; }
+}
+
+static void shutdown_stats_add(uint8_t bin, uint32_t duration) {
+  // the TWI interrupt reads the histogram (register 0x2A)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    shutdown_last_duration = duration;
+    shutdown_stats.bins[bin]++;
+
+    uint8_t total = 0;
+    for (uint8_t i = 0; i < SHUTDOWN_BINS; i++) {
+      total += shutdown_stats.bins[i];
+    }
+    if (total >= SHUTDOWN_MAX_SAMPLES) {
+      for (uint8_t i = 0; i < SHUTDOWN_BINS; i++) {
+        shutdown_stats.bins[i] /= 2;
+      }
+    }
+  }
+
+  if (shutdown_stats_save()) {
+    scheduler_cancel(TASK_SHUTDOWN_STATS);
+  } else {
+    scheduler_schedule(TASK_SHUTDOWN_STATS, SHUTDOWN_STATS_RETRY_DELAY);
+  }
+}
+
+void shutdown_stats_record(uint32_t duration) {
+  uint32_t bin = duration / SHUTDOWN_BIN_WIDTH;
+  if (bin >= SHUTDOWN_BINS) {
+    bin = SHUTDOWN_BINS - 1;
+  }
+  shutdown_stats_add(bin, duration);
+}
+
+void shutdown_stats_record_cutoff(uint32_t elapsed) {
+  shutdown_stats_add(SHUTDOWN_BINS - 1, elapsed);
+}
+
+uint16_t shutdown_stats_get_timeout() {
+  uint32_t ceiling = (uint32_t)shutdown_wait_limit * 1000;
+
+  uint8_t total = 0;
+  for (uint8_t i = 0; i < SHUTDOWN_BINS; i++) {
+    total += shutdown_stats.bins[i];
+  }
+  if (total < SHUTDOWN_MIN_SAMPLES) {
+    return ceiling;
+  }
+
+  // the first bin at which the cumulative count reaches the percentile
+  uint16_t target = ((uint16_t)total * SHUTDOWN_PERCENTILE + 99) / 100;
+  uint16_t count = 0;
+  uint8_t bin = 0;
+  while (bin < SHUTDOWN_BINS - 1) {
+    count += shutdown_stats.bins[bin];
+    if (count >= target) {
+      break;
+    }
+    bin++;
+  }
+  uint32_t timeout = (uint32_t)(bin + 1) * SHUTDOWN_BIN_WIDTH + SHUTDOWN_MARGIN;
+  return timeout < ceiling ? timeout : ceiling;
+}
+
+uint32_t shutdown_stats_get_last() { return shutdown_last_duration; }
+
+void shutdown_stats_get_bins(uint8_t bins[SHUTDOWN_BINS]) {
+  memcpy(bins, shutdown_stats.bins, SHUTDOWN_BINS);
+}
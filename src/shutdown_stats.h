@@ -0,0 +1,76 @@
+#ifndef SH_RPI_FIRMWARE_SRC_SHUTDOWN_STATS_H_
+#define SH_RPI_FIRMWARE_SRC_SHUTDOWN_STATS_H_
+
+#include <stdint.h>
+
+//////
+// Learned shutdown timeout
+//
+// When the host signals that it has powered off, the time it took since
+// the shutdown was requested is added to a histogram. A host that is cut
+// off at the timeout took longer than that by an unknown amount, so it is
+// counted in the last bin. The shutdown timeout
+// is then a high percentile of the recorded durations plus a margin, capped
+// by the host-settable ceiling (shutdown_wait_limit). Until enough
+// shutdowns have been seen, the ceiling is used as is. Once the histogram
+// holds SHUTDOWN_MAX_SAMPLES shutdowns, all counts are halved, so old
+// shutdowns are gradually forgotten.
+//
+// The histogram is kept in the last two EEPROM pages, written alternately.
+// Each copy has a sequence number and a CRC; at boot the newest valid copy
+// is used (see nvm_record.h).
+
+#define SHUTDOWN_BINS 24
+// Width of a histogram bin in ms. The last bin counts all longer
+// shutdowns.
+#define SHUTDOWN_BIN_WIDTH 2500
+#define SHUTDOWN_PERCENTILE 95
+// Added to the percentile, in ms
+#define SHUTDOWN_MARGIN 5000
+// Number of shutdowns needed before the learned timeout is used
+#define SHUTDOWN_MIN_SAMPLES 4
+#define SHUTDOWN_MAX_SAMPLES 32
+
+#define SHUTDOWN_STATS_VERSION 1
+#define SHUTDOWN_STATS_SIZE 32
+// EEPROM address of the first copy
+#define SHUTDOWN_STATS_ADDR (256 - 2 * SHUTDOWN_STATS_SIZE)
+
+/**
+ * @brief Read the histogram from the EEPROM.
+ */
+void shutdown_stats_load();
+
+/**
+ * @brief Add the duration of a completed shutdown and save the histogram.
+ *
+ * @param duration Time from the shutdown request to the host powering off,
+ * in ms
+ */
+void shutdown_stats_record(uint32_t duration);
+
+/**
+ * @brief Count a shutdown cut off at the timeout in the last bin and save
+ * the histogram.
+ *
+ * @param elapsed Time from the shutdown request to the cut-off, in ms
+ */
+void shutdown_stats_record_cutoff(uint32_t elapsed);
+
+/**
+ * @brief The shutdown timeout to use, in ms.
+ */
+uint16_t shutdown_stats_get_timeout();
+
+/**
+ * @brief Duration of the latest recorded shutdown in ms, or 0xffffffff if
+ * none since boot. For a cut-off, the time until the cut-off.
+ */
+uint32_t shutdown_stats_get_last();
+
+/**
+ * @brief Copy the histogram bin counts.
+ */
+void shutdown_stats_get_bins(uint8_t bins[SHUTDOWN_BINS]);
+
+#endif  // SH_RPI_FIRMWARE_SRC_SHUTDOWN_STATS_H_
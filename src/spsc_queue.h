@@ -0,0 +1,90 @@
+#ifndef SH_RPI_FIRMWARE_SRC_SPSC_QUEUE_H_
+#define SH_RPI_FIRMWARE_SRC_SPSC_QUEUE_H_
+
+#include <stdint.h>
+
+// Compiler barrier: keeps the compiler from moving memory accesses across
+// it. Sufficient on the single-core AVR, and on hosts with total store
+// ordering for the native build.
+#define SPSC_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/**
+ * @brief Lock-free single-producer, single-consumer ring buffer.
+ *
+ * Used to pass records from an interrupt handler to the main loop (or the
+ * other way round) without disabling interrupts. The head index is only
+ * written by the producer and the tail index only by the consumer. Both
+ * run freely and are reduced modulo the capacity on access, so all
+ * N slots are usable.
+ *
+ * @tparam T Record type
+ * @tparam N Capacity; must be a power of two no larger than 128
+ */
+template <typename T, uint8_t N>
+class SpscQueue {
+  static_assert(N > 0 && N <= 128 && (N & (N - 1)) == 0,
+                "capacity must be a power of two no larger than 128");
+
+ public:
+  /**
+   * @brief Append a record. Producer side only.
+   *
+   * @return false if the queue is full and the record was not added
+   */
+  bool push(const T& value) {
+    uint8_t head = head_;
+    if ((uint8_t)(head - tail_) >= N) {
+      return false;
+    }
+    buffer_[head & (N - 1)] = value;
+    // publish the record only after it has been written
+    SPSC_BARRIER();
+    head_ = head + 1;
+    return true;
+  }
+
+  /**
+   * @brief Remove the oldest record. Consumer side only.
+   *
+   * @return false if the queue is empty
+   */
+  bool pop(T& value) {
+    uint8_t tail = tail_;
+    if (tail == head_) {
+      return false;
+    }
+    SPSC_BARRIER();
+    value = buffer_[tail & (N - 1)];
+    // release the slot only after it has been read
+    SPSC_BARRIER();
+    tail_ = tail + 1;
+    return true;
+  }
+
+  /**
+   * @brief Read the oldest record without removing it. Consumer side only.
+   *
+   * @return false if the queue is empty
+   */
+  bool peek(T& value) const {
+    uint8_t tail = tail_;
+    if (tail == head_) {
+      return false;
+    }
+    SPSC_BARRIER();
+    value = buffer_[tail & (N - 1)];
+    return true;
+  }
+
+  /**
+   * @brief Number of records in the queue.
+   */
+  uint8_t size() const { return head_ - tail_; }
+
+ protected:
+  T buffer_[N];
+  volatile uint8_t head_ = 0;  //!< Written by the producer only
+  volatile uint8_t tail_ = 0;  //!< Written by the consumer only
+};
+
+#endif  // SH_RPI_FIRMWARE_SRC_SPSC_QUEUE_H_
@@ -0,0 +1,56 @@
+#include "stack_monitor.h"
+
+#include "hal.h"
+
+static uint16_t stack_free_min = 0xffff;
+
+#ifdef ARDUINO
+
+// Provided by the linker script
+extern uint8_t __heap_start;
+extern uint8_t __stack;
+
+#define STACK_REGION_LOW (&__heap_start)
+// bytes from the stack pointer up are in use
+#define STACK_REGION_HIGH ((const uint8_t*)SP)
+
+// Runs from .init3, after the stack pointer and the zero register have
+// been set up and before .data and .bss are initialized. Code in the init
+// sections runs inline, without a call frame, so the whole region up to
+// the top of the SRAM can be painted.
+__attribute__((naked, used, section(".init3"))) static void stack_paint() {
+  for (uint8_t* p = &__heap_start; p <= &__stack; p++) {
+    *p = STACK_CANARY;
+  }
+}
+
+#else
+
+uint8_t native_stack[NATIVE_STACK_SIZE];
+uint16_t native_stack_pointer = NATIVE_STACK_SIZE;
+
+#define STACK_REGION_LOW (native_stack)
+#define STACK_REGION_HIGH (native_stack + native_stack_pointer)
+
+void native_stack_paint() {
+  memset(native_stack, STACK_CANARY, NATIVE_STACK_SIZE);
+  native_stack_pointer = NATIVE_STACK_SIZE;
+  stack_free_min = 0xffff;
+}
+
+#endif
+
+void stack_check() {
+  const uint8_t* low = STACK_REGION_LOW;
+  const uint8_t* high = STACK_REGION_HIGH;
+  const uint8_t* p = low;
+  while (p < high && *p == STACK_CANARY) {
+    p++;
+  }
+  uint16_t free = p - low;
+  if (free < stack_free_min) {
+    stack_free_min = free;
+  }
+}
+
+uint16_t stack_get_free_min() { return stack_free_min; }
@@ -0,0 +1,43 @@
+#ifndef SH_RPI_FIRMWARE_SRC_STACK_MONITOR_H_
+#define SH_RPI_FIRMWARE_SRC_STACK_MONITOR_H_
+
+#include <stdint.h>
+
+//////
+// Stack high-water mark
+//
+// At boot, before the C runtime initializes .data and .bss, the SRAM above
+// the static data is painted with a canary byte. The stack grows down into
+// that region, so the lowest overwritten byte marks the deepest stack use
+// since boot. Nothing is allocated from the heap; everything below that
+// byte has never been used.
+
+#define STACK_CANARY 0xc5
+
+/**
+ * @brief Rescan the painted region for the deepest stack use.
+ *
+ * Takes time proportional to the free SRAM; call it from a slow task.
+ */
+void stack_check();
+
+/**
+ * @brief Minimum free SRAM since boot in bytes, as of the latest
+ * stack_check().
+ */
+uint16_t stack_get_free_min();
+
+#ifndef ARDUINO
+// Simulated SRAM above the static data
+#define NATIVE_STACK_SIZE 1024
+extern uint8_t native_stack[NATIVE_STACK_SIZE];
+// Offset of the simulated stack pointer in native_stack
+extern uint16_t native_stack_pointer;
+
+/**
+ * @brief Paint the simulated SRAM and reset the high-water mark.
+ */
+void native_stack_paint();
+#endif
+
+#endif  // SH_RPI_FIRMWARE_SRC_STACK_MONITOR_H_
@@ -1,31 +1,18 @@
 #include "state_machine.h"
 
-#include <Wire.h>
-
+#include "analog_io.h"
 #include "digital_io.h"
 #include "globals.h"
-
-// take care to have all enum values of StateType present
-void (*state_machine[])(void) = {sm_state_BEGIN,
-                                 sm_state_WAIT_VIN_ON,
-                                 sm_state_ENT_CHARGING,
-                                 sm_state_CHARGING,
-                                 sm_state_ENT_ON,
-                                 sm_state_ON,
-                                 sm_state_ENT_DEPLETING,
-                                 sm_state_DEPLETING,
-                                 sm_state_ENT_SHUTDOWN,
-                                 sm_state_SHUTDOWN,
-                                 sm_state_ENT_WATCHDOG_REBOOT,
-                                 sm_state_WATCHDOG_REBOOT,
-                                 sm_state_ENT_OFF,
-                                 sm_state_OFF,
-                                 sm_state_ENT_SLEEP_SHUTDOWN,
-                                 sm_state_SLEEP_SHUTDOWN,
-                                 sm_state_ENT_SLEEP,
-                                 sm_state_SLEEP};
-
-char *state_names[] = {
+#include "hal.h"
+#include "holdup.h"
+#include "led_patterns.h"
+#include "scheduler.h"
+#include "shutdown_stats.h"
+#include "supercap_health.h"
+#include "telemetry.h"
+#include "timing.h"
+
+const char* const state_names[] = {
     "BEGIN",        "WAIT_VIN_ON", "ENT_CHARGING",        "CHARGING",
     "ENT_ON",       "ON",          "ENT_DEPLETING",       "DEPLETING",
     "ENT_SHUTDOWN", "SHUTDOWN",    "ENT_WATCHDOG_REBOOT", "WATCHDOG_REBOOT",
@@ -41,290 +28,417 @@ const char* get_sm_state_name() {
   return state_names[sm_state];
 }
 
-// All LEDs are off
-LedPatternSegment power_off_pattern[] = {
-    {{0, 0, 0, 0}, 0b1111, 3900},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+//////
+// Event queue
+//
+// Events are posted and consumed in the main loop only. Every loop pass
+// posts at most a handful of events and sm_run() drains the queue, so it
+// never fills up in practice; should it happen, the newest event is
+// dropped.
 
-void sm_state_BEGIN() {
-  set_en5v_pin(false);
-  Wire.begin(I2C_ADDRESS);
-  i2c_register = 0xff;
-  watchdog_limit = 0;
-  gpio_poweroff_elapsed = 0;
-  shutdown_requested = false;
-  sleep_requested = false;
-  reset_requested = false;
+#define SM_EVENT_QUEUE_LENGTH 8  // power of two
 
-  led_blinker.set_pattern(power_off_pattern);
+static EventType sm_events[SM_EVENT_QUEUE_LENGTH];
+static uint8_t sm_events_head = 0;
+static uint8_t sm_events_tail = 0;
 
-  sm_state = WAIT_VIN_ON;
+void sm_post_event(EventType event) {
+  if ((uint8_t)(sm_events_head - sm_events_tail) >= SM_EVENT_QUEUE_LENGTH) {
+    return;
+  }
+  sm_events[sm_events_head++ & (SM_EVENT_QUEUE_LENGTH - 1)] = event;
 }
 
-void sm_state_WAIT_VIN_ON() {
-  // never start if DC input voltage is not present
-  if (v_in >= int(VIN_OFF / VIN_MAX * VIN_SCALE)) {
-    sm_state = ENT_CHARGING;
+static bool sm_take_event(EventType& event) {
+  if (sm_events_head == sm_events_tail) {
+    return false;
   }
+  event = sm_events[sm_events_tail++ & (SM_EVENT_QUEUE_LENGTH - 1)];
+  return true;
 }
 
-// just show the underlying bar display
-LedPatternSegment no_pattern[] = {
-    {{0, 0, 0, 0}, 0b0000, 100},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+//////
+// Timers
+//
+// Each state may start a single timer in its entry action. EV_TIMEOUT is
+// posted once when it expires. The timer is stopped on every transition.
+// The host watchdog has a timer of its own. Both are one-shot scheduler
+// tasks.
+
+static uint16_t sm_timer_task() {
+  sm_post_event(EV_TIMEOUT);
+  return SCHEDULER_STOP;
+}
 
-void sm_state_ENT_CHARGING() {
-  led_blinker.set_pattern(no_pattern);
-  sm_state = CHARGING;
+static void sm_timer_start(uint16_t duration) {
+  scheduler_schedule(TASK_SM_TIMER, duration);
 }
 
-void sm_state_CHARGING() {
-  if (v_supercap > power_on_vcap_voltage) {
-    sm_state = ENT_ON;
-  } else if (v_in < int(VIN_OFF / VIN_MAX * VIN_SCALE)) {
-    // if power is cut before supercap is charged,
-    // kill power immediately
-    sm_state = ENT_OFF;
+static uint16_t sm_watchdog_task() {
+  // the watchdog may have been disabled since the timer was started
+  if (watchdog_limit) {
+    sm_post_event(EV_WATCHDOG_TIMEOUT);
   }
+  return SCHEDULER_STOP;
 }
 
-// Pattern to set when watchdog is enabled
-LedPatternSegment watchdog_pattern[] = {
-    {{255, 255, 255, 255}, 0b0000, 3950},
-    {{0, 0, 0, 0}, 0b1111, 50},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+void sm_restart_watchdog() {
+  if (watchdog_limit) {
+    scheduler_schedule(TASK_WATCHDOG, watchdog_limit);
+  } else {
+    scheduler_cancel(TASK_WATCHDOG);
+  }
+}
 
-// Pattern to set when supercap overvoltage is detected
-LedPatternSegment vcap_alarm_pattern[] = {
-    {{255, 255, 255, 255}, 0b1111, 100},
-    {{0, 0, 0, 0}, 0b1111, 100},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+// time of the last power failure detected by the window comparator
+static uint32_t power_fail_time;
 
-void update_watchdog_pattern() {
-    if (watchdog_limit) {
-      led_blinker.set_pattern(watchdog_pattern);
-    } else {
-      led_blinker.set_pattern(no_pattern);
-    }
+//////
+// Guards
+
+static bool vin_present() {
+  return v_in >= int(VIN_OFF / VIN_MAX * VIN_SCALE);
 }
 
-void sm_state_ENT_ON() {
-  set_en5v_pin(true);
-  update_watchdog_pattern();
-  gpio_poweroff_elapsed = 0;
-  sm_state = ON;
+static bool vin_restored() {
+  return v_in > int(VIN_OFF / VIN_MAX * VIN_SCALE);
 }
 
-void sm_state_ON() {
-  if (watchdog_value_changed) {
-    update_watchdog_pattern();
-    watchdog_value_changed = false;
-  }
+static bool vin_lost() { return v_in < int(VIN_OFF / VIN_MAX * VIN_SCALE); }
 
-  if (vcap_alarm_changed) {
-    if (vcap_alarm_triggered) {
-      led_blinker.set_pattern(vcap_alarm_pattern);
-    } else {
-      update_watchdog_pattern();
-    }
-    vcap_alarm_changed = false;
-  }
+static bool vcap_charged() { return v_supercap > power_on_vcap_voltage; }
 
-  if (watchdog_limit && (watchdog_elapsed > watchdog_limit)) {
-    sm_state = ENT_WATCHDOG_REBOOT;
-    return;
-  }
+static bool vcap_depleted() { return v_supercap < power_off_vcap_voltage; }
 
-  if (shutdown_requested) {
-    shutdown_requested = false;
-    sm_state = ENT_SHUTDOWN;
-    return;
-  }
+// the host has been powered off for more than a second
+static bool host_powered_off() {
+  return gpio_poweroff_elapsed > GPIO_OFF_TIME_LIMIT;
+}
 
-  if (sleep_requested) {
-    sleep_requested = false;
-    sm_state = ENT_SLEEP_SHUTDOWN;
-    return;
-  }
+static bool wakeup_triggered() {
+  return rtc_wakeup_triggered || ext_wakeup_triggered;
+}
 
-  // kill the power if the host has been powered off for more than a second
-  //if (gpio_poweroff_elapsed > GPIO_OFF_TIME_LIMIT) {
-  //  sm_state = ENT_OFF;
-  //  return;
-  //}
+//////
+// Actions
 
-  if (v_in < int(VIN_OFF / VIN_MAX * VIN_SCALE)) {
-    sm_state = ENT_DEPLETING;
-    return;
+static void update_watchdog_pattern() {
+  if (watchdog_limit) {
+    led_blinker.set_pattern(watchdog_pattern);
+  } else {
+    led_blinker.set_pattern(no_pattern);
   }
 }
 
-// KITT light effect to the left
-LedPatternSegment depleting_pattern[] = {
-    {{0, 0, 0, 255}, 0b0001, 50}, {{0, 0, 255, 0}, 0b0011, 50},
-    {{0, 255, 0, 0}, 0b0110, 50}, {{255, 0, 0, 0}, 0b1100, 50},
-    {{0, 0, 0, 0}, 0b1000, 50},   {{0, 0, 0, 0}, 0b0000, 750},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+static void update_vcap_alarm_pattern() {
+  if (vcap_alarm_triggered) {
+    led_blinker.set_pattern(vcap_alarm_pattern);
+  } else {
+    update_watchdog_pattern();
+  }
+}
 
-void sm_state_ENT_DEPLETING() {
-  led_blinker.set_pattern(depleting_pattern);
-  sm_state = DEPLETING;
+static void record_power_fail() {
+  timing_record(TIMING_POWER_FAIL, power_fail_time);
 }
 
-void sm_state_DEPLETING() {
-  if (watchdog_limit && (watchdog_elapsed > watchdog_limit)) {
-    sm_state = ENT_WATCHDOG_REBOOT;
-    return;
-  }
+// time at which the current shutdown was requested
+static uint32_t shutdown_start = 0;
 
-  if (shutdown_requested) {
-    shutdown_requested = false;
-    sm_state = ENT_SHUTDOWN;
-    return;
-  } else if (v_in > int(VIN_OFF / VIN_MAX * VIN_SCALE)) {
-    sm_state = ENT_ON;
-    return;
-  } else if (v_supercap < power_off_vcap_voltage) {
-    sm_state = ENT_OFF;
-    return;
-  }
+// the host powered off when the GPIO went low, not when that was confirmed
+static void record_shutdown_duration() {
+  shutdown_stats_record(millis() - shutdown_start - gpio_poweroff_elapsed);
+}
 
-  // kill the power if the host has been powered off for more than a second
-  if (gpio_poweroff_elapsed > GPIO_OFF_TIME_LIMIT) {
-    sm_state = ENT_OFF;
-    return;
-  }
+// the host needed longer than the timeout; count it so that the timeout
+// grows instead of cutting off the same host again
+static void record_shutdown_cutoff() {
+  shutdown_stats_record_cutoff(millis() - shutdown_start);
 }
 
-elapsedMillis elapsed_shutdown;
+// Shutdown and sleep requests made before the host is ON, or a sleep
+// request while DEPLETING, are held until ON is entered
+static bool shutdown_pending = false;
+static bool sleep_pending = false;
 
-// two longish blips, then a long pause
-LedPatternSegment shutdown_pattern[] = {
-    {{0, 0, 0, 0}, 0b1111, 200}, {{0, 0, 0, 0}, 0b0000, 100},
-    {{0, 0, 0, 0}, 0b1111, 200}, {{0, 0, 0, 0}, 0b0000, 1000},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+static void hold_shutdown_request() { shutdown_pending = true; }
 
-void sm_state_ENT_SHUTDOWN() {
-  led_blinker.set_pattern(shutdown_pattern);
-  // ignore watchdog
-  watchdog_limit = 0;
-  elapsed_shutdown = 0;
-  sm_state = SHUTDOWN;
+static void hold_sleep_request() { sleep_pending = true; }
+
+// a reset acts on the held shutdown request, so it is not repeated in OFF
+static void drop_held_requests() {
+  shutdown_pending = false;
+  sleep_pending = false;
 }
 
-void sm_state_SHUTDOWN() {
-  if ((gpio_poweroff_elapsed > GPIO_OFF_TIME_LIMIT) ||
-      (elapsed_shutdown > SHUTDOWN_WAIT_DURATION)) {
-    sm_state = ENT_OFF;
+bool sm_shutdown_requested() {
+  if (shutdown_pending) {
+    return true;
   }
+  for (uint8_t i = sm_events_tail; i != sm_events_head; i++) {
+    if (sm_events[i & (SM_EVENT_QUEUE_LENGTH - 1)] == EV_SHUTDOWN_REQ) {
+      return true;
+    }
+  }
+  return false;
 }
 
-elapsedMillis elapsed_reboot;
-
-// alternating blink pattern indicating something is wrong
-LedPatternSegment watchdog_reboot_pattern[] = {
-    {{255, 0, 255, 0}, 0b1111, 200},
-    {{0, 255, 0, 255}, 0b1111, 200},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+//////
+// Entry and exit actions
 
-void sm_state_ENT_WATCHDOG_REBOOT() {
-  elapsed_reboot = 0;
-  watchdog_limit = 0;
-  Wire.end();  // need to do this before we turn off the power
+static void enter_WAIT_VIN_ON() {
   set_en5v_pin(false);
-  led_blinker.set_pattern(watchdog_reboot_pattern);
-  sm_state = WATCHDOG_REBOOT;
+  Wire.begin(I2C_ADDRESS);
+  i2c_register = 0xff;
+  watchdog_limit = 0;
+  gpio_poweroff_elapsed = 0;
+  shutdown_pending = false;
+  sleep_pending = false;
+
+  led_blinker.set_pattern(power_off_pattern);
 }
 
-void sm_state_WATCHDOG_REBOOT() {
-  if (elapsed_reboot > WATCHDOG_REBOOT_DURATION) {
-    sm_state = BEGIN;
+static void enter_CHARGING() {
+  led_blinker.set_pattern(no_pattern);
+  supercap_health_charging_start();
+}
+
+static void exit_CHARGING() { supercap_health_charging_stop(); }
+
+static void enter_ON() {
+  set_en5v_pin(true);
+  adc_power_fail_arm(int(VIN_OFF / VIN_MAX * VIN_SCALE));
+  update_watchdog_pattern();
+  gpio_poweroff_elapsed = 0;
+  supercap_health_on_start();
+
+  // a held shutdown request takes precedence over a sleep request
+  if (shutdown_pending) {
+    sm_post_event(EV_SHUTDOWN_REQ);
+  } else if (sleep_pending) {
+    sm_post_event(EV_SLEEP_REQ);
   }
+  shutdown_pending = false;
+  sleep_pending = false;
 }
 
-elapsedMillis elapsed_off;
+// V_IN is only monitored for power failure while ON
+static void exit_ON() {
+  adc_power_fail_disarm();
+  supercap_health_on_stop();
+}
 
-void sm_state_ENT_OFF() {
-  Wire.end();  // need to do this before we turn off the power
-  // delay(10);  // DEBUG
-  set_en5v_pin(false);
-  // delay(10);
-  elapsed_off = 0;
-  // in case we're not dead, set a blink pattern
-  led_blinker.set_pattern(power_off_pattern);
-  sm_state = OFF;
+static void enter_DEPLETING() {
+  led_blinker.set_pattern(depleting_pattern);
+  holdup_start();
+  supercap_health_discharge_start();
 }
 
-void sm_state_OFF() {
-  if (elapsed_off > OFF_STATE_DURATION) {
-    // if we're still alive, jump back to begin
-    sm_state = BEGIN;
-  }
+static void exit_DEPLETING() {
+  holdup_stop();
+  supercap_health_discharge_stop();
 }
 
-void sm_state_ENT_SLEEP_SHUTDOWN() {
+static void enter_SHUTDOWN() {
   led_blinker.set_pattern(shutdown_pattern);
   // ignore watchdog
   watchdog_limit = 0;
-  elapsed_shutdown = 0;
-  sm_state = SLEEP_SHUTDOWN;
+  shutdown_start = millis();
+  sm_timer_start(shutdown_stats_get_timeout());
 }
 
-void sm_state_SLEEP_SHUTDOWN() {
-  if ((gpio_poweroff_elapsed > GPIO_OFF_TIME_LIMIT) ||
-      (elapsed_shutdown > SHUTDOWN_WAIT_DURATION)) {
-    sm_state = ENT_SLEEP;
-  }
+static void enter_WATCHDOG_REBOOT() {
+  watchdog_limit = 0;
+  Wire.end();  // need to do this before we turn off the power
+  set_en5v_pin(false);
+  led_blinker.set_pattern(watchdog_reboot_pattern);
+  sm_timer_start(WATCHDOG_REBOOT_DURATION);
 }
 
-// two short blinks, then a long pause
-LedPatternSegment sleep_pattern[] = {
-    {{255, 255, 255, 255}, 0b1111, 100}, {{0, 0, 0, 0}, 0b1111, 200},
-    {{255, 255, 255, 255}, 0b1111, 100}, {{0, 0, 0, 0}, 0b0000, 2000},
-    {{0, 0, 0, 0}, 0b0000, 0},
-};
+static void enter_OFF() {
+  Wire.end();  // need to do this before we turn off the power
+  set_en5v_pin(false);
+  // in case we're not dead, set a blink pattern
+  led_blinker.set_pattern(power_off_pattern);
+  // if we're still alive after the timeout, start over
+  sm_timer_start(OFF_STATE_DURATION);
+}
 
-void sm_state_ENT_SLEEP() {
+static void enter_SLEEP() {
   Wire.end();  // need to do this before we turn off the power
   set_en5v_pin(false);
   // we're not dead, set a blink pattern
   led_blinker.set_pattern(sleep_pattern);
-  sm_state = SLEEP;
 }
 
-void sm_state_SLEEP() {
-  if (rtc_wakeup_triggered || ext_wakeup_triggered) {
-    rtc_wakeup_triggered = false;
-    ext_wakeup_triggered = false;
-    sm_state = BEGIN;
+struct StateActions {
+  void (*entry)();
+  void (*exit)();
+};
+
+// take care to have all enum values of StateType present
+static const StateActions state_actions[] = {
+    {nullptr, nullptr},  // BEGIN
+    {enter_WAIT_VIN_ON, nullptr},  // WAIT_VIN_ON
+    {nullptr, nullptr},  // ENT_CHARGING
+    {enter_CHARGING, exit_CHARGING},  // CHARGING
+    {nullptr, nullptr},  // ENT_ON
+    {enter_ON, exit_ON},  // ON
+    {nullptr, nullptr},  // ENT_DEPLETING
+    {enter_DEPLETING, exit_DEPLETING},  // DEPLETING
+    {nullptr, nullptr},  // ENT_SHUTDOWN
+    {enter_SHUTDOWN, nullptr},  // SHUTDOWN
+    {nullptr, nullptr},  // ENT_WATCHDOG_REBOOT
+    {enter_WATCHDOG_REBOOT, nullptr},  // WATCHDOG_REBOOT
+    {nullptr, nullptr},  // ENT_OFF
+    {enter_OFF, nullptr},  // OFF
+    {nullptr, nullptr},  // ENT_SLEEP_SHUTDOWN
+    {enter_SHUTDOWN, nullptr},  // SLEEP_SHUTDOWN
+    {nullptr, nullptr},  // ENT_SLEEP
+    {enter_SLEEP, nullptr},  // SLEEP
+};
+static_assert(sizeof(state_actions) / sizeof(state_actions[0]) == NUM_STATES,
+              "state_actions must have an entry for every state");
+
+//////
+// Transition table
+//
+// The rows for the current state and event are tried in order and the
+// first one whose guard passes (or has no guard) is taken. A transition
+// runs the exit action of the old state, the transition action and the
+// entry action of the new state. STAY rows run the action only. Events
+// without a matching row are dropped.
+//
+// The table is mirrored in state_machine.dot; check_state_machine.py
+// verifies that the two agree.
+
+// next state of internal transitions
+#define STAY NUM_STATES
+// matches any current state
+#define ANY_STATE NUM_STATES
+
+struct Transition {
+  uint8_t state;
+  EventType event;
+  bool (*guard)();
+  void (*action)();
+  uint8_t next;
+};
+
+// clang-format off
+static const Transition transitions[] = {
+  // state            event                  guard             action                     next
+  {BEGIN,           EV_START,              nullptr,          nullptr,                   WAIT_VIN_ON},
+
+  // never start if DC input voltage is not present
+  {WAIT_VIN_ON,     EV_SAMPLE,             vin_present,      nullptr,                   CHARGING},
+  {WAIT_VIN_ON,     EV_SHUTDOWN_REQ,       nullptr,          hold_shutdown_request,     STAY},
+  {WAIT_VIN_ON,     EV_SLEEP_REQ,          nullptr,          hold_sleep_request,        STAY},
+
+  {CHARGING,        EV_SAMPLE,             vcap_charged,     nullptr,                   ON},
+  // if power is cut before supercap is charged, kill power immediately
+  {CHARGING,        EV_SAMPLE,             vin_lost,         nullptr,                   OFF},
+  {CHARGING,        EV_SHUTDOWN_REQ,       nullptr,          hold_shutdown_request,     STAY},
+  {CHARGING,        EV_SLEEP_REQ,          nullptr,          hold_sleep_request,        STAY},
+
+  {ON,              EV_WATCHDOG_CHANGED,   nullptr,          update_watchdog_pattern,   STAY},
+  {ON,              EV_VCAP_ALARM_CHANGED, nullptr,          update_vcap_alarm_pattern, STAY},
+  {ON,              EV_WATCHDOG_TIMEOUT,   nullptr,          nullptr,                   WATCHDOG_REBOOT},
+  {ON,              EV_SHUTDOWN_REQ,       nullptr,          nullptr,                   SHUTDOWN},
+  {ON,              EV_SLEEP_REQ,          nullptr,          nullptr,                   SLEEP_SHUTDOWN},
+  {ON,              EV_POWER_FAIL,         nullptr,          record_power_fail,         DEPLETING},
+  {ON,              EV_SAMPLE,             vin_lost,         nullptr,                   DEPLETING},
+
+  {DEPLETING,       EV_WATCHDOG_TIMEOUT,   nullptr,          nullptr,                   WATCHDOG_REBOOT},
+  {DEPLETING,       EV_SHUTDOWN_REQ,       nullptr,          nullptr,                   SHUTDOWN},
+  {DEPLETING,       EV_SLEEP_REQ,          nullptr,          hold_sleep_request,        STAY},
+  {DEPLETING,       EV_SAMPLE,             vin_restored,     nullptr,                   ON},
+  {DEPLETING,       EV_SAMPLE,             vcap_depleted,    nullptr,                   OFF},
+  {DEPLETING,       EV_SAMPLE,             host_powered_off, nullptr,                   OFF},
+
+  {SHUTDOWN,        EV_SAMPLE,             host_powered_off, record_shutdown_duration,  OFF},
+  {SHUTDOWN,        EV_TIMEOUT,            nullptr,          record_shutdown_cutoff,    OFF},
+
+  {WATCHDOG_REBOOT, EV_TIMEOUT,            nullptr,          nullptr,                   WAIT_VIN_ON},
+
+  {OFF,             EV_TIMEOUT,            nullptr,          nullptr,                   WAIT_VIN_ON},
+
+  {SLEEP_SHUTDOWN,  EV_SAMPLE,             host_powered_off, record_shutdown_duration,  SLEEP},
+  {SLEEP_SHUTDOWN,  EV_TIMEOUT,            nullptr,          record_shutdown_cutoff,    SLEEP},
+
+  {SLEEP,           EV_SAMPLE,             wakeup_triggered, nullptr,                   WAIT_VIN_ON},
+
+  // reset request overrides the state machine
+  {ANY_STATE,       EV_RESET_REQ,          nullptr,          drop_held_requests,        OFF},
+};
+// clang-format on
+
+static void sm_transition(StateType next, void (*action)()) {
+  StateType last_state = sm_state;
+
+  if (state_actions[last_state].exit) {
+    state_actions[last_state].exit();
+  }
+  if (action) {
+    action();
+  }
+  sm_state = next;
+  scheduler_cancel(TASK_SM_TIMER);
+  if (state_actions[next].entry) {
+    state_actions[next].entry();
   }
+
+#ifdef SERIAL_TEXT_OUTPUT
+  Serial.print("New state: ");
+  Serial.println(state_names[sm_state]);
+#else
+  telemetry_send_state_change(last_state, sm_state);
+#endif
+}
+
+static void sm_dispatch(EventType event) {
+  for (uint8_t i = 0; i < sizeof(transitions) / sizeof(transitions[0]); i++) {
+    const Transition& t = transitions[i];
+    if ((t.state != sm_state && t.state != ANY_STATE) || t.event != event) {
+      continue;
+    }
+    if (t.guard && !t.guard()) {
+      continue;
+    }
+    if (t.next == STAY) {
+      if (t.action) {
+        t.action();
+      }
+      return;
+    }
+    sm_transition((StateType)t.next, t.action);
+    return;
+  }
+}
+
+// Turn power-fail detections into events.
+static void sm_collect_events() {
+  uint16_t power_fail_v_in;
+  if (adc_power_fail_take(power_fail_time, power_fail_v_in)) {
+    // keep DEPLETING from acting on the pre-drop reading
+    v_in = power_fail_v_in;
+    sm_post_event(EV_POWER_FAIL);
+  }
+}
+
+void sm_init() {
+  scheduler_add(TASK_SM_TIMER, sm_timer_task);
+  scheduler_add(TASK_WATCHDOG, sm_watchdog_task);
+  sm_post_event(EV_START);
 }
 
 // function to run the state machine
 
 void sm_run() {
-  static StateType last_state = BEGIN;
-  // Reset request overrides the state machine
-  if (reset_requested) {
-    reset_requested = false;
-    sm_state = ENT_OFF;
-  }
-  if (last_state != sm_state) {
-    Serial.print("New state: ");
-    Serial.println(state_names[sm_state]);
-    last_state = sm_state;
-  }
-  if (sm_state < NUM_STATES) {
-    // call the function for the state
-    (*state_machine[sm_state])();
-  } else {
-    sm_state = BEGIN;  // FIXME: should we restart instead?
+  sm_collect_events();
+
+  EventType event;
+  while (sm_take_event(event)) {
+    sm_dispatch(event);
   }
 }
@@ -1,7 +1,13 @@
 #ifndef _state_machine_H_
 #define _state_machine_H_
 
+#include <stdint.h>
+
 // valid states for the power state machine
+//
+// The ENT_* values are no longer used as states: entering a state runs its
+// entry action within the transition. They are kept so that the state
+// numbers reported in I2C register 0x15 stay the same.
 
 typedef enum {
   BEGIN,
@@ -25,27 +31,51 @@ typedef enum {
   NUM_STATES
 } StateType;
 
-extern char *state_names[];
-
-void sm_state_BEGIN();
-void sm_state_WAIT_VIN_ON();
-void sm_state_ENT_CHARGING();
-void sm_state_CHARGING();
-void sm_state_ENT_ON();
-void sm_state_ON();
-void sm_state_ENT_DEPLETING();
-void sm_state_DEPLETING();
-void sm_state_ENT_SHUTDOWN();
-void sm_state_SHUTDOWN();
-void sm_state_ENT_WATCHDOG_REBOOT();
-void sm_state_WATCHDOG_REBOOT();
-void sm_state_ENT_OFF();
-void sm_state_OFF();
-void sm_state_ENT_SLEEP_SHUTDOWN();
-void sm_state_SLEEP_SHUTDOWN();
-void sm_state_ENT_SLEEP();
-void sm_state_SLEEP();
+// events driving the state machine
+
+typedef enum : uint8_t {
+  EV_START,               // firmware started
+  EV_SAMPLE,              // new ADC readings and input pin levels
+  EV_POWER_FAIL,          // V_IN window comparator tripped
+  EV_SHUTDOWN_REQ,        // shutdown requested over I2C or with the button
+  EV_SLEEP_REQ,           // sleep shutdown requested over I2C
+  EV_RESET_REQ,           // reset requested with the EXT and button inputs
+  EV_TIMEOUT,             // state timer expired
+  EV_WATCHDOG_TIMEOUT,    // host watchdog expired
+  EV_WATCHDOG_CHANGED,    // watchdog limit set over I2C
+  EV_VCAP_ALARM_CHANGED,  // supercap overvoltage alarm raised or cleared
+  NUM_EVENTS
+} EventType;
+
+extern const char* const state_names[];
+
+/**
+ * @brief Start the state machine.
+ */
+void sm_init();
+
+/**
+ * @brief Queue an event for the state machine.
+ *
+ * Must only be called from the main loop.
+ */
+void sm_post_event(EventType event);
+
+/**
+ * @brief Restart the host watchdog timer after a reset or limit change.
+ */
+void sm_restart_watchdog();
+
+/**
+ * @brief Check for a shutdown request not yet acted on.
+ *
+ * @return true if a shutdown request is queued or held until ON
+ */
+bool sm_shutdown_requested();
 
+/**
+ * @brief Collect pending events and run their transitions.
+ */
 void sm_run();
 
 StateType get_sm_state();
@@ -0,0 +1,319 @@
+#include "supercap_health.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "constants.h"
+#include "hal.h"
+#include "nvm_record.h"
+#include "scheduler.h"
+
+// Delay before retrying a save refused by the EEPROM writer, in ms
+#define HEALTH_RETRY_DELAY 1000
+// Number of ON samples kept for the load (power of two). The load is the
+// mean of the older half, so a sample that already caught the input
+// collapsing is not used.
+#define HEALTH_LOAD_SAMPLES 8
+// Number of samples averaged at each end of the discharge window
+#define HEALTH_END_SAMPLES 4
+
+// The Vcap words are in units of VCAP_MAX / 2^16 V and the Iin words in
+// units of IIN_MAX / 2^16 A, so an Iin word times ms is in units of
+// IIN_MAX / 2^16 mC. The charge integral is doubled by the trapezoidal
+// rule.
+constexpr uint32_t health_charge_units_per_mc =
+    uint32_t(2 * 65536 / IIN_MAX + 0.5);
+// C [mF] = Q [mC] * health_charge_k / (dV >> 4)
+constexpr uint32_t health_charge_k = uint32_t(4096 / VCAP_MAX + 0.5);
+// C [mF] = (P * dt >> 12) * health_discharge_k / (d(V^2) >> 12), with P
+// the product of the Vcap and Iin words >> 16, dt in ms and V^2 of the
+// 14-bit Vcap values
+constexpr uint32_t health_discharge_k =
+    uint32_t(2 * IIN_MAX * 256 * 16 / VCAP_MAX + 0.5);
+// ESR [mOhm] = dV * health_esr_k / Iin
+constexpr uint32_t health_esr_k = uint32_t(1000 * VCAP_MAX / IIN_MAX + 0.5);
+constexpr uint16_t health_min_current =
+    uint16_t(HEALTH_MIN_CURRENT / IIN_MAX * 65536);
+constexpr uint16_t health_min_charge_delta =
+    uint16_t(HEALTH_MIN_CHARGE_DELTA / VCAP_MAX * 65536);
+
+struct SupercapHealthRecord {
+  uint8_t version;
+  uint8_t sequence;
+  SupercapHealth health;
+  uint8_t reserved[6];
+  uint16_t crc;
+};
+
+static_assert(sizeof(SupercapHealthRecord) == SUPERCAP_HEALTH_SIZE,
+              "supercap health record must fill its slot");
+static_assert(offsetof(SupercapHealthRecord, sequence) == NVM_RECORD_SEQUENCE &&
+                  offsetof(SupercapHealthRecord, crc) ==
+                      SUPERCAP_HEALTH_SIZE - NVM_RECORD_CRC_SIZE,
+              "supercap health record must have the common record layout");
+static_assert(EEPROM_PAGE_SIZE % SUPERCAP_HEALTH_SIZE == 0 &&
+                  SUPERCAP_HEALTH_ADDR % SUPERCAP_HEALTH_SIZE == 0,
+              "supercap health records must not cross EEPROM pages");
+
+static SupercapHealthRecord health_record;
+// Copy (0 or 1) holding the saved estimates
+static uint8_t health_copy = 1;
+
+enum HealthPhase : uint8_t {
+  HEALTH_IDLE,
+  HEALTH_CHARGING,
+  HEALTH_ON,
+  HEALTH_DISCHARGING,
+};
+
+static HealthPhase health_phase = HEALTH_IDLE;
+static uint8_t health_samples = 0;
+static uint32_t health_start_time = 0;
+
+// CHARGING: the charge since the first sample
+static uint16_t health_v_first = 0;
+static uint16_t health_v_last = 0;
+static uint32_t health_previous_time = 0;
+static uint16_t health_previous_i = 0;
+static uint32_t health_charge_mc = 0;
+static uint32_t health_charge_rest = 0;
+
+// ON: the latest samples
+static uint16_t health_load_v[HEALTH_LOAD_SAMPLES];
+static uint16_t health_load_i[HEALTH_LOAD_SAMPLES];
+static uint8_t health_load_head = 0;
+static uint32_t health_last_time = 0;
+
+// The load when leaving ON, as sums of HEALTH_END_SAMPLES samples
+static bool health_load_valid = false;
+static uint32_t health_ref_v = 0;
+static uint32_t health_ref_i = 0;
+
+// DISCHARGING: sums of the samples at the start and at the end of the
+// window, with their times relative to the power failure
+static uint32_t health_a_v = 0;
+static uint32_t health_a_t = 0;
+static uint32_t health_b_v = 0;
+static uint32_t health_b_t = 0;
+static uint8_t health_b_samples = 0;
+
+static bool health_save() {
+  return nvm_record_save(SUPERCAP_HEALTH_ADDR, &health_record,
+                         sizeof(health_record), health_copy);
+}
+
+static uint16_t health_task() {
+  return health_save() ? SCHEDULER_STOP : HEALTH_RETRY_DELAY;
+}
+
+static void health_commit() {
+  if (health_save()) {
+    scheduler_cancel(TASK_SUPERCAP_HEALTH);
+  } else {
+    scheduler_schedule(TASK_SUPERCAP_HEALTH, HEALTH_RETRY_DELAY);
+  }
+}
+
+// Fold an estimate into a moving average
+static void health_merge(uint16_t& average, uint8_t& count,
+                         uint32_t estimate) {
+  if (estimate >= HEALTH_UNKNOWN) {
+    return;
+  }
+  uint16_t merged = estimate;
+  if (count != 0) {
+    merged = average +
+             ((int32_t)estimate - average) / (1 << HEALTH_SMOOTHING_SHIFT);
+  }
+  // the TWI interrupt reads the estimates (registers 0x2B-0x2D)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    average = merged;
+    if (count < 0xff) {
+      count++;
+    }
+  }
+}
+
+void supercap_health_load() {
+  scheduler_add(TASK_SUPERCAP_HEALTH, health_task);
+
+  SupercapHealthRecord record;
+  if (!nvm_record_load(SUPERCAP_HEALTH_ADDR, &record, sizeof(record),
+                       SUPERCAP_HEALTH_VERSION, health_copy)) {
+    memset(&record, 0, sizeof(record));
+    record.version = SUPERCAP_HEALTH_VERSION;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { health_record = record; }
+}
+
+void supercap_health_record(uint16_t v_cap, uint16_t i_in, uint32_t now) {
+  switch (health_phase) {
+    case HEALTH_CHARGING:
+      if (health_samples == 0) {
+        health_v_first = v_cap;
+        health_charge_mc = 0;
+        health_charge_rest = 0;
+        health_samples = 1;
+      } else {
+        health_charge_rest +=
+            ((uint32_t)health_previous_i + i_in) * (now - health_previous_time);
+        health_charge_mc += health_charge_rest / health_charge_units_per_mc;
+        health_charge_rest %= health_charge_units_per_mc;
+      }
+      health_v_last = v_cap;
+      health_previous_time = now;
+      health_previous_i = i_in;
+      break;
+
+    case HEALTH_ON:
+      if (health_samples == 0) {
+        health_start_time = now;
+      }
+      if (health_samples < HEALTH_LOAD_SAMPLES) {
+        health_samples++;
+      }
+      health_load_v[health_load_head] = v_cap;
+      health_load_i[health_load_head] = i_in;
+      health_load_head = (health_load_head + 1) & (HEALTH_LOAD_SAMPLES - 1);
+      health_last_time = now;
+      break;
+
+    case HEALTH_DISCHARGING: {
+      uint32_t t = now - health_start_time;
+      if (health_samples < HEALTH_END_SAMPLES) {
+        health_a_v += v_cap;
+        health_a_t += t;
+        health_samples++;
+        break;
+      }
+      if (t < HEALTH_DISCHARGE_WINDOW) {
+        break;
+      }
+      health_b_v += v_cap;
+      health_b_t += t;
+      if (++health_b_samples < HEALTH_END_SAMPLES) {
+        break;
+      }
+      health_phase = HEALTH_IDLE;
+
+      // The step at the power failure, with the discharge until the first
+      // samples extrapolated back
+      int32_t fall = (int32_t)health_a_v - (int32_t)health_b_v;
+      int32_t v_after =
+          health_a_v + fall * (int32_t)health_a_t /
+                           (int32_t)(health_b_t - health_a_t);
+      int32_t step = (int32_t)health_ref_v - v_after;
+      if (step >= 0) {
+        health_merge(health_record.health.esr, health_record.health.esr_count,
+                     (step * health_esr_k + health_ref_i / 2) / health_ref_i);
+      }
+
+      // the sums of four 16-bit words are 18-bit values
+      uint32_t v_a = health_a_v >> 4;
+      uint32_t v_b = health_b_v >> 4;
+      if (v_b < v_a) {
+        uint32_t power = (health_ref_v / HEALTH_END_SAMPLES) *
+                             (health_ref_i / HEALTH_END_SAMPLES) >>
+                         16;
+        uint32_t dt = (health_b_t - health_a_t) / HEALTH_END_SAMPLES;
+        uint32_t dv2 = (v_a * v_a - v_b * v_b) >> 12;
+        if (dv2 != 0) {
+          health_merge(health_record.health.capacitance,
+                       health_record.health.capacitance_count,
+                       (power * dt >> 12) * health_discharge_k / dv2);
+        }
+      }
+      health_commit();
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void supercap_health_charging_start() {
+  health_phase = HEALTH_CHARGING;
+  health_samples = 0;
+}
+
+void supercap_health_charging_stop() {
+  if (health_phase != HEALTH_CHARGING) {
+    return;
+  }
+  health_phase = HEALTH_IDLE;
+  if (health_samples == 0 || health_v_last < health_v_first ||
+      health_v_last - health_v_first < health_min_charge_delta) {
+    return;
+  }
+  uint16_t dv = (health_v_last - health_v_first) >> 4;
+  health_merge(health_record.health.capacitance,
+               health_record.health.capacitance_count,
+               health_charge_mc * health_charge_k / dv);
+  health_commit();
+}
+
+void supercap_health_on_start() {
+  health_phase = HEALTH_ON;
+  health_samples = 0;
+}
+
+void supercap_health_on_stop() {
+  health_load_valid = false;
+  if (health_phase != HEALTH_ON) {
+    return;
+  }
+  health_phase = HEALTH_IDLE;
+  if (health_samples < HEALTH_LOAD_SAMPLES ||
+      health_last_time - health_start_time < HEALTH_SETTLE_TIME) {
+    return;
+  }
+  // the oldest samples in the ring start at the head
+  health_ref_v = 0;
+  health_ref_i = 0;
+  for (uint8_t k = 0; k < HEALTH_END_SAMPLES; k++) {
+    uint8_t index = (health_load_head + k) & (HEALTH_LOAD_SAMPLES - 1);
+    health_ref_v += health_load_v[index];
+    health_ref_i += health_load_i[index];
+  }
+  health_load_valid =
+      health_ref_i >= (uint32_t)health_min_current * HEALTH_END_SAMPLES;
+}
+
+void supercap_health_discharge_start() {
+  if (!health_load_valid) {
+    return;
+  }
+  health_load_valid = false;
+  health_phase = HEALTH_DISCHARGING;
+  health_samples = 0;
+  health_start_time = millis();
+  health_a_v = 0;
+  health_a_t = 0;
+  health_b_v = 0;
+  health_b_t = 0;
+  health_b_samples = 0;
+}
+
+void supercap_health_discharge_stop() {
+  if (health_phase == HEALTH_DISCHARGING) {
+    health_phase = HEALTH_IDLE;
+  }
+}
+
+void supercap_health_get(SupercapHealth& health) {
+  health = health_record.health;
+  if (health.capacitance_count == 0) {
+    health.capacitance = HEALTH_UNKNOWN;
+  }
+  if (health.esr_count == 0) {
+    health.esr = HEALTH_UNKNOWN;
+  }
+}
+
+void supercap_health_reset() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memset(&health_record.health, 0, sizeof(health_record.health));
+  }
+  health_commit();
+}
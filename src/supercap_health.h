@@ -0,0 +1,115 @@
+#ifndef SH_RPI_FIRMWARE_SRC_SUPERCAP_HEALTH_H_
+#define SH_RPI_FIRMWARE_SRC_SUPERCAP_HEALTH_H_
+
+#include <stdint.h>
+
+#include "shutdown_stats.h"
+
+//////
+// Supercap health estimation
+//
+// The capacitance and the equivalent series resistance (ESR) of the
+// supercap are estimated from the charge and discharge curves, using the
+// DC IN current as the supercap current:
+//
+// - While CHARGING, the 5V output is off and all of the input current
+//   charges the supercap, so C = integral(Iin dt) / dV.
+// - On a power failure, the host load moves from DC IN to the supercap.
+//   The load is taken from the Vcap * Iin power drawn while ON, which
+//   requires the supercap to have been ON long enough to be fully charged.
+//   The supercap voltage steps down by Iload * ESR and then falls with
+//   Vcap^2 decreasing by 2 P / C per second. Both are measured over the
+//   first HEALTH_DISCHARGE_WINDOW ms of DEPLETING, before the host starts
+//   shutting down and changes the load.
+//
+// Conversion losses between DC IN and the supercap are not accounted for,
+// so the estimates are best used to follow the ageing of a bank relative
+// to its earlier values.
+//
+// Each estimate is merged into an exponential moving average that is kept
+// in the EEPROM in two alternately written copies, each with a sequence
+// number and a CRC (see nvm_record.h).
+
+// Time in ms that the supercap must have been ON before a power failure
+// is used for the estimates
+#define HEALTH_SETTLE_TIME 60000
+// Length of the measured discharge in ms
+#define HEALTH_DISCHARGE_WINDOW 2000
+// Minimum load current in A for the discharge estimates
+#define HEALTH_MIN_CURRENT 0.2
+// Minimum voltage rise in V for a charging estimate
+#define HEALTH_MIN_CHARGE_DELTA 1.0
+// Weight of a new estimate in the averages, as a right shift
+#define HEALTH_SMOOTHING_SHIFT 2
+
+#define SUPERCAP_HEALTH_VERSION 1
+#define SUPERCAP_HEALTH_SIZE 16
+// EEPROM address of the first copy, just below the shutdown durations
+#define SUPERCAP_HEALTH_ADDR (SHUTDOWN_STATS_ADDR - 2 * SUPERCAP_HEALTH_SIZE)
+
+// Value of an estimate that has not been measured yet
+#define HEALTH_UNKNOWN 0xffff
+
+struct SupercapHealth {
+  uint16_t capacitance;       //!< Capacitance in mF
+  uint16_t esr;               //!< ESR in mOhm
+  uint8_t capacitance_count;  //!< Number of capacitance estimates, saturated
+  uint8_t esr_count;          //!< Number of ESR estimates, saturated
+};
+
+/**
+ * @brief Read the estimates from the EEPROM.
+ */
+void supercap_health_load();
+
+/**
+ * @brief Add a sample to the running measurement.
+ *
+ * @param v_cap Supercap voltage, left-aligned 16-bit ADC value
+ * @param i_in DC IN current, left-aligned 16-bit ADC value
+ * @param now Sample time in ms
+ */
+void supercap_health_record(uint16_t v_cap, uint16_t i_in, uint32_t now);
+
+/**
+ * @brief Start measuring the charge. Called on entering CHARGING.
+ */
+void supercap_health_charging_start();
+
+/**
+ * @brief Estimate the capacitance from the charge. Called on leaving
+ * CHARGING.
+ */
+void supercap_health_charging_stop();
+
+/**
+ * @brief Start following the load. Called on entering ON.
+ */
+void supercap_health_on_start();
+
+/**
+ * @brief Take the load from the latest samples. Called on leaving ON.
+ */
+void supercap_health_on_stop();
+
+/**
+ * @brief Start measuring the discharge. Called on entering DEPLETING.
+ */
+void supercap_health_discharge_start();
+
+/**
+ * @brief Abandon an incomplete discharge. Called on leaving DEPLETING.
+ */
+void supercap_health_discharge_stop();
+
+/**
+ * @brief Read the averaged estimates. Unmeasured values are HEALTH_UNKNOWN.
+ */
+void supercap_health_get(SupercapHealth& health);
+
+/**
+ * @brief Forget the estimates, e.g. after replacing the supercap.
+ */
+void supercap_health_reset();
+
+#endif  // SH_RPI_FIRMWARE_SRC_SUPERCAP_HEALTH_H_
@@ -0,0 +1,97 @@
+#include "telemetry.h"
+
+#include "crc16.h"
+#include "digital_io.h"
+#include "globals.h"
+#include "hal.h"
+#include "state_machine.h"
+
+static uint8_t telemetry_sequence = 0;
+static uint16_t telemetry_dropped = 0;
+
+size_t telemetry_cobs_encode(const uint8_t* src, size_t length, uint8_t* dst) {
+  size_t code_index = 0;
+  size_t out = 1;
+  uint8_t code = 1;
+
+  for (size_t i = 0; i < length; i++) {
+    if (src[i] == 0) {
+      dst[code_index] = code;
+      code_index = out++;
+      code = 1;
+      continue;
+    }
+    dst[out++] = src[i];
+    if (++code == 0xff) {
+      dst[code_index] = code;
+      code_index = out++;
+      code = 1;
+    }
+  }
+  dst[code_index] = code;
+  return out;
+}
+
+bool telemetry_send(uint8_t type, uint8_t* payload, uint8_t length) {
+  // type + payload + CRC
+  uint8_t raw[1 + TELEMETRY_MAX_PAYLOAD + 2];
+  // COBS overhead + delimiter
+  uint8_t frame[sizeof(raw) + 2];
+
+  raw[0] = type;
+  memcpy(&raw[1], payload, length);
+  uint16_t crc = crc16(raw, length + 1);
+  raw[length + 1] = crc >> 8;
+  raw[length + 2] = crc & 0xff;
+
+  size_t frame_length = telemetry_cobs_encode(raw, length + 3, frame);
+  frame[frame_length++] = 0;
+
+  // never wait for the TX buffer to drain
+  if (Serial.availableForWrite() < (int)frame_length) {
+    if (telemetry_dropped != 0xffff) {
+      telemetry_dropped++;
+    }
+    return false;
+  }
+  Serial.write(frame, frame_length);
+  return true;
+}
+
+void telemetry_send_status() {
+  uint8_t payload[TELEMETRY_STATUS_SIZE];
+
+  uint8_t pins = 0;
+  if (read_pin(RTC_INT_PIN)) {
+    pins |= 0x01;
+  }
+  if (read_pin(EXT_INT_PIN)) {
+    pins |= 0x02;
+  }
+  if (read_pin(POWER_TOGGLE_PIN)) {
+    pins |= 0x04;
+  }
+
+  payload[0] = telemetry_sequence++;
+  payload[1] = get_sm_state();
+  payload[2] = v_in_word >> 8;
+  payload[3] = v_in_word & 0xff;
+  payload[4] = v_supercap_word >> 8;
+  payload[5] = v_supercap_word & 0xff;
+  payload[6] = i_in_word >> 8;
+  payload[7] = i_in_word & 0xff;
+  payload[8] = temperature_K >> 8;
+  payload[9] = temperature_K & 0xff;
+  payload[10] = i2c_register;
+  payload[11] = pins;
+  payload[12] = telemetry_dropped >> 8;
+  payload[13] = telemetry_dropped & 0xff;
+
+  telemetry_send(TELEMETRY_FRAME_STATUS, payload, TELEMETRY_STATUS_SIZE);
+}
+
+void telemetry_send_state_change(uint8_t old_state, uint8_t new_state) {
+  uint8_t payload[TELEMETRY_STATE_SIZE] = {telemetry_sequence++, old_state,
+                                           new_state};
+  telemetry_send(TELEMETRY_FRAME_STATE, payload, TELEMETRY_STATE_SIZE);
+}
@@ -0,0 +1,77 @@
+#ifndef SH_RPI_FIRMWARE_SRC_TELEMETRY_H_
+#define SH_RPI_FIRMWARE_SRC_TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//////
+// Binary serial telemetry
+//
+// Frames are written to the serial port as
+//
+//   COBS(type, payload..., CRC-16 high byte, CRC-16 low byte) 0x00
+//
+// The CRC is CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+// over the type and payload bytes. COBS encoding removes all zero bytes,
+// so the 0x00 delimiter marks the end of each frame and a receiver can
+// resynchronize at any point. Multi-byte payload values are big-endian.
+//
+// Frames are only queued if the serial TX buffer has room for the whole
+// frame. Otherwise the frame is dropped and counted, so the main loop never
+// blocks on the serial port. telemetry_decoder.py decodes the stream.
+
+// Status frame, sent periodically
+//
+// Offset  Size  Content
+//   0      1    Frame sequence number
+//   1      1    State machine state
+//   2      2    DC IN voltage (as I2C register 0x20)
+//   4      2    Supercap voltage (as I2C register 0x21)
+//   6      2    DC IN current (as I2C register 0x22)
+//   8      2    MCU temperature (as I2C register 0x23)
+//  10      1    Last selected I2C register
+//  11      1    Input pins: bit 0 = RTC, bit 1 = EXT, bit 2 = PWR
+//  12      2    Number of frames dropped so far
+#define TELEMETRY_FRAME_STATUS 0x01
+#define TELEMETRY_STATUS_SIZE 14
+
+// State change frame, sent on every state machine transition
+//
+// Offset  Size  Content
+//   0      1    Frame sequence number
+//   1      1    Previous state
+//   2      1    New state
+#define TELEMETRY_FRAME_STATE 0x02
+#define TELEMETRY_STATE_SIZE 3
+
+// Maximum payload size of any frame
+#define TELEMETRY_MAX_PAYLOAD 14
+
+/**
+ * @brief COBS-encode a buffer.
+ *
+ * The output buffer must have room for length + length / 254 + 1 bytes.
+ * No delimiter is appended.
+ *
+ * @return Number of bytes written to dst
+ */
+size_t telemetry_cobs_encode(const uint8_t* src, size_t length, uint8_t* dst);
+
+/**
+ * @brief Send a frame if it fits in the serial TX buffer.
+ *
+ * @return false if the frame was dropped
+ */
+bool telemetry_send(uint8_t type, uint8_t* payload, uint8_t length);
+
+/**
+ * @brief Send a status frame with the current readings.
+ */
+void telemetry_send_status();
+
+/**
+ * @brief Send a state change frame.
+ */
+void telemetry_send_state_change(uint8_t old_state, uint8_t new_state);
+
+#endif  // SH_RPI_FIRMWARE_SRC_TELEMETRY_H_
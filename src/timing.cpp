@@ -0,0 +1,81 @@
+#include "timing.h"
+
+#include "hal.h"
+
+static TimingStats timing_stats[NUM_TIMING_SECTIONS];
+
+// upper 16 bits of the timer count
+static volatile uint16_t timing_overflows = 0;
+
+ISR(TCB1_INT_vect) {
+  TCB1.INTFLAGS = TCB_CAPT_bm;
+  timing_overflows++;
+}
+
+void timing_init() {
+  timing_reset();
+  TCB1.CCMP = 0xffff;
+  TCB1.CNT = 0;
+  TCB1.CTRLB = TCB_CNTMODE_INT_gc;
+  TCB1.INTCTRL = TCB_CAPT_bm;
+  TCB1.CTRLA = TCB_CLKSEL_CLKDIV2_gc | TCB_ENABLE_bm;
+}
+
+uint32_t timing_now() {
+  uint16_t high;
+  uint16_t low;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    high = timing_overflows;
+    low = TCB1.CNT;
+    // account for an overflow that has not been serviced yet
+    if ((TCB1.INTFLAGS & TCB_CAPT_bm) && low < 0x8000) {
+      high++;
+    }
+  }
+  return ((uint32_t)high << 16) | low;
+}
+
+void timing_record(TimingSection section, uint32_t start) {
+  uint32_t duration = timing_now() - start;
+  TimingStats& stats = timing_stats[section];
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (duration < stats.min) {
+      stats.min = duration;
+    }
+    if (duration > stats.max) {
+      stats.max = duration;
+    }
+
+    // halve the running sums instead of letting them overflow; the mean
+    // is preserved
+    if (stats.count == 0xffff || stats.sum > 0xffffffff - duration) {
+      stats.count >>= 1;
+      stats.sum >>= 1;
+    }
+    stats.count++;
+    stats.sum += duration;
+
+    uint8_t bin = 0;
+    for (uint32_t v = duration >> 7; v && bin < TIMING_HISTOGRAM_BINS - 1;
+         v >>= 1) {
+      bin++;
+    }
+    if (stats.histogram[bin] != 0xffff) {
+      stats.histogram[bin]++;
+    }
+  }
+}
+
+void timing_get_stats(TimingSection section, TimingStats& stats) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { stats = timing_stats[section]; }
+}
+
+void timing_reset() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < NUM_TIMING_SECTIONS; i++) {
+      timing_stats[i] = TimingStats();
+      timing_stats[i].min = 0xffffffff;
+    }
+  }
+}
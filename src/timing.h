@@ -0,0 +1,69 @@
+#ifndef SH_RPI_FIRMWARE_SRC_TIMING_H_
+#define SH_RPI_FIRMWARE_SRC_TIMING_H_
+
+#include <stdint.h>
+
+//////
+// Execution time instrumentation
+//
+// TCB1 runs freely at CLK_PER / 2 (0.1 us per tick at 20 MHz) and its
+// overflow interrupt extends the count to 32 bits. Code sections are
+// bracketed with timing_now() and timing_record(). For each section, the
+// minimum, maximum and mean duration and a log2 histogram are kept.
+//
+// Histogram bin i counts durations shorter than 2^(i + 7) ticks
+// (12.8 us * 2^i); the last bin counts everything longer.
+
+// Timer ticks per microsecond
+#define TIMING_TICKS_PER_US (F_CPU / 2000000)
+
+#define TIMING_HISTOGRAM_BINS 8
+
+enum TimingSection {
+  TIMING_LOOP,        //!< One loop() iteration
+  TIMING_ADC,         //!< Processing of a completed ADC sweep
+  TIMING_SM,          //!< sm_run()
+  TIMING_TWI,         //!< I2C receive and request handlers
+  TIMING_POWER_FAIL,  //!< V_IN drop detection to ENT_DEPLETING
+  NUM_TIMING_SECTIONS
+};
+
+struct TimingStats {
+  uint32_t min;    //!< Shortest duration in ticks
+  uint32_t max;    //!< Longest duration in ticks
+  uint32_t sum;    //!< Sum of durations, for the mean
+  uint16_t count;  //!< Number of durations included in sum
+  uint16_t histogram[TIMING_HISTOGRAM_BINS];  //!< Saturating bin counts
+};
+
+/**
+ * @brief Start the instrumentation timer.
+ */
+void timing_init();
+
+/**
+ * @brief Current timer value in ticks.
+ */
+uint32_t timing_now();
+
+/**
+ * @brief Record the duration of a section.
+ *
+ * @param section Section that was measured
+ * @param start Value of timing_now() at the start of the section
+ */
+void timing_record(TimingSection section, uint32_t start);
+
+/**
+ * @brief Copy the statistics of a section.
+ *
+ * Safe to call while the section is being recorded in an interrupt.
+ */
+void timing_get_stats(TimingSection section, TimingStats& stats);
+
+/**
+ * @brief Clear the statistics of all sections.
+ */
+void timing_reset();
+
+#endif  // SH_RPI_FIRMWARE_SRC_TIMING_H_
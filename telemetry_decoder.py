@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# Decode the binary telemetry frames sent on the serial port.
+#
+# Usage: telemetry_decoder.py /dev/ttyUSB0 [baud]
+#        telemetry_decoder.py capture.bin
+#
+# See src/telemetry.h for the frame format.
+
+import struct
+import sys
+
+STATE_NAMES = [
+    'BEGIN', 'WAIT_VIN_ON', 'ENT_CHARGING', 'CHARGING', 'ENT_ON', 'ON',
+    'ENT_DEPLETING', 'DEPLETING', 'ENT_SHUTDOWN', 'SHUTDOWN',
+    'ENT_WATCHDOG_REBOOT', 'WATCHDOG_REBOOT', 'ENT_OFF', 'OFF',
+    'ENT_SLEEP_SHUTDOWN', 'SLEEP_SHUTDOWN', 'ENT_SLEEP', 'SLEEP',
+]
+
+# Full scale values of the 16-bit left-aligned readings
+VIN_MAX = 32.1
+VCAP_MAX = 9.35
+I_IN_MAX = 2.5
+
+FRAME_STATUS = 0x01
+FRAME_STATE = 0x02
+
+
+def crc16(data, crc=0xffff):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xffff
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            raise ValueError('invalid COBS data')
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def state_name(state):
+    if state < len(STATE_NAMES):
+        return STATE_NAMES[state]
+    return 'UNKNOWN(%d)' % state
+
+
+def decode_frame(frame):
+    data = cobs_decode(frame)
+    if len(data) < 3:
+        raise ValueError('short frame')
+    body, crc = data[:-2], struct.unpack('>H', data[-2:])[0]
+    if crc16(body) != crc:
+        raise ValueError('CRC mismatch')
+    frame_type, payload = body[0], body[1:]
+
+    if frame_type == FRAME_STATUS and len(payload) == 14:
+        seq, state, vin, vcap, iin, temp, reg, pins, dropped = struct.unpack(
+            '>BBHHHHBBH', payload)
+        return ('#%3d %-20s Vin %5.2f V, Vcap %4.2f V, Iin %4.2f A, '
+                'temp %5.1f C, i2c 0x%02x, RTC %d, EXT %d, PWR %d, '
+                'dropped %d' % (
+                    seq, state_name(state), vin * VIN_MAX / 65536,
+                    vcap * VCAP_MAX / 65536, iin * I_IN_MAX / 65536,
+                    temp - 273.15, reg, pins & 1, (pins >> 1) & 1,
+                    (pins >> 2) & 1, dropped))
+    if frame_type == FRAME_STATE and len(payload) == 3:
+        seq, old, new = struct.unpack('>BBB', payload)
+        return '#%3d New state: %s -> %s' % (seq, state_name(old),
+                                             state_name(new))
+    return 'unknown frame type 0x%02x: %s' % (frame_type, payload.hex())
+
+
+def frames(stream):
+    buf = bytearray()
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            return
+        if chunk[0] == 0:
+            if buf:
+                yield bytes(buf)
+            buf = bytearray()
+        else:
+            buf += chunk
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('usage: %s PORT|FILE [baud]' % sys.argv[0])
+        return 1
+    path = sys.argv[1]
+    if path.startswith('/dev/'):
+        import serial
+        baud = int(sys.argv[2]) if len(sys.argv) > 2 else 115200
+        stream = serial.Serial(path, baud)
+    else:
+        stream = open(path, 'rb')
+
+    for frame in frames(stream):
+        try:
+            print(decode_frame(frame))
+        except ValueError as e:
+            print('bad frame (%s): %s' % (e, frame.hex()))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,153 @@
+// Interrupt-driven ADC sampler against a mocked ADC: the test plays the
+// peripheral, completing each conversion the sampler starts and running the
+// RESRDY handler, so the channel rotation and the result slots can be
+// checked one conversion at a time.
+
+#include <unity.h>
+
+#include "analog_io.h"
+#include "constants.h"
+#include "hal.h"
+
+extern "C" void ADC0_RESRDY_vect();
+extern "C" void ADC1_RESRDY_vect();
+
+// Result of the throwaway settling conversions, never to be stored
+static const uint16_t SETTLING_READING = 0x3ff;
+
+// 10-bit reading of each channel, distinct so that a misplaced result
+// is caught
+static uint16_t channel_reading(uint8_t channel) { return 100 + 200 * channel; }
+
+static ADC_t& adc_peripheral(uint8_t adc_num) {
+  return adc_num == 0 ? ADC0 : ADC1;
+}
+
+// Complete the conversion in progress on an ADC with the given 10-bit
+// reading, accumulated over the number of samples set in SAMPNUM
+static void complete_conversion(uint8_t adc_num, uint16_t reading) {
+  ADC_t& adc = adc_peripheral(adc_num);
+  TEST_ASSERT_TRUE_MESSAGE(adc.COMMAND & ADC_STCONV_bm, "conversion started");
+  adc.COMMAND = 0;
+  adc.RES = reading << (adc.CTRLB & 0x07);
+  adc.INTFLAGS |= ADC_RESRDY_bm;
+  if (adc_num == 0) {
+    ADC0_RESRDY_vect();
+  } else {
+    ADC1_RESRDY_vect();
+  }
+}
+
+// Next channel of the table converted on an ADC after `channel`
+static uint8_t next_channel(uint8_t adc_num, int channel) {
+  for (int i = channel + 1; i < NUM_ADC_CHANNELS; i++) {
+    if (adc_channels[i].adc_num == adc_num) {
+      return i;
+    }
+  }
+  return NUM_ADC_CHANNELS;
+}
+
+// Check the settling and the measuring conversion of a channel
+static void convert_channel(uint8_t adc_num, uint8_t channel,
+                            uint8_t log2_samples) {
+  ADC_t& adc = adc_peripheral(adc_num);
+  TEST_ASSERT_EQUAL_HEX8(adc_channels[channel].ain, adc.MUXPOS);
+  TEST_ASSERT_EQUAL_MESSAGE(ADC_SAMPNUM_ACC1_gc, adc.CTRLB,
+                            "settling conversion is a single sample");
+  complete_conversion(adc_num, SETTLING_READING);
+
+  TEST_ASSERT_EQUAL_HEX8(adc_channels[channel].ain, adc.MUXPOS);
+  TEST_ASSERT_EQUAL(adc_channels[channel].oversample ? log2_samples : 0,
+                    adc.CTRLB);
+  complete_conversion(adc_num, channel_reading(channel));
+}
+
+// Run a full sweep, alternating between the two ADCs to show that they
+// step through their channels independently, and check the result slots
+static void check_sweep(uint8_t log2_samples) {
+  adc_sampler_set_oversampling(log2_samples);
+  TEST_ASSERT_TRUE(adc_sampler_start());
+  TEST_ASSERT_FALSE_MESSAGE(adc_sampler_start(), "sweep still running");
+
+  uint8_t channel[2] = {next_channel(0, -1), next_channel(1, -1)};
+  while (channel[0] < NUM_ADC_CHANNELS || channel[1] < NUM_ADC_CHANNELS) {
+    for (uint8_t adc_num = 0; adc_num < 2; adc_num++) {
+      if (channel[adc_num] == NUM_ADC_CHANNELS) {
+        continue;
+      }
+      uint16_t results[NUM_ADC_CHANNELS];
+      TEST_ASSERT_FALSE_MESSAGE(adc_sampler_read(results),
+                                "no results before the sweep completes");
+      convert_channel(adc_num, channel[adc_num], log2_samples);
+      channel[adc_num] = next_channel(adc_num, channel[adc_num]);
+    }
+  }
+  TEST_ASSERT_FALSE_MESSAGE((ADC0.COMMAND | ADC1.COMMAND) & ADC_STCONV_bm,
+                            "ADCs idle after the sweep");
+
+  uint16_t results[NUM_ADC_CHANNELS];
+  TEST_ASSERT_TRUE(adc_sampler_read(results));
+  for (uint8_t i = 0; i < NUM_ADC_CHANNELS; i++) {
+    uint16_t reading = channel_reading(i);
+    uint16_t expected =
+        adc_channels[i].oversample
+            ? adc_decimate(reading << log2_samples, log2_samples)
+            : reading;
+    TEST_ASSERT_EQUAL_UINT16(expected, results[i]);
+  }
+  TEST_ASSERT_FALSE_MESSAGE(adc_sampler_read(results),
+                            "results returned only once");
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_decimation() {
+  for (uint8_t log2_samples = 0; log2_samples <= ADC_MAX_OVERSAMPLE_LOG2;
+       log2_samples++) {
+    uint8_t extra_bits = log2_samples / 2;
+    // weight of the least significant bit in the left-aligned result
+    uint16_t lsb = 1 << (6 - extra_bits);
+
+    // the same full-scale range for every setting, without overflow
+    TEST_ASSERT_EQUAL_HEX16(0, adc_decimate(0, log2_samples));
+    TEST_ASSERT_EQUAL_HEX16(1023 << 6, adc_decimate(1023 << log2_samples,
+                                                   log2_samples));
+
+    for (uint32_t sum = 0; sum <= (1023u << log2_samples); sum += 7) {
+      // the sum scaled down to 10 + extra_bits bits, left-aligned
+      uint16_t expected = (sum >> (log2_samples - extra_bits)) * lsb;
+      TEST_ASSERT_EQUAL_HEX16(expected, adc_decimate(sum, log2_samples));
+    }
+
+    // an average between two readings resolves the extra bits
+    uint16_t reading = 500;
+    uint16_t step = 1 << (log2_samples - extra_bits);
+    TEST_ASSERT_EQUAL_HEX16(
+        adc_decimate(reading << log2_samples, log2_samples) + lsb,
+        adc_decimate((reading << log2_samples) + step, log2_samples));
+  }
+}
+
+void test_sweep_with_oversampling() {
+  adc_sampler_init();
+  check_sweep(ADC_OVERSAMPLE_LOG2);
+}
+
+void test_sweep_without_oversampling() { check_sweep(0); }
+
+void test_oversampling_clamped() {
+  adc_sampler_set_oversampling(ADC_MAX_OVERSAMPLE_LOG2 + 1);
+  TEST_ASSERT_EQUAL(ADC_MAX_OVERSAMPLE_LOG2, adc_sampler_get_oversampling());
+  check_sweep(ADC_MAX_OVERSAMPLE_LOG2);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_decimation);
+  RUN_TEST(test_sweep_with_oversampling);
+  RUN_TEST(test_sweep_without_oversampling);
+  RUN_TEST(test_oversampling_clamped);
+  return UNITY_END();
+}
@@ -0,0 +1,156 @@
+// Host command queue: a two-thread stress test of the queue, and command
+// ordering, deferral and overflow accounting through the I2C interface.
+// Also the shutdown requests made before the host is powered, and the
+// reset requested with EXT_INT.
+
+#include <unity.h>
+
+#include <thread>
+
+#include "commands.h"
+#include "globals.h"
+#include "hal.h"
+#include "native_sim.h"
+#include "scheduler.h"
+#include "state_machine.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Producer and consumer on separate threads, standing in for the TWI
+// interrupt and the main loop.
+void test_queue_stress() {
+  const uint32_t count = 1000000;
+  SpscQueue<Command, COMMAND_QUEUE_LENGTH> queue;
+
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < count; i++) {
+      Command command{(CommandType)(i % NUM_COMMANDS), (uint16_t)i};
+      while (!queue.push(command)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t errors = 0;
+  for (uint32_t i = 0; i < count;) {
+    Command command;
+    if (!queue.pop(command)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (command.type != i % NUM_COMMANDS || command.value != (uint16_t)i) {
+      errors++;
+    }
+    i++;
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL(0, errors);
+  TEST_ASSERT_EQUAL(0, queue.size());
+}
+
+void test_shutdown_held_while_charging() {
+  sim_idle_pins();
+  native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN, sim_vcap_counts(3.0));
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(12.0));
+  setup();
+  sim_step(100);
+  TEST_ASSERT_EQUAL(CHARGING, get_sm_state());
+
+  uint8_t shutdown[] = {0x30, 1};
+  native_i2c_write(shutdown, 2);
+  sim_step(100);
+  TEST_ASSERT_EQUAL(CHARGING, get_sm_state());
+
+  native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN, sim_vcap_counts(8.5));
+  for (int i = 0; i < 100 && get_sm_state() == CHARGING; i++) {
+    sim_step(10);
+  }
+  sim_step(10);
+  TEST_ASSERT_EQUAL_MESSAGE(SHUTDOWN, get_sm_state(),
+                            "request carried out once ON");
+
+  // the host powers off and comes back for the tests that follow
+  native_set_pin(GPIO_POWEROFF_PIN, false);
+  for (int i = 0; i < 300 && get_sm_state() == SHUTDOWN; i++) {
+    sim_step(10);
+  }
+  TEST_ASSERT_TRUE(sim_power_restart());
+}
+
+void test_back_to_back_writes() {
+  TEST_ASSERT_TRUE(sim_power_up());
+
+  // back-to-back writes arriving before the main loop runs
+  uint8_t brightness_10[] = {0x17, 10};
+  uint8_t brightness_20[] = {0x17, 20};
+  uint8_t shutdown[] = {0x30, 1};
+  uint32_t eeprom_writes = native_eeprom_writes;
+  native_i2c_write(brightness_10, 2);
+  native_i2c_write(brightness_20, 2);
+  native_i2c_write(shutdown, 2);
+  TEST_ASSERT_EQUAL(3, command_queue.size());
+  loop();
+  TEST_ASSERT_EQUAL_MESSAGE(20, led_global_brightness,
+                            "writes applied in order");
+  TEST_ASSERT_EQUAL_MESSAGE(eeprom_writes, native_eeprom_writes,
+                            "EEPROM commit deferred");
+  TEST_ASSERT_TRUE(scheduler_is_scheduled(TASK_CONFIG_COMMIT));
+  TEST_ASSERT_EQUAL(SHUTDOWN, get_sm_state());
+}
+
+void test_overflows_counted() {
+  uint8_t brightness_10[] = {0x17, 10};
+  for (int i = 0; i < COMMAND_QUEUE_LENGTH + 2; i++) {
+    native_i2c_write(brightness_10, 2);
+  }
+  loop();
+  uint8_t overflows[NUM_COMMANDS];
+  native_i2c_read(0x28, overflows, NUM_COMMANDS);
+  TEST_ASSERT_EQUAL(2, overflows[CMD_SET_LED_BRIGHTNESS]);
+  TEST_ASSERT_EQUAL(0, overflows[CMD_SHUTDOWN]);
+}
+
+// Posted directly, without the I2C write that also resets the watchdog
+void test_watchdog_limit_restarts_watchdog() {
+  command_post(CMD_SET_WATCHDOG, 50);
+  commands_process();
+  TEST_ASSERT_EQUAL(50, watchdog_limit);
+  TEST_ASSERT_TRUE(scheduler_is_scheduled(TASK_WATCHDOG));
+
+  command_post(CMD_SET_WATCHDOG, 0);
+  commands_process();
+  TEST_ASSERT_FALSE(scheduler_is_scheduled(TASK_WATCHDOG));
+}
+
+// EXT_INT held low while the host requests a shutdown resets, as with the
+// power button
+void test_ext_and_host_shutdown_reset() {
+  // the host of the tests before powers off and comes back
+  native_set_pin(GPIO_POWEROFF_PIN, false);
+  for (int i = 0; i < 300 && get_sm_state() == SHUTDOWN; i++) {
+    sim_step(10);
+  }
+  TEST_ASSERT_TRUE(sim_power_restart());
+  native_set_pin(EXT_INT_PIN, false);
+  sim_step(100);
+  TEST_ASSERT_EQUAL(ON, get_sm_state());
+
+  uint8_t shutdown[] = {0x30, 1};
+  native_i2c_write(shutdown, 2);
+  loop();
+  TEST_ASSERT_EQUAL(OFF, get_sm_state());
+  native_set_pin(EXT_INT_PIN, true);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_queue_stress);
+  RUN_TEST(test_shutdown_held_while_charging);
+  RUN_TEST(test_back_to_back_writes);
+  RUN_TEST(test_overflows_counted);
+  RUN_TEST(test_watchdog_limit_restarts_watchdog);
+  RUN_TEST(test_ext_and_host_shutdown_reset);
+  return UNITY_END();
+}
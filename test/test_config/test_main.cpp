@@ -0,0 +1,223 @@
+// EEPROM settings log: write coalescing, slot rotation, recovery from a
+// corrupt record and the background EEPROM writer.
+
+#include <string.h>
+#include <unity.h>
+
+#include "analog_io.h"
+#include "config.h"
+#include "constants.h"
+#include "globals.h"
+#include "hal.h"
+#include "history.h"
+#include "native_sim.h"
+#include "nvm.h"
+#include "state_machine.h"
+
+static uint8_t before[NATIVE_EEPROM_SIZE];
+
+// Number of config slots that differ from the copy of the EEPROM taken
+// before the test step, and the last of them
+static int config_slots_changed(int& slot) {
+  int changed = 0;
+  for (int i = 0; i < CONFIG_NUM_SLOTS; i++) {
+    int address = i * CONFIG_RECORD_SIZE;
+    if (memcmp(&before[address], &native_eeprom[address],
+               CONFIG_RECORD_SIZE) != 0) {
+      changed++;
+      slot = i;
+    }
+  }
+  return changed;
+}
+
+static void send_brightness(uint8_t value) {
+  uint8_t brightness[] = {0x17, value};
+  native_i2c_write(brightness, 2);
+}
+
+void setUp() { memcpy(before, native_eeprom, sizeof(before)); }
+void tearDown() {}
+
+void test_defaults_on_blank_eeprom() {
+  memset(native_eeprom, 0xff, sizeof(native_eeprom));
+  config_load();
+  TEST_ASSERT_EQUAL(int(VCAP_POWER_ON / VCAP_MAX * VCAP_SCALE),
+                    power_on_vcap_voltage);
+  TEST_ASSERT_EQUAL(0xff, led_global_brightness);
+  TEST_ASSERT_EQUAL(ADC_OVERSAMPLE_LOG2, adc_sampler_get_oversampling());
+  TEST_ASSERT_EQUAL(HISTORY_INTERVAL, history_get_interval());
+}
+
+void test_legacy_settings() {
+  // settings left at the fixed addresses by older firmware
+  int16_t legacy_power_on = 800;
+  uint8_t legacy_brightness = 40;
+  EEPROM.put(EEPROM_POWER_ON_VCAP_ADDR, legacy_power_on);
+  EEPROM.put(EEPROM_LED_BRIGHTNESS_ADDR, legacy_brightness);
+  config_load();
+  TEST_ASSERT_EQUAL(800, power_on_vcap_voltage);
+  TEST_ASSERT_EQUAL(40, led_global_brightness);
+
+  memcpy(before, native_eeprom, sizeof(before));
+  TEST_ASSERT_TRUE_MESSAGE(config_commit(), "first commit queues a record");
+  TEST_ASSERT_TRUE(config_pending());
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(before, native_eeprom, sizeof(before),
+                                   "record written in the background");
+  uint32_t operations = native_nvm_operations;
+  sim_wait_nvm();
+  TEST_ASSERT_EQUAL_MESSAGE(1, native_nvm_operations - operations,
+                            "record written with one page operation");
+  int slot = -1;
+  TEST_ASSERT_EQUAL(1, config_slots_changed(slot));
+  TEST_ASSERT_EQUAL_MESSAGE(1, slot,
+                            "legacy settings kept until the log wraps");
+
+  config_load();
+  TEST_ASSERT_EQUAL(800, power_on_vcap_voltage);
+  TEST_ASSERT_EQUAL(40, led_global_brightness);
+  TEST_ASSERT_FALSE_MESSAGE(config_commit(), "unchanged settings not written");
+}
+
+void test_burst_committed_once() {
+  TEST_ASSERT_TRUE(sim_power_up());
+  memcpy(before, native_eeprom, sizeof(before));
+  uint32_t eeprom_writes = native_eeprom_writes;
+  for (int i = 0; i < 10; i++) {
+    send_brightness(100 + i);
+    sim_step(100);
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(eeprom_writes, native_eeprom_writes,
+                            "nothing written during the burst");
+  sim_step(CONFIG_SETTLE_TIME);
+  int slot;
+  TEST_ASSERT_EQUAL(1, config_slots_changed(slot));
+  TEST_ASSERT_LESS_OR_EQUAL(CONFIG_RECORD_SIZE,
+                            native_eeprom_writes - eeprom_writes);
+}
+
+void test_steady_stream_committed() {
+  for (int i = 0; i < CONFIG_MAX_COMMIT_DELAY / 500; i++) {
+    send_brightness(i);
+    sim_step(500);
+  }
+  int slot;
+  TEST_ASSERT_EQUAL_MESSAGE(1, config_slots_changed(slot),
+                            "commit not deferred past the maximum delay");
+}
+
+void test_slot_rotation() {
+  // one commit per slot overwrites every record once
+  for (int i = 0; i < CONFIG_NUM_SLOTS; i++) {
+    led_global_brightness = i;
+    config_commit();
+    sim_wait_nvm();
+  }
+  int slot;
+  TEST_ASSERT_EQUAL(CONFIG_NUM_SLOTS, config_slots_changed(slot));
+  config_load();
+  TEST_ASSERT_EQUAL_MESSAGE(CONFIG_NUM_SLOTS - 1, led_global_brightness,
+                            "newest record wins after wrapping");
+}
+
+void test_corrupt_record_skipped() {
+  // a torn write of the newest record falls back to the previous one
+  led_global_brightness = 77;
+  config_commit();
+  sim_wait_nvm();
+  int slot = -1;
+  config_slots_changed(slot);
+  native_eeprom[slot * CONFIG_RECORD_SIZE + 5] ^= 0x10;
+  config_load();
+  TEST_ASSERT_EQUAL(CONFIG_NUM_SLOTS - 1, led_global_brightness);
+
+  led_global_brightness = 78;
+  config_commit();
+  sim_wait_nvm();
+  config_load();
+  TEST_ASSERT_EQUAL_MESSAGE(78, led_global_brightness,
+                            "commit after a corrupt record");
+}
+
+void test_sequence_wraparound() {
+  for (uint32_t i = 0; i < 0x10000; i++) {
+    led_global_brightness = i & 1;
+    config_commit();
+    sim_wait_nvm();
+  }
+  led_global_brightness = 5;
+  config_commit();
+  sim_wait_nvm();
+  config_load();
+  TEST_ASSERT_EQUAL(5, led_global_brightness);
+}
+
+void test_writes_refused_on_low_supercap() {
+  // no writes are started in DEPLETING on a low supercap
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(3.0));
+  native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN,
+                          sim_vcap_counts(VCAP_NVM_MIN - 0.2));
+  sim_step(100);
+  memcpy(before, native_eeprom, sizeof(before));
+  send_brightness(33);
+  sim_step(CONFIG_SETTLE_TIME * 2);
+  TEST_ASSERT_EQUAL(DEPLETING, get_sm_state());
+  TEST_ASSERT_TRUE(config_pending());
+  TEST_ASSERT_EQUAL_MEMORY(before, native_eeprom, sizeof(before));
+
+  // written once power returns
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(12.0));
+  native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN, sim_vcap_counts(8.5));
+  sim_step(CONFIG_SETTLE_TIME + 100);
+  config_load();
+  TEST_ASSERT_FALSE(config_pending());
+  TEST_ASSERT_EQUAL(33, led_global_brightness);
+}
+
+void test_writes_gated_by_power_in_any_state() {
+  uint8_t shutdown[] = {0x30, 1};
+  native_i2c_write(shutdown, 2);
+  sim_step(100);
+  TEST_ASSERT_EQUAL(SHUTDOWN, get_sm_state());
+
+  // no DC IN and a low supercap while the host shuts down
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(3.0));
+  native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN,
+                          sim_vcap_counts(VCAP_NVM_MIN - 0.2));
+  sim_step(100);
+  memcpy(before, native_eeprom, sizeof(before));
+  send_brightness(44);
+  sim_step(CONFIG_SETTLE_TIME * 2);
+  TEST_ASSERT_EQUAL(SHUTDOWN, get_sm_state());
+  TEST_ASSERT_TRUE(config_pending());
+  TEST_ASSERT_EQUAL_MEMORY(before, native_eeprom, sizeof(before));
+
+  // DC IN alone allows the write, whatever the supercap voltage
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(12.0));
+  sim_step(CONFIG_SETTLE_TIME + 100);
+  TEST_ASSERT_EQUAL(SHUTDOWN, get_sm_state());
+  TEST_ASSERT_FALSE(config_pending());
+  config_load();
+  TEST_ASSERT_EQUAL(44, led_global_brightness);
+
+  native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN, sim_vcap_counts(8.5));
+  native_set_pin(GPIO_POWEROFF_PIN, false);
+  for (int i = 0; i < 300 && get_sm_state() == SHUTDOWN; i++) {
+    sim_step(10);
+  }
+  TEST_ASSERT_TRUE(sim_power_restart());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_on_blank_eeprom);
+  RUN_TEST(test_legacy_settings);
+  RUN_TEST(test_burst_committed_once);
+  RUN_TEST(test_steady_stream_committed);
+  RUN_TEST(test_slot_rotation);
+  RUN_TEST(test_corrupt_record_skipped);
+  RUN_TEST(test_sequence_wraparound);
+  RUN_TEST(test_writes_refused_on_low_supercap);
+  RUN_TEST(test_writes_gated_by_power_in_any_state);
+  return UNITY_END();
+}
@@ -0,0 +1,111 @@
+// Energy and charge counters against synthetic DC IN traces, integrated
+// both by the firmware and here in floating point from the same quantized
+// samples.
+
+#include <math.h>
+#include <unity.h>
+
+#include "constants.h"
+#include "energy.h"
+#include "globals.h"
+#include "hal.h"
+#include "native_sim.h"
+
+struct EnergyTrace {
+  uint32_t now;
+  double previous_w;
+  double previous_a;
+  double mwh;
+  double mah;
+};
+
+static EnergyTrace trace;
+static double boot_mwh;
+static double boot_mah;
+
+static void energy_trace_sample(double v, double i, uint32_t interval) {
+  uint16_t v_word = v / VIN_MAX * 65535;
+  uint16_t i_word = i / IIN_MAX * 65535;
+  double w = v_word * VIN_MAX / 65536 * i_word * IIN_MAX / 65536;
+  double a = i_word * IIN_MAX / 65536;
+  trace.now += interval;
+  trace.mwh += (trace.previous_w + w) / 2 * interval / 3600;
+  trace.mah += (trace.previous_a + a) / 2 * interval / 3600;
+  trace.previous_w = w;
+  trace.previous_a = a;
+  energy_record(v_word, i_word, trace.now);
+}
+
+static void assert_totals_near(EnergyCounter counter, double mwh,
+                               double mah) {
+  EnergyTotals totals;
+  energy_get(counter, totals);
+  // The counters drop the fractions of a unit. The sample power is
+  // rounded, so allow some slack in the energy.
+  double slack = 0.001 * mwh;
+  TEST_ASSERT_TRUE(totals.mwh <= mwh + slack);
+  TEST_ASSERT_TRUE(totals.mwh >= mwh - 1 - slack);
+  TEST_ASSERT_TRUE(totals.mah <= mah + 1e-6);
+  TEST_ASSERT_TRUE(totals.mah >= mah - 1);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_constant_load() {
+  // an hour at a constant 12 V, 1 A, sampled every SAMPLE_INTERVAL
+  energy_trace_sample(12.0, 1.0, 0);
+  for (uint32_t t = 0; t < 3600000; t += SAMPLE_INTERVAL) {
+    energy_trace_sample(12.0, 1.0, SAMPLE_INTERVAL);
+  }
+  assert_totals_near(ENERGY_SINCE_BOOT, trace.mwh, trace.mah);
+  boot_mwh = trace.mwh;
+  boot_mah = trace.mah;
+}
+
+void test_ramp_with_jitter() {
+  // a current ramp at 24 V with jittered sample intervals
+  energy_reset_trip();
+  trace.mwh = trace.mah = 0;
+  for (uint32_t n = 0; n < 150000; n++) {
+    uint32_t interval = SAMPLE_INTERVAL - 3 + (n * 7919) % 7;
+    energy_trace_sample(24.0, 1.5 * n / 150000, interval);
+  }
+  assert_totals_near(ENERGY_TRIP, trace.mwh, trace.mah);
+  // the since-boot counter keeps counting across a trip reset
+  assert_totals_near(ENERGY_SINCE_BOOT, boot_mwh + trace.mwh,
+                     boot_mah + trace.mah);
+}
+
+void test_long_gap_capped() {
+  // a gap in the samples only counts for ENERGY_MAX_INTERVAL
+  energy_reset_trip();
+  trace.mwh = trace.mah = 0;
+  energy_trace_sample(12.0, 1.0, 60000);
+  assert_totals_near(ENERGY_TRIP, trace.mwh * ENERGY_MAX_INTERVAL / 60000,
+                     trace.mah * ENERGY_MAX_INTERVAL / 60000);
+}
+
+void test_trip_energy_in_registers() {
+  // the running firmware integrates the sampled input
+  TEST_ASSERT_TRUE(sim_power_up());
+  native_set_analog_input(I_IN_ADC_NUM, I_IN_ADC_AIN, 512);
+  sim_step(100);
+  uint8_t reset[] = {0x52, 1};
+  native_i2c_write(reset, 2);
+  sim_step(60000);
+  double w = v_in_word * VIN_MAX / 65536 * i_in_word * IIN_MAX / 65536;
+  uint8_t reg[8];
+  native_i2c_read(0x52, reg, 8);
+  uint32_t mwh = (uint32_t)reg[0] << 24 | reg[1] << 16 | reg[2] << 8 | reg[3];
+  TEST_ASSERT_TRUE(fabs(mwh - w * 60000 / 3600) < 0.01 * mwh);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_constant_load);
+  RUN_TEST(test_ramp_with_jitter);
+  RUN_TEST(test_long_gap_capped);
+  RUN_TEST(test_trip_energy_in_registers);
+  return UNITY_END();
+}
@@ -0,0 +1,89 @@
+// History FIFO readout through I2C registers 0x25 and 0x26: records and
+// the overflow flag are only removed once the host has read them in full.
+
+#include <unity.h>
+
+#include "constants.h"
+#include "history.h"
+#include "native_sim.h"
+
+// Records are told apart by their Vin word
+static void record(uint16_t v_in) { history_record(v_in, 0, 0, 0); }
+
+static uint8_t read_count() {
+  uint8_t reg[2];
+  native_i2c_read(0x26, reg, 2);
+  return reg[0];
+}
+
+static void drain() {
+  uint8_t records[HISTORY_READ_MAX * HISTORY_RECORD_SIZE];
+  for (uint8_t count = read_count(); count; count = read_count()) {
+    uint8_t n = count < HISTORY_READ_MAX ? count : HISTORY_READ_MAX;
+    native_i2c_read(0x25, records, n * HISTORY_RECORD_SIZE);
+  }
+  // clear the overflow flag
+  read_count();
+}
+
+static uint16_t record_v_in(const uint8_t* record) {
+  return record[0] << 8 | record[1];
+}
+
+void setUp() {
+  history_set_interval(1);
+  drain();
+}
+void tearDown() {}
+
+void test_partial_read_keeps_records() {
+  for (uint16_t v = 1; v <= 3; v++) {
+    record(v);
+  }
+  uint8_t records[HISTORY_READ_MAX * HISTORY_RECORD_SIZE];
+
+  // the host stops one and a half records in
+  native_i2c_read(0x25, records, HISTORY_RECORD_SIZE * 3 / 2);
+  TEST_ASSERT_EQUAL(1, record_v_in(&records[0]));
+  TEST_ASSERT_EQUAL(2, read_count());
+
+  // a single byte does not take the record either
+  native_i2c_read(0x25, records, 1);
+  TEST_ASSERT_EQUAL(2, read_count());
+
+  native_i2c_read(0x25, records, sizeof(records));
+  TEST_ASSERT_EQUAL(2, record_v_in(&records[0]));
+  TEST_ASSERT_EQUAL(3, record_v_in(&records[HISTORY_RECORD_SIZE]));
+  TEST_ASSERT_EQUAL(0, read_count());
+}
+
+void test_overflow_cleared_when_read() {
+  for (uint16_t v = 0; v <= HISTORY_LENGTH; v++) {
+    record(v);
+  }
+  uint8_t reg[2];
+  // reading only the count leaves the flag set
+  native_i2c_read(0x26, reg, 1);
+  native_i2c_read(0x26, reg, 2);
+  TEST_ASSERT_EQUAL(HISTORY_LENGTH, reg[0]);
+  TEST_ASSERT_EQUAL(1, reg[1]);
+  native_i2c_read(0x26, reg, 2);
+  TEST_ASSERT_EQUAL(0, reg[1]);
+
+  // a record dropped after the flag was read, before it is cleared, sets
+  // it again
+  record(0);
+  native_i2c_read(0x26, reg, 2);
+  TEST_ASSERT_EQUAL(1, reg[1]);
+  record(0);
+  native_i2c_read(0x26, reg, 2);
+  TEST_ASSERT_EQUAL(1, reg[1]);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  TEST_ASSERT_TRUE(sim_power_up());
+  RUN_TEST(test_partial_read_keeps_records);
+  RUN_TEST(test_overflow_cleared_when_read);
+  return UNITY_END();
+}
@@ -0,0 +1,134 @@
+// Hold-up time prediction against simulated supercap discharges.
+
+#include <math.h>
+#include <unity.h>
+
+#include "constants.h"
+#include "hal.h"
+#include "holdup.h"
+#include "native_sim.h"
+#include "state_machine.h"
+
+// Supercap discharged by a constant-power load: Vcap^2 falls linearly at
+// `rate` V^2/s.
+struct Discharge {
+  double v2;
+  double rate;
+};
+
+// 30 s from 8.5 V to the power-off threshold
+static const Discharge full_discharge = {
+    8.5 * 8.5, (8.5 * 8.5 - VCAP_POWER_OFF * VCAP_POWER_OFF) / 30};
+
+static Discharge d;
+static uint32_t now;
+
+// Seconds until the supercap reaches v_off
+static double discharge_remaining(double v_off) {
+  return (d.v2 - v_off * v_off) / d.rate;
+}
+
+// Supercap voltage after another interval
+static double discharge_step(uint32_t interval_ms) {
+  d.v2 -= d.rate * interval_ms / 1000;
+  return sqrt(d.v2);
+}
+
+// Left-aligned 16-bit supercap voltage, as oversampled by the ADC
+static uint16_t vcap_word(double v) { return v / VCAP_MAX * 65536; }
+
+static uint16_t discharge_sample(uint32_t interval_ms) {
+  return vcap_word(discharge_step(interval_ms));
+}
+
+static void assert_prediction_near(uint16_t tenths, double expected) {
+  TEST_ASSERT_NOT_EQUAL(HOLDUP_UNKNOWN, tenths);
+  TEST_ASSERT_FLOAT_WITHIN(0.05 * expected, expected, tenths / 10.0);
+}
+
+static uint16_t predict() {
+  return holdup_get_tenths(sim_vcap_counts(VCAP_POWER_OFF));
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_single_sample() {
+  d = full_discharge;
+  holdup_start();
+  holdup_record(discharge_sample(0), now);
+  TEST_ASSERT_EQUAL(HOLDUP_UNKNOWN, predict());
+}
+
+void test_prediction_after_5_s() {
+  for (; now < 5000; now += SAMPLE_INTERVAL) {
+    holdup_record(discharge_sample(SAMPLE_INTERVAL), now);
+  }
+  assert_prediction_near(predict(), discharge_remaining(VCAP_POWER_OFF));
+}
+
+void test_follows_load_change() {
+  // the host shuts down and draws half the power
+  d.rate /= 2;
+  for (uint32_t end = now + 10000; now < end; now += SAMPLE_INTERVAL) {
+    holdup_record(discharge_sample(SAMPLE_INTERVAL), now);
+  }
+  assert_prediction_near(predict(), discharge_remaining(VCAP_POWER_OFF));
+}
+
+void test_steady_voltage() {
+  // a steady voltage gives no prediction
+  for (uint32_t end = now + 10000; now < end; now += SAMPLE_INTERVAL) {
+    holdup_record(vcap_word(7.0), now);
+  }
+  TEST_ASSERT_EQUAL(HOLDUP_UNKNOWN, predict());
+  holdup_stop();
+}
+
+void test_slow_discharge_resolution() {
+  // A light load: 10 min from 8.5 V to the power-off threshold. The 10-bit
+  // reading drops by one step in 2 s, so only the oversampled voltage
+  // gives a slope this early.
+  d = full_discharge;
+  d.rate /= 20;
+  holdup_start();
+  for (uint32_t end = now + 2000; now < end; now += SAMPLE_INTERVAL) {
+    holdup_record(discharge_sample(SAMPLE_INTERVAL), now);
+  }
+  assert_prediction_near(predict(), discharge_remaining(VCAP_POWER_OFF));
+  holdup_stop();
+}
+
+void test_register_in_depleting() {
+  // the firmware predicts from its own samples while DEPLETING
+  TEST_ASSERT_TRUE(sim_power_up());
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(3.0));
+  d = full_discharge;
+  for (int i = 0; i < 600; i++) {
+    native_set_analog_input(V_CAP_ADC_NUM, V_CAP_ADC_AIN,
+                            sim_vcap_counts(discharge_step(10)));
+    sim_step(10);
+  }
+  TEST_ASSERT_EQUAL(DEPLETING, get_sm_state());
+  assert_prediction_near(sim_read_word(0x29),
+                         discharge_remaining(VCAP_POWER_OFF));
+}
+
+void test_register_unknown_when_on() {
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(12.0));
+  sim_step(100);
+  TEST_ASSERT_EQUAL(ON, get_sm_state());
+  TEST_ASSERT_EQUAL_HEX16(0xffff, sim_read_word(0x29));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_sample);
+  RUN_TEST(test_prediction_after_5_s);
+  RUN_TEST(test_follows_load_change);
+  RUN_TEST(test_steady_voltage);
+  RUN_TEST(test_slow_discharge_resolution);
+  RUN_TEST(test_register_in_depleting);
+  RUN_TEST(test_register_unknown_when_on);
+  return UNITY_END();
+}
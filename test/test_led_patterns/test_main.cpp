@@ -0,0 +1,170 @@
+// LED patterns: every shipped pattern is decoded and rendered for two
+// cycles, and each frame is checked against the segment active at its
+// time. Run with -v to see the pattern timelines.
+
+#include <stdio.h>
+#include <unity.h>
+
+#include "blinker.h"
+#include "globals.h"
+#include "led_patterns.h"
+
+// Blinker with access to the rendered values
+class PatternRenderer : public LedBlinker {
+ public:
+  PatternRenderer(const int* pins) : LedBlinker(pins, no_pattern, 0x8000) {
+    set_bar(0);
+  }
+
+  // Restart a pattern from its first segment and render the first frame
+  void start(const LedPatternSegment* pattern) {
+    pattern_ = pattern;
+    pattern_index_ = 0;
+    start_segment();
+    update_led_values();
+  }
+
+  // LED value at full global brightness
+  uint8_t value(int led) const { return (led_value_[led] + 127) / 255; }
+};
+
+struct NamedPattern {
+  const char* name;
+  const LedPatternSegment* pattern;
+};
+
+static const NamedPattern shipped_patterns[] = {
+    {"off", off_pattern},
+    {"power_off", power_off_pattern},
+    {"no", no_pattern},
+    {"watchdog", watchdog_pattern},
+    {"vcap_alarm", vcap_alarm_pattern},
+    {"depleting", depleting_pattern},
+    {"shutdown", shutdown_pattern},
+    {"watchdog_reboot", watchdog_reboot_pattern},
+    {"sleep", sleep_pattern},
+};
+
+// fade up linearly, then down with easing
+static constexpr auto fade_pattern =
+    led_pattern(led_segment({0, 0, 0, 0}, 0b1111, 100, LED_FADE_LINEAR),
+                led_segment({255, 255, 255, 255}, 0b1111, 100, LED_FADE_EASE));
+
+// a slow eased fade, long enough to show single-step rounding errors
+static constexpr auto slow_ease_pattern =
+    led_pattern(led_segment({0, 0, 0, 0}, 0b1111, 1500, LED_FADE_EASE),
+                led_segment({255, 255, 255, 255}, 0b1111, 100));
+
+static PatternRenderer& get_renderer() {
+  static const int pins[NUM_LEDS] = {LED1_PIN, LED2_PIN, LED3_PIN, LED4_PIN};
+  static PatternRenderer renderer(pins);
+  return renderer;
+}
+
+// Print the frames of two pattern cycles where the values change, and
+// check that each frame shows the segment active at its time.
+static bool render_pattern(const NamedPattern& named) {
+  const LedPatternSegment* pattern = named.pattern;
+  uint32_t period = 0;
+  for (int i = 0; pattern[i].duration(); i++) {
+    period += pattern[i].duration();
+  }
+  printf("%s (%u ms):\n", named.name, period);
+  for (int i = 0; pattern[i].duration(); i++) {
+    const LedPatternSegment& segment = pattern[i];
+    printf("  segment %d: %3u %3u %3u %3u mask 0x%x %4u ms fade %u\n", i,
+           segment.brightness[0], segment.brightness[1], segment.brightness[2],
+           segment.brightness[3], segment.mask(), segment.duration(),
+           segment.fade());
+  }
+
+  PatternRenderer& renderer = get_renderer();
+  bool ok = true;
+  int previous[NUM_LEDS] = {-1, -1, -1, -1};
+  renderer.start(named.pattern);
+  for (uint32_t t = 0; t < 2 * period; t += BLINKER_INTERVAL) {
+    if (t) {
+      renderer.tick();
+    }
+    bool changed = false;
+    for (int led = 0; led < NUM_LEDS; led++) {
+      changed |= renderer.value(led) != previous[led];
+    }
+    if (changed) {
+      printf("  %6u ms:", t);
+      for (int led = 0; led < NUM_LEDS; led++) {
+        previous[led] = renderer.value(led);
+        printf(" %3d", previous[led]);
+      }
+      printf("\n");
+    }
+    // find the segment active at t
+    uint32_t start = t - t % period;
+    int index = 0;
+    while (start + pattern[index].duration() <= t) {
+      start += pattern[index++].duration();
+    }
+    if (pattern[index].fade() != LED_FADE_STEP) {
+      continue;
+    }
+    for (int led = 0; led < NUM_LEDS; led++) {
+      bool masked = pattern[index].mask() & (1 << (NUM_LEDS - 1 - led));
+      uint8_t expected = masked ? pattern[index].brightness[led] : 0;
+      ok &= renderer.value(led) == expected;
+    }
+  }
+  return ok;
+}
+
+void setUp() { led_global_brightness = 255; }
+void tearDown() {}
+
+void test_shipped_patterns() {
+  for (const NamedPattern& named : shipped_patterns) {
+    TEST_ASSERT_TRUE_MESSAGE(render_pattern(named), named.name);
+  }
+}
+
+void test_fades() {
+  TEST_ASSERT_TRUE(render_pattern({"fade", fade_pattern}));
+  PatternRenderer& renderer = get_renderer();
+  uint8_t values[20];
+  renderer.start(fade_pattern);
+  values[0] = renderer.value(0);
+  for (int i = 1; i < 20; i++) {
+    renderer.tick();
+    values[i] = renderer.value(0);
+  }
+  // fades change on every frame
+  for (int i = 1; i < 10; i++) {
+    TEST_ASSERT_GREATER_THAN(values[i - 1], values[i]);
+    TEST_ASSERT_LESS_THAN(values[i + 9], values[i + 10]);
+  }
+  // fades pass the midpoint halfway
+  TEST_ASSERT_UINT_WITHIN(1, 127, values[5]);
+  TEST_ASSERT_UINT_WITHIN(2, 127, values[15]);
+  // an ease fade starts slower than a linear one
+  TEST_ASSERT_GREATER_THAN(255 - values[2] + 16, values[12]);
+}
+
+void test_slow_ease_never_reverses() {
+  PatternRenderer& renderer = get_renderer();
+  renderer.start(slow_ease_pattern);
+  int previous = renderer.value(0);
+  TEST_ASSERT_EQUAL(0, previous);
+  for (int i = 1; i < 150; i++) {
+    renderer.tick();
+    TEST_ASSERT_GREATER_OR_EQUAL(previous, renderer.value(0));
+    previous = renderer.value(0);
+  }
+  renderer.tick();
+  TEST_ASSERT_EQUAL(255, renderer.value(0));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_shipped_patterns);
+  RUN_TEST(test_fades);
+  RUN_TEST(test_slow_ease_never_reverses);
+  return UNITY_END();
+}
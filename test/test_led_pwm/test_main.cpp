@@ -0,0 +1,147 @@
+// LED PWM output: the frame engine writes only the changed PWM outputs at
+// the start of a PWM period and dithers only fractional duties, the gamma
+// table, and the accuracy of the dithered duty values.
+
+#include <unity.h>
+
+#include "gamma.h"
+#include "hal.h"
+#include "led_pwm.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Output level of a TCA0 channel as seen on the pin
+static uint8_t tca_level(uint8_t cmp, uint8_t enable_bm, PORT_t& port,
+                         uint8_t pin_bm) {
+  if (TCA0.SPLIT.CTRLB & enable_bm) {
+    return cmp;
+  }
+  return (port.OUT & pin_bm) ? 255 : 0;
+}
+
+void test_frame_committed_at_period_start() {
+  led_pwm_init();
+  native_advance(1);
+
+  uint16_t frame[NUM_LEDS] = {10 << 4, 20 << 4, 30 << 4, 40 << 4};
+  TEST_ASSERT_TRUE(led_pwm_set(frame));
+  TEST_ASSERT_TRUE(led_pwm_pending());
+  TEST_ASSERT_EQUAL_MESSAGE(0, TCA0.SPLIT.LCMP0,
+                            "TCA0 waits for the period start");
+  TEST_ASSERT_EQUAL_MESSAGE(40, native_pwm[LED4_PIN], "TCD0 written at once");
+  native_advance(1);
+  TEST_ASSERT_FALSE(led_pwm_pending());
+  TEST_ASSERT_EQUAL(10, TCA0.SPLIT.LCMP0);
+  TEST_ASSERT_EQUAL(20, TCA0.SPLIT.LCMP1);
+  TEST_ASSERT_EQUAL(30, TCA0.SPLIT.HCMP0);
+  TEST_ASSERT_EQUAL(TCA_SPLIT_LCMP0EN_bm | TCA_SPLIT_LCMP1EN_bm |
+                        TCA_SPLIT_HCMP0EN_bm,
+                    TCA0.SPLIT.CTRLB);
+
+  // an unchanged frame writes nothing
+  TEST_ASSERT_FALSE(led_pwm_set(frame));
+  TEST_ASSERT_FALSE(led_pwm_pending());
+  TEST_ASSERT_FALSE(TCA0.SPLIT.INTCTRL & TCA_SPLIT_LUNF_bm);
+}
+
+void test_only_changed_outputs_written() {
+  uint16_t frame[NUM_LEDS] = {10 << 4, 0, GAMMA_DUTY_MAX, 40 << 4};
+  // mark the registers to see which ones are written
+  TCA0.SPLIT.LCMP0 = 0xaa;
+  TCA0.SPLIT.HCMP0 = 0xaa;
+  native_pwm[LED4_PIN] = -1;
+  led_pwm_set(frame);
+  native_advance(1);
+  TEST_ASSERT_EQUAL(0xaa, TCA0.SPLIT.LCMP0);
+  TEST_ASSERT_EQUAL(-1, native_pwm[LED4_PIN]);
+
+  // 0 and 255 drive constant levels
+  TEST_ASSERT_EQUAL(TCA_SPLIT_LCMP0EN_bm, TCA0.SPLIT.CTRLB);
+  TEST_ASSERT_FALSE(PORTB.OUT & PIN1_bm);
+  TEST_ASSERT_TRUE(PORTA.OUT & PIN3_bm);
+}
+
+void test_dither_only_with_fractions() {
+  uint16_t fractional[NUM_LEDS] = {(10 << 4) | 3, 20 << 4, 30 << 4, 0};
+  uint16_t whole[NUM_LEDS] = {10 << 4, 20 << 4, 30 << 4, 0};
+  uint16_t off[NUM_LEDS] = {0, 0, 0, 0};
+
+  led_pwm_set(fractional);
+  for (int i = 0; i < 16; i++) {
+    native_advance(1);
+    TEST_ASSERT_TRUE_MESSAGE(led_pwm_pending(), "dithering");
+  }
+  led_pwm_set(whole);
+  native_advance(1);
+  TEST_ASSERT_FALSE_MESSAGE(led_pwm_pending(), "whole duties");
+  TEST_ASSERT_EQUAL(10, TCA0.SPLIT.LCMP0);
+
+  led_pwm_set(fractional);
+  native_advance(1);
+  led_pwm_set(off);
+  TEST_ASSERT_TRUE(led_pwm_pending());
+  native_advance(1);
+  TEST_ASSERT_FALSE_MESSAGE(led_pwm_pending(), "LEDs off");
+  TEST_ASSERT_EQUAL(0, TCA0.SPLIT.CTRLB);
+}
+
+void test_gamma_table() {
+  TEST_ASSERT_EQUAL(0, gamma_table.duty[0]);
+  TEST_ASSERT_EQUAL(GAMMA_DUTY_MAX, gamma_correct(GAMMA_INPUT_MAX));
+  uint16_t previous = 0;
+  for (uint32_t i = 0; i <= GAMMA_INPUT_MAX; i++) {
+    uint16_t duty = gamma_correct(i);
+    TEST_ASSERT_GREATER_OR_EQUAL(previous, duty);
+    previous = duty;
+  }
+  // distinct output levels at a dark global brightness
+  const uint8_t brightness = 16;
+  uint16_t levels = 0;
+  previous = 0;
+  for (uint16_t value = 1; value < 256; value++) {
+    uint16_t duty = gamma_correct(brightness * value);
+    levels += duty != previous;
+    previous = duty;
+  }
+  TEST_ASSERT_GREATER_THAN(16, levels);
+}
+
+void test_dithered_duty_accuracy() {
+  const uint32_t periods = 320;
+  double max_error = 0;
+  for (uint16_t duty = 0; duty <= GAMMA_DUTY_MAX; duty += 3) {
+    uint16_t frame[NUM_LEDS] = {duty, duty, uint16_t(GAMMA_DUTY_MAX - duty),
+                                0};
+    led_pwm_set(frame);
+    uint32_t sum[3] = {0, 0, 0};
+    // one PWM period per simulated millisecond
+    for (uint32_t i = 0; i < periods; i++) {
+      native_advance(1);
+      sum[0] += tca_level(TCA0.SPLIT.LCMP0, TCA_SPLIT_LCMP0EN_bm, PORTB,
+                          PIN0_bm);
+      sum[1] += tca_level(TCA0.SPLIT.LCMP1, TCA_SPLIT_LCMP1EN_bm, PORTB,
+                          PIN1_bm);
+      sum[2] += tca_level(TCA0.SPLIT.HCMP0, TCA_SPLIT_HCMP0EN_bm, PORTA,
+                          PIN3_bm);
+    }
+    for (int ch = 0; ch < 3; ch++) {
+      double mean = (double)(sum[ch] << GAMMA_DUTY_FRACTION_BITS) / periods;
+      double error = mean > frame[ch] ? mean - frame[ch] : frame[ch] - mean;
+      max_error = error > max_error ? error : max_error;
+    }
+  }
+  // the accumulator carries less than one 8-bit step between frames
+  TEST_ASSERT_TRUE(max_error <=
+                   (double)(1 << GAMMA_DUTY_FRACTION_BITS) / periods);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_committed_at_period_start);
+  RUN_TEST(test_only_changed_outputs_written);
+  RUN_TEST(test_dither_only_with_fractions);
+  RUN_TEST(test_gamma_table);
+  RUN_TEST(test_dithered_duty_accuracy);
+  return UNITY_END();
+}
@@ -0,0 +1,60 @@
+// Power-fail detection: V_IN threshold crossings injected into the
+// simulated ADC and the time taken by the state machine to react.
+
+#include <unity.h>
+
+#include "analog_io.h"
+#include "constants.h"
+#include "hal.h"
+#include "native_sim.h"
+#include "state_machine.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_reaches_on() { TEST_ASSERT_TRUE(sim_power_up()); }
+
+void test_no_trip_above_threshold() {
+  // noise just above the threshold must not trip the monitor
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN,
+                          sim_vin_counts(VIN_OFF + 0.2));
+  sim_step(100);
+  TEST_ASSERT_EQUAL(ON, get_sm_state());
+}
+
+void test_window_comparator_trip() {
+  // drop between sweeps; the window comparator fires on the next conversion
+  sim_step(2);
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(3.0));
+  native_run_adc();
+  loop();
+  TEST_ASSERT_EQUAL(DEPLETING, get_sm_state());
+  sim_step(100);
+  TEST_ASSERT_EQUAL(DEPLETING, get_sm_state());
+}
+
+void test_rearmed_on_power_return() {
+  // power returns; the monitor is re-armed on entering ON
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(12.0));
+  sim_step(100);
+  TEST_ASSERT_EQUAL(ON, get_sm_state());
+}
+
+void test_trip_during_sweep() {
+  // drop while a sweep is running; the sweep result trips the monitor
+  adc_sampler_start();
+  native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN, sim_vin_counts(3.0));
+  native_run_adc();
+  loop();
+  TEST_ASSERT_EQUAL(DEPLETING, get_sm_state());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_reaches_on);
+  RUN_TEST(test_no_trip_above_threshold);
+  RUN_TEST(test_window_comparator_trip);
+  RUN_TEST(test_rearmed_on_power_return);
+  RUN_TEST(test_trip_during_sweep);
+  return UNITY_END();
+}
@@ -0,0 +1,106 @@
+// Deadline scheduler across a millis() wrap-around.
+
+#include <unity.h>
+
+#include "scheduler.h"
+
+// Test tasks record their run times
+static uint32_t task_now;
+static uint32_t task_runs[NUM_TASKS];
+static uint32_t task_last_run[NUM_TASKS];
+static TaskId task_order[8];
+static uint8_t task_order_length;
+
+// start shortly before millis() wraps around
+static const uint32_t start = 0xffffffff - 50;
+
+static void task_ran(TaskId id) {
+  task_runs[id]++;
+  task_last_run[id] = task_now;
+  if (task_order_length < 8) {
+    task_order[task_order_length++] = id;
+  }
+}
+
+static uint16_t fast_task() {
+  task_ran(TASK_ACQUISITION);
+  return 7;
+}
+
+static uint16_t slow_task() {
+  task_ran(TASK_BLINKER);
+  return 10;
+}
+
+static uint16_t one_shot_task() {
+  task_ran(TASK_SM_TIMER);
+  return SCHEDULER_STOP;
+}
+
+static void scheduler_advance(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    task_now++;
+    scheduler_run(task_now);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_first_deadline() {
+  task_now = start;
+  scheduler_add(TASK_ACQUISITION, fast_task);
+  scheduler_add(TASK_BLINKER, slow_task);
+  scheduler_add(TASK_SM_TIMER, one_shot_task);
+  scheduler_run(task_now);
+  scheduler_schedule(TASK_ACQUISITION, 7);
+  scheduler_schedule(TASK_BLINKER, 10);
+  scheduler_schedule(TASK_SM_TIMER, 100);
+  TEST_ASSERT_EQUAL(7, scheduler_time_to_next());
+}
+
+void test_periodic_across_wrap() {
+  scheduler_advance(100);
+  TEST_ASSERT_EQUAL(14, task_runs[TASK_ACQUISITION]);
+  TEST_ASSERT_EQUAL(10, task_runs[TASK_BLINKER]);
+  TEST_ASSERT_EQUAL_UINT32(start + 98, task_last_run[TASK_ACQUISITION]);
+  TEST_ASSERT_EQUAL_UINT32(start + 100, task_last_run[TASK_BLINKER]);
+}
+
+void test_one_shot_runs_once() {
+  TEST_ASSERT_EQUAL(1, task_runs[TASK_SM_TIMER]);
+  TEST_ASSERT_EQUAL_UINT32(start + 100, task_last_run[TASK_SM_TIMER]);
+  TEST_ASSERT_FALSE(scheduler_is_scheduled(TASK_SM_TIMER));
+}
+
+void test_cancelled_one_shot() {
+  scheduler_schedule(TASK_SM_TIMER, 5);
+  scheduler_cancel(TASK_SM_TIMER);
+  scheduler_advance(10);
+  TEST_ASSERT_EQUAL(1, task_runs[TASK_SM_TIMER]);
+}
+
+void test_overdue_in_deadline_order() {
+  // a late scheduler_run() call runs the overdue tasks in deadline order;
+  // the fast task has fallen a full period behind and is run only once
+  scheduler_schedule(TASK_SM_TIMER, 8);
+  task_order_length = 0;
+  task_now += 25;
+  scheduler_run(task_now);
+  TEST_ASSERT_EQUAL(3, task_order_length);
+  TEST_ASSERT_EQUAL(TASK_ACQUISITION, task_order[0]);
+  TEST_ASSERT_EQUAL(TASK_SM_TIMER, task_order[1]);
+  TEST_ASSERT_EQUAL(TASK_BLINKER, task_order[2]);
+  TEST_ASSERT_EQUAL_MESSAGE(7, scheduler_time_to_next(),
+                            "fast task restarts its period");
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_deadline);
+  RUN_TEST(test_periodic_across_wrap);
+  RUN_TEST(test_one_shot_runs_once);
+  RUN_TEST(test_cancelled_one_shot);
+  RUN_TEST(test_overdue_in_deadline_order);
+  return UNITY_END();
+}
@@ -0,0 +1,176 @@
+// Data shared between the TWI interrupt and the main loop, under
+// preemption: a timer signal stands in for the TWI interrupt and
+// interrupts the main loop at arbitrary points, like the interrupt does on
+// the MCU. The handler reads the telemetry block and posts a command;
+// the main loop publishes new register images and consumes the commands.
+// Another handler reads the shutdown statistics while the main loop
+// records shutdowns and renders them into the statistics cache.
+
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unity.h>
+
+#include "commands.h"
+#include "globals.h"
+#include "hal.h"
+#include "native_sim.h"
+#include "shrpi_i2c.h"
+#include "shutdown_stats.h"
+
+// Handler statistics; written in the handler only
+static volatile uint32_t isr_reads;
+static volatile uint32_t isr_torn;
+static volatile uint32_t isr_stale;
+static volatile uint16_t isr_last_sequence;
+static volatile uint8_t isr_next_brightness;
+
+// Difference between the block sequence number and the publication round
+static uint16_t sequence_offset;
+
+// Telemetry values published in round k, so that an image mixing two
+// rounds is recognized
+static void publish(uint16_t k) {
+  v_in_word = k;
+  v_supercap_word = ~k;
+  i_in_word = k * 3;
+  temperature_K = k ^ 0x5555;
+  update_I2C_register_file(true);
+}
+
+static uint16_t get_word(const uint8_t* src) { return src[0] << 8 | src[1]; }
+
+// Read registers 0x20-0x23 and the telemetry block at 0x24 that follows
+// them. Returns false if they are not all from the same round.
+static bool read_telemetry(uint16_t& sequence) {
+  uint8_t data[8 + 15];
+  native_i2c_read(0x20, data, sizeof(data));
+  const uint8_t* block = &data[8];
+  uint16_t k = get_word(&data[0]);
+  sequence = get_word(&block[1]);
+  return get_word(&data[2]) == (uint16_t)~k &&
+         get_word(&data[4]) == (uint16_t)(k * 3) &&
+         get_word(&data[6]) == (k ^ 0x5555) &&
+         memcmp(&block[3], &data[0], 8) == 0 &&
+         (uint16_t)(sequence - k) == sequence_offset;
+}
+
+static void twi_interrupt() {
+  uint16_t sequence;
+  if (!read_telemetry(sequence)) {
+    isr_torn = isr_torn + 1;
+  }
+  // the image served never goes back to an older one
+  if (isr_reads && (int16_t)(sequence - isr_last_sequence) < 0) {
+    isr_stale = isr_stale + 1;
+  }
+  isr_last_sequence = sequence;
+  isr_reads = isr_reads + 1;
+
+  // post a command only if it fits, so that every command is accounted for
+  if (command_queue.size() < COMMAND_QUEUE_LENGTH) {
+    uint8_t brightness[] = {0x17, isr_next_brightness};
+    native_i2c_write(brightness, 2);
+    isr_next_brightness = isr_next_brightness + 1;
+  }
+}
+
+// Read register 0x2A while the histogram is halved now and then
+static void shutdown_stats_interrupt() {
+  uint8_t block[4 + SHUTDOWN_BINS];
+  native_i2c_read(0x2A, block, sizeof(block));
+  uint16_t total = 0;
+  for (uint8_t i = 0; i < SHUTDOWN_BINS; i++) {
+    total += block[4 + i];
+  }
+  if (total >= SHUTDOWN_MAX_SAMPLES) {
+    isr_torn = isr_torn + 1;
+  }
+  isr_reads = isr_reads + 1;
+}
+
+static void (*volatile interrupt_handler)();
+
+static void on_timer(int) { native_interrupt(interrupt_handler); }
+
+static void start_interrupts(void (*handler)(), long interval_us) {
+  isr_reads = 0;
+  isr_torn = 0;
+  interrupt_handler = handler;
+  struct sigaction action = {};
+  action.sa_handler = on_timer;
+  sigaction(SIGALRM, &action, nullptr);
+  struct itimerval timer = {{0, interval_us}, {0, interval_us}};
+  setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+static void stop_interrupts() {
+  struct itimerval timer = {};
+  setitimer(ITIMER_REAL, &timer, nullptr);
+  signal(SIGALRM, SIG_DFL);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_publication_under_preemption() {
+  TEST_ASSERT_TRUE(sim_power_up());
+  publish(0);
+  uint8_t block[15];
+  native_i2c_read(0x24, block, sizeof(block));
+  sequence_offset = get_word(&block[1]);
+
+  uint32_t commands = 0;
+  uint32_t command_errors = 0;
+  uint8_t expected_brightness = 0;
+  uint16_t k = 0;
+
+  start_interrupts(twi_interrupt, 10);
+  while (isr_reads < 20000) {
+    publish(++k);
+    Command command;
+    while (command_queue.pop(command)) {
+      if (command.type != CMD_SET_LED_BRIGHTNESS ||
+          command.value != expected_brightness) {
+        command_errors++;
+      }
+      expected_brightness = command.value + 1;
+      commands++;
+    }
+  }
+  stop_interrupts();
+
+  char message[80];
+  snprintf(message, sizeof(message), "%u reads, %u publications, %u commands",
+           (unsigned)isr_reads, (unsigned)k, (unsigned)commands);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_MESSAGE(0, isr_torn, "torn telemetry blocks");
+  TEST_ASSERT_EQUAL_MESSAGE(0, isr_stale, "older image served");
+  TEST_ASSERT_EQUAL_MESSAGE(0, command_errors, "commands lost or reordered");
+  TEST_ASSERT_GREATER_THAN(0, commands);
+}
+
+void test_shutdown_stats_under_preemption() {
+  TEST_ASSERT_TRUE(sim_power_up());
+
+  uint32_t records = 0;
+  start_interrupts(shutdown_stats_interrupt, 10);
+  while (isr_reads < 20000) {
+    shutdown_stats_record(records++ * 997 % 30000);
+    update_I2C_register_file(false);
+  }
+  stop_interrupts();
+
+  char message[80];
+  snprintf(message, sizeof(message), "%u reads, %u shutdowns",
+           (unsigned)isr_reads, (unsigned)records);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_MESSAGE(0, isr_torn, "histogram read while halved");
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_publication_under_preemption);
+  RUN_TEST(test_shutdown_stats_under_preemption);
+  return UNITY_END();
+}
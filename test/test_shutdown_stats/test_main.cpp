@@ -0,0 +1,198 @@
+// Learned shutdown timeout: the histogram percentile, its persistence and
+// the host-settable ceiling.
+
+#include <string.h>
+#include <unity.h>
+
+#include "config.h"
+#include "constants.h"
+#include "globals.h"
+#include "hal.h"
+#include "native_sim.h"
+#include "shutdown_stats.h"
+#include "state_machine.h"
+
+// Shut the host down through register 0x30. The host powers off after
+// `duration` ms, or never if 0. Returns the time taken to leave SHUTDOWN.
+static uint32_t shutdown_cycle(uint32_t duration) {
+  sim_power_restart();
+  uint8_t shutdown[] = {0x30, 1};
+  native_i2c_write(shutdown, 2);
+  uint32_t elapsed = 0;
+  for (; elapsed < 2 * SHUTDOWN_WAIT_DURATION; elapsed += 10) {
+    if (duration != 0 && elapsed == duration) {
+      native_set_pin(GPIO_POWEROFF_PIN, false);
+    }
+    sim_step(10);
+    if (elapsed > 0 && get_sm_state() != SHUTDOWN) {
+      break;
+    }
+  }
+  sim_wait_nvm();
+  return elapsed;
+}
+
+static void record(uint32_t duration) {
+  shutdown_stats_record(duration);
+  sim_wait_nvm();
+}
+
+static const uint16_t learned_timeout =
+    5 * SHUTDOWN_BIN_WIDTH + SHUTDOWN_MARGIN;
+
+void setUp() {}
+void tearDown() {}
+
+void test_ceiling_on_blank_eeprom() {
+  memset(native_eeprom, 0xff, sizeof(native_eeprom));
+  shutdown_stats_load();
+  TEST_ASSERT_EQUAL(SHUTDOWN_WAIT_DURATION, shutdown_stats_get_timeout());
+}
+
+void test_learned_percentile() {
+  // 8-12 s shutdowns put the 95th percentile in the 10-12.5 s bin
+  uint32_t durations[] = {8000, 10000, 12000, 9000};
+  for (int i = 0; i < 3; i++) {
+    record(durations[i]);
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(SHUTDOWN_WAIT_DURATION,
+                            shutdown_stats_get_timeout(),
+                            "ceiling used until enough shutdowns are seen");
+  record(durations[3]);
+  TEST_ASSERT_EQUAL(learned_timeout, shutdown_stats_get_timeout());
+}
+
+void test_rare_long_shutdown_ignored() {
+  for (int i = 0; i < 20; i++) {
+    record(9000);
+  }
+  record(40000);
+  TEST_ASSERT_EQUAL(learned_timeout, shutdown_stats_get_timeout());
+}
+
+void test_capped_by_ceiling() {
+  shutdown_wait_limit = 10;
+  TEST_ASSERT_EQUAL(10000, shutdown_stats_get_timeout());
+  shutdown_wait_limit = SHUTDOWN_WAIT_DURATION / 1000;
+}
+
+void test_histogram_persistence() {
+  uint8_t bins[SHUTDOWN_BINS];
+  uint8_t expected_bins[SHUTDOWN_BINS];
+
+  // the histogram survives a reboot
+  uint16_t timeout = shutdown_stats_get_timeout();
+  shutdown_stats_get_bins(expected_bins);
+  shutdown_stats_load();
+  shutdown_stats_get_bins(bins);
+  TEST_ASSERT_EQUAL_MEMORY(expected_bins, bins, SHUTDOWN_BINS);
+  TEST_ASSERT_EQUAL(timeout, shutdown_stats_get_timeout());
+
+  // a torn write falls back to the previous copy
+  uint8_t before[NATIVE_EEPROM_SIZE];
+  memcpy(before, native_eeprom, sizeof(before));
+  record(20000);
+  int copy = memcmp(&before[SHUTDOWN_STATS_ADDR],
+                    &native_eeprom[SHUTDOWN_STATS_ADDR],
+                    SHUTDOWN_STATS_SIZE) == 0;
+  native_eeprom[SHUTDOWN_STATS_ADDR + copy * SHUTDOWN_STATS_SIZE + 10] ^= 0x01;
+  shutdown_stats_load();
+  shutdown_stats_get_bins(bins);
+  TEST_ASSERT_EQUAL_MEMORY(expected_bins, bins, SHUTDOWN_BINS);
+}
+
+void test_old_shutdowns_forgotten() {
+  // a host that now takes 30 s gradually replaces the old shutdowns
+  uint8_t bins[SHUTDOWN_BINS];
+  for (int i = 0; i < 2 * SHUTDOWN_MAX_SAMPLES; i++) {
+    record(30000);
+  }
+  shutdown_stats_get_bins(bins);
+  TEST_ASSERT_LESS_OR_EQUAL(1, bins[3]);
+  TEST_ASSERT_EQUAL(13 * SHUTDOWN_BIN_WIDTH + SHUTDOWN_MARGIN,
+                    shutdown_stats_get_timeout());
+}
+
+void test_newest_copy_after_wrap() {
+  // the 8-bit sequence numbers wrap around several times
+  uint8_t bins[SHUTDOWN_BINS];
+  uint8_t expected_bins[SHUTDOWN_BINS];
+  for (int i = 0; i < 600; i++) {
+    record(i % 2 ? 30000 : 9000);
+    shutdown_stats_get_bins(expected_bins);
+    shutdown_stats_load();
+    shutdown_stats_get_bins(bins);
+    TEST_ASSERT_EQUAL_MEMORY(expected_bins, bins, SHUTDOWN_BINS);
+  }
+}
+
+void test_measured_shutdowns() {
+  // the firmware measures real shutdowns and reports them in 0x2A
+  memset(native_eeprom, 0xff, sizeof(native_eeprom));
+  TEST_ASSERT_TRUE(sim_power_up());
+  for (int i = 0; i < SHUTDOWN_MIN_SAMPLES; i++) {
+    shutdown_cycle(8000);
+  }
+  TEST_ASSERT_EQUAL(OFF, get_sm_state());
+  TEST_ASSERT_TRUE(sim_power_restart());
+  TEST_ASSERT_UINT_WITHIN(1, 80, sim_read_word(0x2A, 2));
+  TEST_ASSERT_EQUAL((4 * SHUTDOWN_BIN_WIDTH + SHUTDOWN_MARGIN) / 100,
+                    sim_read_word(0x2A, 0));
+}
+
+void test_hung_host_cut_off() {
+  uint16_t timeout = 4 * SHUTDOWN_BIN_WIDTH + SHUTDOWN_MARGIN;
+  TEST_ASSERT_EQUAL(timeout, shutdown_stats_get_timeout());
+  uint8_t bins[SHUTDOWN_BINS];
+  shutdown_stats_get_bins(bins);
+  uint8_t cutoffs = bins[SHUTDOWN_BINS - 1];
+
+  uint32_t elapsed = shutdown_cycle(0);
+  TEST_ASSERT_EQUAL(OFF, get_sm_state());
+  TEST_ASSERT_GREATER_OR_EQUAL(timeout - 10, elapsed);
+  TEST_ASSERT_LESS_OR_EQUAL(timeout + 100, elapsed);
+
+  // the cut-off is counted as a shutdown longer than any bin, which
+  // raises the learned timeout
+  shutdown_stats_get_bins(bins);
+  TEST_ASSERT_EQUAL(cutoffs + 1, bins[SHUTDOWN_BINS - 1]);
+  TEST_ASSERT_GREATER_THAN(timeout, shutdown_stats_get_timeout());
+  TEST_ASSERT_TRUE(sim_power_restart());
+  TEST_ASSERT_UINT_WITHIN(1, timeout / 100, sim_read_word(0x2A, 2));
+  TEST_ASSERT_GREATER_THAN(timeout / 100, sim_read_word(0x2A, 0));
+}
+
+void test_ceiling_register() {
+  // the ceiling is set through register 0x1A and kept in the settings
+  sim_power_restart();
+  uint8_t limit[] = {0x1A, 200};
+  native_i2c_write(limit, 2);
+  sim_step(10);
+  native_i2c_read(0x1A, limit, 1);
+  TEST_ASSERT_EQUAL_MESSAGE(SHUTDOWN_WAIT_LIMIT_MAX, limit[0],
+                            "ceiling clamped");
+  uint8_t limit_12[] = {0x1A, 12};
+  native_i2c_write(limit_12, 2);
+  sim_step(CONFIG_SETTLE_TIME + 100);
+  sim_wait_nvm();
+  TEST_ASSERT_EQUAL_MESSAGE(120, sim_read_word(0x2A),
+                            "learned timeout capped in 0x2A");
+  shutdown_wait_limit = 0;
+  config_load();
+  TEST_ASSERT_EQUAL_MESSAGE(12, shutdown_wait_limit, "ceiling read back");
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ceiling_on_blank_eeprom);
+  RUN_TEST(test_learned_percentile);
+  RUN_TEST(test_rare_long_shutdown_ignored);
+  RUN_TEST(test_capped_by_ceiling);
+  RUN_TEST(test_histogram_persistence);
+  RUN_TEST(test_old_shutdowns_forgotten);
+  RUN_TEST(test_newest_copy_after_wrap);
+  RUN_TEST(test_measured_shutdowns);
+  RUN_TEST(test_hung_host_cut_off);
+  RUN_TEST(test_ceiling_register);
+  return UNITY_END();
+}
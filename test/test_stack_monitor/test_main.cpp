@@ -0,0 +1,51 @@
+// Stack high-water mark against simulated stack use.
+
+#include <string.h>
+#include <unity.h>
+
+#include "hal.h"
+#include "native_sim.h"
+#include "stack_monitor.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_all_free_at_boot() {
+  native_stack_paint();
+  stack_check();
+  TEST_ASSERT_EQUAL(NATIVE_STACK_SIZE, stack_get_free_min());
+}
+
+void test_high_water_mark() {
+  // a deep call chain, then back to a shallow one
+  native_stack_pointer = 700;
+  memset(&native_stack[native_stack_pointer], 0, NATIVE_STACK_SIZE - 700);
+  native_stack_pointer = 900;
+  stack_check();
+  TEST_ASSERT_EQUAL_MESSAGE(700, stack_get_free_min(), "deepest use found");
+  native_stack_pointer = NATIVE_STACK_SIZE;
+  stack_check();
+  TEST_ASSERT_EQUAL_MESSAGE(700, stack_get_free_min(), "high-water mark kept");
+}
+
+void test_scan_stops_at_stack_pointer() {
+  // canary bytes above the stack pointer are in use, not free
+  native_stack_pointer = 300;
+  stack_check();
+  TEST_ASSERT_EQUAL(300, stack_get_free_min());
+}
+
+void test_reported_in_register() {
+  sim_power_up();
+  sim_step(STACK_CHECK_INTERVAL);
+  TEST_ASSERT_EQUAL(300, sim_read_word(0x27));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_all_free_at_boot);
+  RUN_TEST(test_high_water_mark);
+  RUN_TEST(test_scan_stops_at_stack_pointer);
+  RUN_TEST(test_reported_in_register);
+  return UNITY_END();
+}
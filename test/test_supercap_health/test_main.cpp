@@ -0,0 +1,162 @@
+// Supercap capacitance and ESR estimates against a simulated supercap.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "constants.h"
+#include "digital_io.h"
+#include "hal.h"
+#include "native_sim.h"
+#include "supercap_health.h"
+
+// Supercap charged by a current-limited charger. The 5V converter runs
+// from DC IN while it is present and from the supercap otherwise.
+struct SupercapModel {
+  double c;         // capacitance in F
+  double esr;       // ESR in Ohm
+  double v;         // open-circuit voltage
+  double v_in;      // DC IN voltage
+  double i_charge;  // charger current limit in A
+  double v_full;    // charger float voltage
+  double p_load;    // 5V converter input power in W
+};
+
+// a 5 F, 150 mOhm supercap charged from empty
+static SupercapModel m = {5.0, 0.15, 0.5, 12.0, 1.0, 8.8, 8.0};
+static SupercapHealth saved;
+
+// Run the firmware against the model for the given time
+static void supercap_run(uint32_t ms) {
+  const double dt = 0.01;
+  for (uint32_t t = 0; t < ms; t += 10) {
+    bool load = read_pin(EN5V_PIN);
+    double i_cap = 0;
+    double i_in = 0;
+    if (m.v_in > 0) {
+      i_cap = m.v < m.v_full ? m.i_charge : 0;
+      i_in = i_cap + (load ? m.p_load / m.v : 0);
+    } else if (load) {
+      i_cap = -m.p_load / m.v;
+    }
+    double v_term = m.v + i_cap * m.esr;
+    m.v += i_cap * dt / m.c;
+
+    // dither the 10-bit readings so that averages resolve smaller steps
+    double dither = rand() / (RAND_MAX + 1.0);
+    native_set_analog_input(
+        V_CAP_ADC_NUM, V_CAP_ADC_AIN,
+        uint16_t(v_term / VCAP_MAX * VCAP_SCALE + dither));
+    native_set_analog_input(V_IN_ADC_NUM, V_IN_ADC_AIN,
+                            sim_vin_counts(m.v_in));
+    native_set_analog_input(I_IN_ADC_NUM, I_IN_ADC_AIN,
+                            uint16_t(i_in / IIN_MAX * 1024 + dither));
+    sim_step(10);
+  }
+}
+
+// Cut DC IN after the supercap has been ON for `on_ms` and restore it once
+// the discharge has been measured
+static void supercap_power_fail(uint32_t on_ms) {
+  supercap_run(on_ms);
+  m.v_in = 0;
+  supercap_run(HEALTH_DISCHARGE_WINDOW + 500);
+  m.v_in = 12.0;
+  supercap_run(1000);
+  sim_wait_nvm();
+}
+
+static void assert_estimate_near(uint16_t value, double expected,
+                                 double tolerance) {
+  TEST_ASSERT_NOT_EQUAL(HEALTH_UNKNOWN, value);
+  TEST_ASSERT_FLOAT_WITHIN(tolerance * expected, expected, value);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_capacitance_from_charge() {
+  uint8_t reg[6];
+  memset(native_eeprom, 0xff, sizeof(native_eeprom));
+  sim_idle_pins();
+  native_set_analog_input(0, ADC_TEMPSENSE, 300);
+  setup();
+  supercap_run(100);
+  native_i2c_read(0x2B, reg, 6);
+  const uint8_t unknown[] = {0xff, 0xff, 0xff, 0xff, 0, 0};
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(unknown, reg, 6,
+                                   "unknown on a blank EEPROM");
+  for (int i = 0; i < 6000 && get_sm_state() != ON; i++) {
+    supercap_run(10);
+  }
+  TEST_ASSERT_EQUAL(ON, get_sm_state());
+  SupercapHealth health;
+  supercap_health_get(health);
+  assert_estimate_near(health.capacitance, 5000, 0.03);
+}
+
+void test_estimates_from_power_fail() {
+  // a power failure after the supercap has settled
+  uint8_t reg[6];
+  supercap_power_fail(HEALTH_SETTLE_TIME + 10000);
+  TEST_ASSERT_EQUAL(ON, get_sm_state());
+  native_i2c_read(0x2B, reg, 6);
+  assert_estimate_near(reg[2] << 8 | reg[3], 150, 0.1);
+  assert_estimate_near(reg[0] << 8 | reg[1], 5000, 0.05);
+  TEST_ASSERT_EQUAL_MESSAGE(2, reg[4], "capacitance estimates counted");
+  TEST_ASSERT_EQUAL_MESSAGE(1, reg[5], "ESR estimates counted");
+}
+
+void test_estimates_read_back() {
+  SupercapHealth health;
+  supercap_health_get(saved);
+  supercap_health_load();
+  supercap_health_get(health);
+  TEST_ASSERT_EQUAL_MEMORY(&saved, &health, sizeof(health));
+}
+
+void test_no_estimate_before_settling() {
+  SupercapHealth health;
+  supercap_power_fail(HEALTH_SETTLE_TIME / 2);
+  supercap_health_get(health);
+  TEST_ASSERT_EQUAL(1, health.esr_count);
+  TEST_ASSERT_EQUAL(2, health.capacitance_count);
+}
+
+void test_ageing_moves_averages() {
+  // an ageing supercap pulls the averages a quarter of the way along
+  SupercapHealth health;
+  m.c = 4.0;
+  m.esr = 0.25;
+  supercap_power_fail(HEALTH_SETTLE_TIME + 10000);
+  supercap_health_get(health);
+  assert_estimate_near(health.capacitance, saved.capacitance - 250, 0.02);
+  assert_estimate_near(health.esr, saved.esr + 25, 0.05);
+}
+
+void test_reset_through_register() {
+  // the host forgets the estimates after replacing the supercap
+  uint8_t reg[6];
+  uint8_t reset[] = {0x2B, 1};
+  native_i2c_write(reset, 2);
+  sim_step(10);
+  sim_wait_nvm();
+  supercap_health_load();
+  native_i2c_read(0x2B, reg, 6);
+  TEST_ASSERT_EQUAL(0xff, reg[0]);
+  TEST_ASSERT_EQUAL(0xff, reg[2]);
+  TEST_ASSERT_EQUAL(0, reg[4]);
+  TEST_ASSERT_EQUAL(0, reg[5]);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_capacitance_from_charge);
+  RUN_TEST(test_estimates_from_power_fail);
+  RUN_TEST(test_estimates_read_back);
+  RUN_TEST(test_no_estimate_before_settling);
+  RUN_TEST(test_ageing_moves_averages);
+  RUN_TEST(test_reset_through_register);
+  return UNITY_END();
+}